@@ -0,0 +1,405 @@
+#include <cstddef>
+#include <limits.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <vector>
+#include <deque>
+#include <string>
+#include "types.h"
+#include "utils.h"
+#include "config.h"
+#include "device.h"
+#include "memory.h"
+#include "ula.h"
+#include "z80.h"
+#include "filemap.h"
+#include "disk.h"
+#include "floppy.h"
+#include "divmmc.h"
+#include "keyboard.h"
+#include "joystick.h"
+#include "tape.h"
+#include "recorder.h"
+#include "sound.h"
+#include "snapshot.h"
+#include "movie.h"
+#include "netplay.h"
+#include "gdb.h"
+#include "mouse.h"
+#include "rewind.h"
+#include "board.h"
+#include "batch.h"
+
+static const struct {
+    const char *name;
+    u8 row;                                                 // Keyboard half-row, 8 - Kempston.
+    u8 mask;
+} batch_keys[] = {
+    { "SPACE", 0, 0x01 }, { "SS", 0, 0x02 }, { "M", 0, 0x04 }, { "N", 0, 0x08 }, { "B", 0, 0x10 },
+    { "ENTER", 1, 0x01 }, { "L", 1, 0x02 }, { "K", 1, 0x04 }, { "J", 1, 0x08 }, { "H", 1, 0x10 },
+    { "P", 2, 0x01 }, { "O", 2, 0x02 }, { "I", 2, 0x04 }, { "U", 2, 0x08 }, { "Y", 2, 0x10 },
+    { "0", 3, 0x01 }, { "9", 3, 0x02 }, { "8", 3, 0x04 }, { "7", 3, 0x08 }, { "6", 3, 0x10 },
+    { "1", 4, 0x01 }, { "2", 4, 0x02 }, { "3", 4, 0x04 }, { "4", 4, 0x08 }, { "5", 4, 0x10 },
+    { "Q", 5, 0x01 }, { "W", 5, 0x02 }, { "E", 5, 0x04 }, { "R", 5, 0x08 }, { "T", 5, 0x10 },
+    { "A", 6, 0x01 }, { "S", 6, 0x02 }, { "D", 6, 0x04 }, { "F", 6, 0x08 }, { "G", 6, 0x10 },
+    { "CS", 7, 0x01 }, { "Z", 7, 0x02 }, { "X", 7, 0x04 }, { "C", 7, 0x08 }, { "V", 7, 0x10 },
+    { "RIGHT", 8, JB_Right }, { "LEFT", 8, JB_Left }, { "DOWN", 8, JB_Down }, { "UP", 8, JB_Up }, { "FIRE", 8, JB_A }
+};
+
+struct Batch_Fork {
+    Cfg cfg;
+    Board *board;
+    u32 frame;                                              // The frame it's forked before.
+    u32 state_hash;
+};
+
+struct Batch_Queue {
+    std::mutex mutex;
+    std::deque<size_t> jobs;
+};
+
+static u32 fnv(u32 hash, const void *data, size_t size){
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ ((const u8*)data)[i]) * 0x01000193;
+    return hash;
+}
+
+static bool parse_event(const char *token, Batch_Event &event){
+    char *end;
+    memset(&event, 0, sizeof(event));
+    event.frame = strtoul(token, &end, 10);
+    event.hold = BATCH_HOLD;
+    if (end == token || *end != ':')
+        return false;
+    std::string keys = end + 1;
+    size_t colon = keys.find(':');
+    if (colon != std::string::npos){
+        event.hold = strtoul(keys.c_str() + colon + 1, &end, 10);
+        if (*end || !event.hold)
+            return false;
+        keys.resize(colon);
+    }
+    for (size_t pos = 0; pos <= keys.size();){
+        size_t plus = MIN(keys.find('+', pos), keys.size());
+        std::string key = keys.substr(pos, plus - pos);
+        pos = plus + 1;
+        if (key == "PLAY"){
+            event.play = true;
+            continue;
+        }
+        if (key == "FORK"){
+            event.forks = colon != std::string::npos ? event.hold : BATCH_FORKS;
+            continue;
+        }
+        size_t i = 0;
+        while (i < sizeof(batch_keys) / sizeof(batch_keys[0]) && key != batch_keys[i].name)
+            i++;
+        if (i == sizeof(batch_keys) / sizeof(batch_keys[0]))
+            return false;
+        if (batch_keys[i].row < 8)
+            event.keyboard[batch_keys[i].row] |= batch_keys[i].mask;
+        else
+            event.joystick |= batch_keys[i].mask;
+    }
+    return true;
+}
+
+bool Batch::load_manifest(const char *path, std::vector<Batch_Job> &jobs){
+    FILE *fp = fopen(path, "r");
+    if (!fp){
+        printf("WARN: Open batch manifest %s.\n", path);
+        return false;
+    }
+    char line[8192];
+    for (int number = 1; fgets(line, sizeof(line), fp); number++){
+        line[strcspn(line, "\r\n")] = 0x00;
+        if (!line[0] || line[0] == '#')
+            continue;
+        Batch_Job job;
+        char *field = strchr(line, '\t');
+        if (field)
+            *field++ = 0x00;
+        job.path = line;
+        if (field){
+            char *script = strchr(field, '\t');
+            if (script)
+                *script++ = 0x00;
+            if (*field)
+                job.frames = strtoul(field, NULL, 10);
+            for (char *token = script ? strtok(script, " ") : NULL; token; token = strtok(NULL, " ")){
+                Batch_Event event;
+                if (!strncmp(token, "run:", 4))
+                    job.run = token + 4;
+                else if (parse_event(token, event))
+                    job.events.push_back(event);
+                else{
+                    printf("WARN: Batch manifest line %d, script %s.\n", number, token);
+                    fclose(fp);
+                    return false;
+                }
+            }
+        }
+        jobs.push_back(job);
+    }
+    fclose(fp);
+    return true;
+}
+
+static void run_file(Board *board, const std::string &name){
+    std::vector<TRD_File> files;
+    if (!board->disk_catalog(files))
+        throw std::runtime_error("TR-DOS catalog");
+    for (const TRD_File &file : files){
+        std::string file_name = file.name;
+        file_name.erase(file_name.find_last_not_of(' ') + 1);
+        if (file_name == name){
+            board->disk_run(file);
+            return;
+        }
+    }
+    throw std::runtime_error("TR-DOS file " + name + " is not found");
+}
+
+// The frame ends with the interrupt, the interrupts are off then in the handler.
+static bool interrupt_taken(Board *board){
+    Z80_State &cpu = board->cpu_state();
+    u16 vector = cpu.ir | 0xFF;
+    u16 handler = cpu.im < 2 ? 0x0038 : board->ula.read_byte(vector) | board->ula.read_byte(vector + 1) << 8;
+    return cpu.pc == handler;
+}
+
+// The scripted keys replace the input of the frame, the ones held together are merged.
+static void set_input(Board *board, const Batch_Job &job, u32 frame){
+    u8 keyboard[8];
+    u8 joystick = 0x00;
+    memset(keyboard, 0xFF, sizeof(keyboard));
+    for (const Batch_Event &event : job.events){
+        if (frame < event.frame || frame >= event.frame + event.hold)
+            continue;
+        for (int i = 0; i < 8; i++)
+            keyboard[i] &= ~event.keyboard[i];
+        joystick |= event.joystick;
+        if (event.play && frame == event.frame && !board->tape.is_play())
+            board->tape.play();
+    }
+    board->keyboard.set_state(keyboard);
+    board->joystick.button(0x3F, false);
+    board->joystick.button(joystick, true);
+}
+
+// The fork loads the same media, the machine state and the media positions are taken from the parent.
+static Batch_Fork* fork_board(const Cfg &cfg, Board *parent, const std::string &path, u32 frame){
+    Batch_Fork *fork = new Batch_Fork{cfg, NULL, frame, 0};
+    fork->board = new Board(fork->cfg);
+    if (!fork->board->load_file(path.c_str()))
+        throw std::runtime_error("Load media file");
+    fork->board->fork(*parent);
+    return fork;
+}
+
+// The parent is stopped as the forks run up to its last frame with the same script, their pages are shared until written.
+static void run_forks(std::vector<Batch_Fork*> &forks, const Batch_Job &job, Batch_Result &result){
+    std::vector<std::thread> threads;
+    for (Batch_Fork *fork : forks)
+        threads.emplace_back([fork, &job, &result]{
+            for (u32 frame = fork->frame; frame < result.frames; frame++){
+                set_input(fork->board, job, frame);
+                fork->board->ula.frame_setup(NULL);
+                fork->board->frame();
+            }
+            fork->state_hash = fork->board->state_hash();
+        });
+    for (std::thread &thread : threads)
+        thread.join();
+    for (Batch_Fork *fork : forks)
+        if (fork->state_hash != result.state_hash){
+            result.status = "error";
+            result.error = "Fork from frame " + std::to_string(fork->frame) + " ends in another state";
+            break;
+        }
+}
+
+// The media is read through an in-memory copy, the disk images of the corpus are never written back.
+void Batch::run_job(Cfg &cfg, const Batch_Job &job, Batch_Result &result){
+    auto start = std::chrono::steady_clock::now();
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "batch:%p/", (void*)&result);
+    std::string path = prefix + job.path;
+    u16 *frame_buffer = new u16[DISPLAY_WIDTH * DISPLAY_HEIGHT]();
+    Board *board = NULL;
+    std::vector<Batch_Fork*> forks;
+    try{
+        File_Map file;
+        if (!file.open(job.path.c_str()))
+            throw std::runtime_error("Open media file");
+        File_Map::add(path.c_str(), file.data(), file.size());
+        file.close();
+        board = new Board(cfg);
+        if (!board->load_file(path.c_str()))
+            throw std::runtime_error("Load media file");
+        if (!job.run.empty())
+            run_file(board, job.run);
+        // The MHz go by the time in the frames, the hashes and the script are not counted.
+        double loop_us = 0;
+        u64 clk = 0;
+        u32 audio_hash = 0x811C9DC5;
+        u32 same_pc = 0;
+        bool drawn = false;
+        for (u32 frame = 0; frame < job.frames; frame++){
+            for (const Batch_Event &event : job.events)
+                for (u32 i = 0; event.frame == frame && i < event.forks; i++)
+                    forks.push_back(fork_board(cfg, board, path, frame));
+            if (!job.events.empty())
+                set_input(board, job, frame);
+            drawn = job.trace || frame + 1 == job.frames;
+            board->ula.frame_setup(drawn ? frame_buffer : NULL);
+            clk += board->frame_clk;
+            u16 pc = board->cpu_state().pc;
+            auto frame_start = std::chrono::steady_clock::now();
+            board->frame();
+            loop_us += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - frame_start).count();
+            result.frames = frame + 1;
+            size_t audio_size = board->sound.get_samples() * 2 * sizeof(s16);
+            audio_hash = fnv(audio_hash, board->sound.get_buffer(), audio_size);
+            if (job.trace){
+                result.frame_hashes.push_back(fnv(0x811C9DC5, frame_buffer, DISPLAY_WIDTH * DISPLAY_HEIGHT * sizeof(u16)));
+                result.audio_hashes.push_back(fnv(0x811C9DC5, board->sound.get_buffer(), audio_size));
+            }
+            // No interrupt takes the machine out of a HALT or a loop with them off.
+            Z80_State &cpu = board->cpu_state();
+            bool disabled = !cpu.iff1 && !interrupt_taken(board);
+            same_pc = disabled && cpu.pc == pc ? same_pc + 1 : 0;
+            if (disabled && board->ula.read_byte(cpu.pc) == 0x76){
+                result.status = "halt";
+                break;
+            }
+            if (same_pc >= BATCH_HANG_FRAMES){
+                result.status = "stuck";
+                break;
+            }
+        }
+        if (!drawn)
+            board->ula.redraw(frame_buffer, board->frame_clk);
+        result.frame_hash = fnv(0x811C9DC5, frame_buffer, DISPLAY_WIDTH * DISPLAY_HEIGHT * sizeof(u16));
+        result.audio_hash = audio_hash;
+        result.state_hash = board->state_hash();
+        result.pc = board->cpu_state().pc;
+        result.mhz = loop_us > 0 ? clk / loop_us : 0;
+        if (!forks.empty())
+            run_forks(forks, job, result);
+    }catch (const std::exception &e){
+        result.status = "error";
+        result.error = e.what();
+    }
+    File_Map::remove(path.c_str());
+    for (Batch_Fork *fork : forks){
+        DELETE(fork->board);
+        DELETE(fork);
+    }
+    DELETE(board);
+    DELETE_ARRAY(frame_buffer);
+    result.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void write_string(FILE *out, const std::string &text){
+    fputc('"', out);
+    for (unsigned char c : text){
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(out, "\\u%04x", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+void Batch::write_result(FILE *out, size_t idx, const Batch_Job &job, const Batch_Result &result){
+    fprintf(out, "{\"job\":%zu,\"path\":", idx);
+    write_string(out, job.path);
+    fprintf(out, ",\"status\":\"%s\",\"frames\":%u,\"frame_hash\":\"%08x\",\"audio_hash\":\"%08x\",\"state_hash\":\"%08x\",\"pc\":\"%04x\",\"wall_ms\":%.1f,\"mhz\":%.2f",
+            result.status, result.frames, result.frame_hash, result.audio_hash, result.state_hash, result.pc, result.wall_ms, result.mhz);
+    if (!result.error.empty()){
+        fprintf(out, ",\"error\":");
+        write_string(out, result.error);
+    }
+    fprintf(out, "}\n");
+}
+
+// The jobs are dealt round, a worker takes its own from the front and the others' from the back.
+static bool take_job(std::vector<Batch_Queue> &queues, size_t worker, size_t &idx){
+    for (size_t i = 0; i < queues.size(); i++){
+        Batch_Queue &queue = queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.jobs.empty())
+            continue;
+        if (i){
+            idx = queue.jobs.back();
+            queue.jobs.pop_back();
+        }else{
+            idx = queue.jobs.front();
+            queue.jobs.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void Batch::run_jobs(const Cfg &cfg, const std::vector<Batch_Job> &jobs, std::vector<Batch_Result> &results, int threads, FILE *out){
+    results.assign(jobs.size(), Batch_Result());
+    threads = MAX(1, MIN(threads, (int)jobs.size()));
+    std::vector<Batch_Queue> queues(threads);
+    for (size_t i = 0; i < jobs.size(); i++)
+        queues[i % threads].jobs.push_back(i);
+    std::mutex out_mutex;
+    auto worker = [&](size_t id){
+        size_t idx;
+        while (take_job(queues, id, idx)){
+            Cfg job_cfg = cfg;                              // The machine may change it, a DivMMC without the ROM goes off.
+            job_cfg.main.rewind_size = 0;
+            run_job(job_cfg, jobs[idx], results[idx]);
+            if (out){
+                std::lock_guard<std::mutex> lock(out_mutex);
+                write_result(out, idx, jobs[idx], results[idx]);
+                fflush(out);
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int i = 1; i < threads; i++)
+        pool.emplace_back(worker, i);
+    worker(0);
+    for (std::thread &thread : pool)
+        thread.join();
+}
+
+// The process exit code is 1 if any job has not run clean.
+int Batch::run(const Cfg &cfg, const char *manifest, const char *output, int threads){
+    std::vector<Batch_Job> jobs;
+    if (!load_manifest(manifest, jobs))
+        return 1;
+    FILE *out = strcmp(output, "-") ? fopen(output, "w") : stdout;
+    if (!out){
+        printf("WARN: Open batch output %s.\n", output);
+        return 1;
+    }
+    if (threads <= 0)
+        threads = MAX(1, (int)std::thread::hardware_concurrency());
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Batch_Result> results;
+    run_jobs(cfg, jobs, results, threads, out);
+    if (out != stdout)
+        fclose(out);
+    int failed = 0;
+    for (const Batch_Result &result : results)
+        failed += strcmp(result.status, "ok") != 0;
+    printf("Batch: %zu jobs, %d failed, %.1f s on %d threads.\n", jobs.size(), failed,
+           std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), threads);
+    return failed ? 1 : 0;
+}
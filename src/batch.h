@@ -0,0 +1,51 @@
+// Headless batch runs over media corpora. A manifest line is a job: "path[<TAB>frames[<TAB>script]]", '#' starts a comment.
+// The script is space separated: "frame:KEY[+KEY...][:hold]" holds the keys from the frame on, "frame:PLAY" starts the tape,
+// "run:NAME" runs the TR-DOS file as the disk catalog does. The keys are A-Z, 0-9, ENTER, SPACE, CS, SS,
+// and Kempston UP, DOWN, LEFT, RIGHT, FIRE. "frame:FORK[:count]" forks the machine at the frame, the forks run the rest
+// of the script on their own threads and the job is an error if any of them ends in another state than the machine.
+// The jobs go over a work-stealing pool, a worker runs one machine at a time, a new one per job so the results don't depend
+// on the order. The results are JSON lines in the order they finish.
+
+#define BATCH_FRAMES                500                     // Frames a job runs if the manifest has no count.
+#define BATCH_HOLD                  4                       // Frames a scripted key is held.
+#define BATCH_HANG_FRAMES           250                     // Frames the PC stays the same with interrupts off, a hang.
+#define BATCH_FORKS                 3                       // Machines a FORK makes if the script has no count.
+
+struct Batch_Event {
+    u32 frame;
+    u32 hold;
+    u8 keyboard[8];                                         // Half-row bits of the keys pressed, 1 - pressed.
+    u8 joystick;
+    bool play;
+    u32 forks;
+};
+
+struct Batch_Job {
+    std::string path;
+    u32 frames = BATCH_FRAMES;
+    std::string run;                                        // TR-DOS file.
+    std::vector<Batch_Event> events;
+    bool trace = false;                                     // Every frame is drawn, its frame and audio hashes are kept.
+};
+
+struct Batch_Result {
+    const char *status = "ok";                              // ok, halt (DI and HALT), stuck (the PC is), error.
+    std::string error;
+    u32 frames = 0;                                         // Frames run, up to the hang.
+    u32 frame_hash = 0;                                     // The last frame buffer.
+    u32 audio_hash = 0;                                     // All the samples of the run.
+    u32 state_hash = 0;
+    u16 pc = 0;
+    double wall_ms = 0;
+    double mhz = 0;                                         // Emulated T-states per microsecond in the frames.
+    std::vector<u32> frame_hashes;                          // Per frame, traced jobs only.
+    std::vector<u32> audio_hashes;
+};
+
+namespace Batch {
+    bool load_manifest(const char *path, std::vector<Batch_Job> &jobs);
+    void run_job(Cfg &cfg, const Batch_Job &job, Batch_Result &result);
+    void run_jobs(const Cfg &cfg, const std::vector<Batch_Job> &jobs, std::vector<Batch_Result> &results, int threads, FILE *out);
+    void write_result(FILE *out, size_t idx, const Batch_Job &job, const Batch_Result &result);
+    int run(const Cfg &cfg, const char *manifest, const char *output, int threads);
+}
@@ -3,9 +3,12 @@
 #include <stdexcept>
 #include <stdio.h>
 #include <string.h>
-#include <SDL.h>
-#include <GL/glew.h>
-#include <SDL_image.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <deque>
+#include <string>
 #include "types.h"
 #include "utils.h"
 #include "config.h"
@@ -13,24 +16,25 @@
 #include "memory.h"
 #include "ula.h"
 #include "z80.h"
-#include "snapshot.h"
+#include "filemap.h"
+#include "disk.h"
 #include "floppy.h"
+#include "divmmc.h"
 #include "keyboard.h"
 #include "joystick.h"
 #include "tape.h"
+#include "recorder.h"
 #include "sound.h"
+#include "snapshot.h"
+#include "movie.h"
+#include "netplay.h"
+#include "gdb.h"
 #include "mouse.h"
+#include "rewind.h"
 #include "board.h"
-#include "video.h"
-#include "ui.h"
-
-//#define TIME
-//#define FRAME_LIMIT 50000
 
-Board::Board(Cfg &cfg) : cfg(cfg) {
-    Video::setup();
-    Video::set_filter((Filter)cfg.video.filter);
 
+Board::Board(Cfg &cfg) : cfg(cfg), divmmc(&ula) {
     sound.set_ay_volume(cfg.audio.ay_volume, (AY_Mixer)cfg.audio.ay_mixer_mode, cfg.audio.ay_side_level, cfg.audio.ay_center_level, cfg.audio.ay_penetr_level);
     sound.set_speaker_volume(cfg.audio.speaker_volume);
     sound.set_tape_volume(cfg.audio.tape_volume);
@@ -39,11 +43,15 @@ Board::Board(Cfg &cfg) : cfg(cfg) {
     ula.load_rom(ROM_128, (const char*)&cfg.main.rom_path[ROM_128]);
     ula.load_rom(ROM_48, (const char*)&cfg.main.rom_path[ROM_48]);
     setup((Hardware)cfg.main.model);
+    set_fast_forward(cfg.main.fast_forward);
+    set_fast_disk(cfg.main.fast_disk);
+    set_divmmc(cfg.main.divmmc);
+    set_rewind(cfg.main.rewind_size);
     reset();
 }
 
 Board::~Board(){
-    Video::free();
+    movie.stop();
 }
 
 void Board::setup(Hardware model){
@@ -55,17 +63,29 @@ void Board::setup(Hardware model){
         { ROM_128, 70908 },
         { ROM_48, 69888 }
     };
+    hardware = model;
     frame_clk = profile[model].clk;
     ula.set_main_rom(profile[model].rom);
     sound.setup(cfg.audio.dsp_rate, cfg.audio.lpf_rate, frame_clk);
 }
 void Board::read(u16 port, u8 *byte, s32 clk){
+    read_devices(port, byte, clk);
+    if (!(port & 0x01) && cfg.main.edge_loading && tape.is_play()){
+        s32 skip = tape.edge_skip(cpu, &ula, *byte, clk, frame_clk);
+        if (skip)
+            read_devices(port, byte, clk + skip);
+    }
+}
+
+void Board::read_devices(u16 port, u8 *byte, s32 clk){
     *byte = 0xFF;
     if (ula.is_trdos_active())
         fdc.read(port, byte, clk);
     else{
         joystick.read(port, byte, clk);
         ula.read(port, byte, clk);
+        if (cfg.main.divmmc)
+            divmmc.read(port, byte, clk);
     }
     keyboard.read(port, byte, clk);
     tape.read(port, byte, clk);
@@ -76,187 +96,526 @@ void Board::read(u16 port, u8 *byte, s32 clk){
 void Board::write(u16 port, u8 byte, s32 clk){
     if (ula.is_trdos_active())
         fdc.write(port, byte, clk);
+    else if (cfg.main.divmmc)
+        divmmc.write(port, byte, clk);
     sound.write(port, byte, clk);
     tape.write(port, byte, clk);
     ula.write(port, byte, clk);
 }
 
-void Board::set_window_size(int width, int height){
-    viewport_width = cfg.video.screen_width = width;
-    viewport_height = cfg.video.screen_height = height;
-    SDL_SetWindowSize(window, width, height);
-    Video::viewport_setup(width, height);
+bool Board::trap(u16 pc){
+    if (divmmc.is_off_area(pc)){
+        // DivMMC is paged out after the instruction, it's run as a single step.
+        if (divmmc.restore_off_area(pc) != TRAP_BYTE){
+            cpu.pc = pc;
+            cpu.irl--;
+            cpu.clk -= 4;
+            cpu.frame(&ula, this, cpu.clk + 1);
+        }
+        divmmc.automap(false);
+        return true;
+    }
+    if (ula.read_byte(pc) == TRAP_BYTE) // Not a patched ROM location, it's real "LD E, E".
+        return false;
+    if (cfg.main.divmmc && divmmc.is_entry(pc)){
+        // The ROM instruction at the entry point is run untrapped, DivMMC is paged in from the next fetch.
+        divmmc.set_traps(false);
+        cpu.pc = pc;
+        cpu.irl--;
+        cpu.clk -= 4;
+        cpu.frame(&ula, this, cpu.clk + 1);
+        divmmc.set_traps(true);
+        divmmc.automap(true);
+        return true;
+    }
+    switch (pc){
+        case LD_BYTES:
+        case SA_BYTES:
+            if (!(pc == LD_BYTES ? tape.load_block(cpu, &ula) : tape.save_block(cpu, &ula))){
+                // Not a standard block or not recording, the ROM routine runs with its first instruction stepped untrapped.
+                // The trap stays for a standard block further on the tape.
+                ula.set_trap(ROM_48, pc, false);
+                cpu.pc = pc;
+                cpu.irl--;
+                cpu.clk -= 4;
+                cpu.frame(&ula, this, cpu.clk + 1);
+                update_traps();
+                return true;
+            }
+            // SA/LD-RET: restore border, enable interrupts and return.
+            write(0xFE, (ula.read_byte(BORDCR) >> 3) & 0x07, cpu.clk);
+            cpu.iff1 = cpu.iff2 = 1;
+            cpu.pcl = ula.read_byte(cpu.sp++);
+            cpu.pch = ula.read_byte(cpu.sp++);
+            update_traps();
+            return true;
+    }
+    return false;
+}
+
+void Board::update_traps(){
+    tape_block = tape.is_block();
+    ula.set_trap(ROM_48, LD_BYTES, cfg.main.tape_traps && tape_block);
+    ula.set_trap(ROM_48, SA_BYTES, cfg.main.tape_traps && tape.is_record());
+    divmmc.set_traps(cfg.main.divmmc);
+}
+
+void Board::set_fast_forward(int shift){
+    cfg.main.fast_forward = MIN(MAX(shift, 0), FAST_FORWARD_MAX);
+    sound.set_speed(1 << cfg.main.fast_forward);
+}
+
+void Board::set_divmmc(bool state){
+    cfg.main.divmmc = state && divmmc.load_rom(cfg.main.divmmc_rom);
+    rewind.clear();
+    update_traps();
+}
+
+void Board::set_fast_disk(bool state){
+    cfg.main.fast_disk = state;
+    fdc.set_fast(state);
+}
+
+// Auto turbo: while the media is active the loop runs without vsync and sound, displaying one frame of several.
+void Board::update_turbo(){
+    turbo = cfg.main.auto_turbo && (tape.is_play() || (ula.is_trdos_active() && fdc.is_busy()) || autotype_pos < autotype_keys.size());
+}
+
+void Board::frame(){
+    if (movie.is_on() && !ahead){
+        Movie_Input input;
+        get_input(input);
+        movie.input(input);
+        set_input(input);
+    }
+    if (gdb.is_on() && !ahead){
+        gdb.update(this);
+        while (gdb.is_tracing() && cpu.clk < frame_clk){
+            gdb.check(this);
+            cpu.step_into(&ula, this, frame_clk);
+        }
+    }
+    cpu.frame(&ula, this, frame_clk);
+    cpu.interrupt(&ula);
+    cpu.clk -= frame_clk;
+    fdc.frame(frame_clk);
+    tape.frame(frame_clk);
+    if (tape.is_block() != tape_block) // The tape went past the last standard block or was moved back before one.
+        update_traps();
+    sound.frame(frame_clk);
+    ula.frame(frame_clk);
+    if (autotype_pos < autotype_keys.size())
+        autotype();
+    if (rewind.is_on() && !ahead && !cfg.main.divmmc) // The DivMMC RAM and its card writes are not kept, as for the run ahead.
+        rewind_push();
+    if (movie.is_on() && !ahead)
+        movie.check(state_hash());
+}
+
+void Board::get_input(Movie_Input &input){
+    keyboard.get_state(input.keyboard);
+    input.joystick = joystick.get_state();
+    mouse.get_state(input.mouse);
+}
+
+void Board::set_input(const Movie_Input &input){
+    keyboard.set_state(input.keyboard);
+    joystick.set_state(input.joystick);
+    mouse.set_state(input.mouse);
+}
+
+// FNV-1a of the registers and RAM, four lanes of 8 bytes a step.
+u32 Board::state_hash(){
+    u64 hash[4] = { 0xCBF29CE484222325, 0xCBF29CE484222325, 0xCBF29CE484222325, 0xCBF29CE484222325 };
+    const u8 *regs = (const u8*)(Z80_State*)&cpu;
+    for (size_t i = 0; i < sizeof(Z80_State); i++)
+        hash[0] = (hash[0] ^ regs[i]) * 0x100000001B3;
+    for (int i = 0; i < RAM_PAGES; i++){
+        const u64 *data = (const u64*)ula.read_page(i);
+        for (int j = 0; j < PAGE_SIZE / 8; j += 4)
+            for (int k = 0; k < 4; k++)
+                hash[k] = (hash[k] ^ data[j + k]) * 0x100000001B3;
+    }
+    u64 result = hash[0] ^ hash[1] * 3 ^ hash[2] * 5 ^ hash[3] * 7;
+    return result ^ result >> 32;
+}
+
+// The movie runs to the end at full speed, not displayed and silent. False if it went out of sync.
+bool Board::replay(){
+    sound.set_silent(true);
+    while (movie.is_playing()){
+        ula.frame_setup(NULL);
+        frame();
+    }
+    sound.set_silent(false);
+    return !movie.is_desync();
 }
 
-void Board::set_texture_filter(Filter filter){
-    Video::set_filter(filter);///////////////////////
+// BASIC is run by TR-DOS called from 48K BASIC: RANDOMIZE USR 15619: REM: RUN "name".
+// Other files are copied into the memory at their address.
+void Board::disk_run(const TRD_File &file){
+    if (file.type != 'B'){
+        std::vector<u8> data;
+        if (!fdc.get_disk(0).read_file(file, data)){
+            printf("WARN: Read file %s.\n", file.name);
+            return;
+        }
+        for (u32 i = 0; i < MIN((u32)file.length, (u32)data.size()) && file.start + i <= 0xFFFF; i++)
+            ula.write_byte(file.start + i, data[i], cpu.clk);
+        return;
+    }
+    ula.set_main_rom(ROM_48);
+    reset();
+    static const u8 command[] = { 0xF9, 0xC0, '1', '5', '6', '1', '9', ':', 0xEA, ':', 0xF7, '"' };
+    int len = 8;
+    while (len && file.name[len - 1] == ' ')
+        len--;
+    autotype_keys.assign(command, command + sizeof(command));
+    autotype_keys.insert(autotype_keys.end(), file.name, file.name + len);
+    autotype_keys.push_back('"');
+    autotype_keys.push_back(0x0D);
+    autotype_wait = AUTOTYPE_DELAY;
 }
 
-void Board::set_full_screen(bool state){
-    if (state){
-        SDL_SetWindowSize(window, SCREEN_WIDTH, SCREEN_HEIGHT);
-        SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN);
-    }else{
-        SDL_ShowCursor(SDL_DISABLE);
-        SDL_SetWindowFullscreen(window, 0);
-        SDL_SetWindowSize(window, cfg.video.screen_width, cfg.video.screen_height);
+// A key code is passed to the ROM when the previous one is taken.
+void Board::autotype(){
+    if (autotype_wait){
+        autotype_wait--;
+        return;
     }
-    SDL_GetWindowSize(window, &cfg.video.screen_width, &cfg.video.screen_height);
-    Video::viewport_setup(cfg.video.screen_width, cfg.video.screen_height);
-    viewport_width = cfg.video.screen_width;
-    viewport_height = cfg.video.screen_height;
-    // Fix window position for imgui.
-    SDL_SetWindowPosition(window, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED);
+    u8 flags = ula.read_byte(FLAGS);
+    if (flags & 0x20)
+        return;
+    ula.write_byte(LAST_K, autotype_keys[autotype_pos++], cpu.clk);
+    ula.write_byte(FLAGS, flags | 0x20, cpu.clk);
+}
+
+void Board::save_state(Board_State &state){
+    state.valid = true;
+    state.hardware = hardware;
+    state.cpu = cpu;
+    for (int i = 0; i < RAM_PAGES; i++)
+        memcpy(state.ram[i], ula.read_page(i), PAGE_SIZE);
+    ula.get_state(state.ula);
+    sound.get_state(state.ay);
+    tape.get_state(state.tape);
+    fdc.get_state(state.fdc, state.fdc_stream);
+    state.autotype_keys = autotype_keys;
+    state.autotype_pos = autotype_pos;
+    state.autotype_wait = autotype_wait;
 }
 
-void Board::set_vsync(bool state){
-    SDL_GL_SetSwapInterval(state ? 1 : 0);
+void Board::load_state(const Board_State &state){
+    if (!state.valid)
+        return;
+    movie.stop();
+    netplay.close();
+    restore_state(state);
+    rewind.clear();
+}
+
+void Board::restore_state(const Board_State &state){
+    if (state.hardware != hardware)
+        setup(state.hardware);
+    (Z80_State&)cpu = state.cpu;
+    for (int i = 0; i < RAM_PAGES; i++)
+        memcpy(ula.page(i), state.ram[i], PAGE_SIZE);
+    ula.set_state(state.ula);
+    sound.set_state(state.ay);
+    tape.set_state(state.tape);
+    fdc.set_state(state.fdc, state.fdc_stream.data());
+    autotype_keys = state.autotype_keys;
+    autotype_pos = state.autotype_pos;
+    autotype_wait = state.autotype_wait;
+    update_traps();
+}
+
+// Writes to media and devices out of the saved state can't be taken back, the frames ahead are not run then.
+bool Board::can_run_ahead(){
+    return cfg.main.run_ahead && !netplay.is_on() && !turbo && !cfg.main.divmmc && !ula.is_trdos_active() && !fdc.is_busy() && !tape.is_record() && !sound.is_recording();
+}
+
+// The frames ahead run with the current input and only the last one is displayed, the game reacts on it that much earlier.
+// The machine goes back to the saved state then, it's silent and the disk is write protected while ahead.
+void Board::run_ahead(u16 *frame_buffer){
+    save_state(ahead_state);
+    ahead = true;
+    sound.set_silent(true);
+    fdc.set_locked(true);
+    for (int i = 0; i < cfg.main.run_ahead; i++){
+        ula.frame_setup(i == cfg.main.run_ahead - 1 ? frame_buffer : NULL);
+        frame();
+    }
+    fdc.set_locked(false);
+    sound.set_silent(false);
+    ahead = false;
+    restore_state(ahead_state);
+}
+
+// Both machines load the same media before, the start state is compared by the hash.
+bool Board::netplay_start(int port, const char *peer, int player){
+    movie.stop();
+    if (!netplay.open(port, peer, player, state_hash()))
+        return false;
+    net_states.resize(NETPLAY_ROLLBACK_MAX + 1);
+    net_count = 0;
+    return true;
+}
+
+// The frames since the first one predicted wrong run again with the input received, not displayed and silent,
+// then the next frame runs with the merged input. The machine waits for the peer as it's too far ahead.
+// The local input stays in the devices between the frames.
+bool Board::net_frame(u16 *frame_buffer){
+    Movie_Input local, input;
+    get_input(local);
+    u32 wrong = netplay.receive(net_count);
+    ahead = true;
+    if (wrong < net_count){
+        restore_state(net_states[wrong % net_states.size()]);
+        sound.set_silent(true);
+        for (u32 f = wrong; f < net_count; f++){
+            save_state(net_states[f % net_states.size()]);
+            netplay.input(f, input);
+            set_input(input);
+            ula.frame_setup(NULL);
+            frame();
+        }
+        sound.set_silent(false);
+    }
+    bool run = netplay.can_run(net_count);
+    if (run){
+        netplay.send(net_count, local);
+        save_state(net_states[net_count % net_states.size()]);
+        netplay.input(net_count, input);
+        set_input(input);
+        ula.frame_setup(frame_buffer);
+        frame();
+        net_count++;
+    }else
+        netplay.flush();
+    ahead = false;
+    set_input(local);
+    return run;
+}
+
+void Board::quick_save(int slot){
+    if (slots.empty())
+        slots.resize(QUICK_SLOTS);
+    save_state(slots[slot % QUICK_SLOTS]);
+}
+
+void Board::quick_load(int slot){
+    if (slots.empty() || !slots[slot % QUICK_SLOTS].valid){
+        printf("WARN: Quick save slot %d is empty.\n", slot);
+        return;
+    }
+    load_state(slots[slot % QUICK_SLOTS]);
+}
+
+// The machine goes on from the state of the parent, the memory pages are shared until written.
+// Media is not a part of it, the loaded one is used. The forks run on their own threads, the parent is stopped while forked.
+void Board::fork(Board &parent){
+    if (parent.hardware != hardware)
+        setup(parent.hardware);
+    ula.fork(parent.ula);
+    (Z80_State&)cpu = parent.cpu;
+    ULA_State ula_state;
+    parent.ula.get_state(ula_state);
+    ula.set_state(ula_state);
+    AY_State ay;
+    parent.sound.get_state(ay);
+    sound.set_state(ay);
+    Tape_State tape_state;
+    parent.tape.get_state(tape_state);
+    tape.set_state(tape_state);
+    FDC_State fdc_state;
+    parent.fdc.get_state(fdc_state, rewind_stream);
+    fdc.set_state(fdc_state, rewind_stream.data());
+    autotype_keys = parent.autotype_keys;
+    autotype_pos = parent.autotype_pos;
+    autotype_wait = parent.autotype_wait;
+    rewind.clear();
+    update_traps();
+}
+
+void Board::set_rewind(int size){
+    cfg.main.rewind_size = MIN(MAX(size, 0), REWIND_SIZE_MAX);
+    rewind.setup((size_t)cfg.main.rewind_size << 20);
+}
+
+void Board::rewind_push(){
+    Rewind_State state;
+    state.hardware = hardware;
+    state.cpu = cpu;
+    ula.get_state(state.ula);
+    sound.get_state(state.ay);
+    tape.get_state(state.tape);
+    fdc.get_state(state.fdc, rewind_stream);
+    state.autotype_pos = autotype_pos;
+    state.autotype_wait = autotype_wait;
+    rewind_record.assign((u8*)&state, (u8*)&state + sizeof(Rewind_State));
+    rewind_record.insert(rewind_record.end(), rewind_stream.begin(), rewind_stream.end());
+    rewind.push(&ula, rewind_record.data(), rewind_record.size());
+}
+
+// One frame back, the RAM is restored by the buffer. The oldest frame is kept while the rewind is held.
+bool Board::rewind_step(){
+    if (!rewind.pop(&ula, rewind_record))
+        return false;
+    movie.stop();
+    netplay.close();
+    Rewind_State state;
+    memcpy(&state, rewind_record.data(), sizeof(Rewind_State));
+    if (state.hardware != hardware)
+        setup(state.hardware);
+    (Z80_State&)cpu = state.cpu;
+    ula.set_state(state.ula);
+    sound.set_state(state.ay);
+    tape.set_state(state.tape);
+    fdc.set_state(state.fdc, rewind_record.data() + sizeof(Rewind_State));
+    autotype_pos = MIN((size_t)state.autotype_pos, autotype_keys.size());
+    autotype_wait = state.autotype_wait;
+    update_traps();
+    return true;
 }
 
 void Board::reset(){
+    movie.stop();
+    netplay.close();
     cpu.reset();
     ula.reset();
     fdc.reset();
+    divmmc.reset();
     sound.reset();
     tape.reset();
     keyboard.reset();
     joystick.reset();
     mouse.reset();
+    autotype_keys.clear();
+    autotype_pos = 0;
+    update_traps();
 }
 
-void Board::run(Cfg &cfg){
-    window = SDL_GL_GetCurrentWindow();
-    viewport_width = cfg.video.screen_width;
-    viewport_height = cfg.video.screen_height;
-#ifdef TIME
-    int frame_count = 0;
-    set_vsync(false);
-    cfg.main.full_speed = true;
-    Uint32 time_start = SDL_GetTicks();
-#endif
-    while (true){
-        SDL_Event event;
-        while (SDL_PollEvent(&event)){
-            switch (event.type){
-                case SDL_WINDOWEVENT:
-                    switch (event.window.event){
-                        case SDL_WINDOWEVENT_CLOSE:
-                            return;
-                        case SDL_WINDOWEVENT_RESIZED:
-                            viewport_width = event.window.data1;
-                            viewport_height = event.window.data2;
-                            break;
-                        case SDL_WINDOWEVENT_EXPOSED:
-                            Video::viewport_setup(viewport_width, viewport_height);
-                            break;
-                    }
-                    break;
-                case SDL_KEYDOWN:
-                    if (event.key.repeat)
-                        break;
-                    if (event.key.keysym.sym == SDLK_RETURN && event.key.keysym.mod & KMOD_CTRL){
-                        set_full_screen(cfg.video.full_screen ^= true);
-                        continue;
-                    }
-                    break;
-            }
-            if (UI::event(event)){
-                keyboard.clear();
-                continue;
-            }
-            switch (event.type){
-                case SDL_KEYDOWN:
-                    switch (event.key.keysym.sym){
-                        case SDLK_F5:
-                            if (tape.is_play())
-                                tape.stop();
-                            else
-                                tape.play();
-                            continue;
-                        case SDLK_F6:
-                            tape.rewind_begin();
-                            continue;
-                        case SDLK_F9:
-                            set_vsync(!(cfg.main.full_speed ^= true));
-                            continue;
-                        case SDLK_F11:
-                            ula.set_main_rom(cfg.main.model != HW_Sinclair_48 ? ROM_128 : ROM_48);
-                            reset();
-                            continue;
-                        case SDLK_F12:
-                            ula.set_main_rom(ROM_Trdos);
-                            reset();
-                            break;
-                        case SDLK_RETURN:
-                            if (event.key.keysym.mod & KMOD_CTRL){
-                                set_full_screen(cfg.video.full_screen ^= true);
-                                continue;
-                            }
-                            break;
-                    }
-                case SDL_KEYUP:
-                    if (event.key.keysym.mod & (KMOD_NUM | KMOD_CAPS))
-                        SDL_SetModState(KMOD_NONE);
-                    keyboard.event(event);
-                    break;
-                default:
-                    joystick.event(event);
-                    mouse.event(event);
-                    break;
-            }
-        }
-        u16 *frame_buffer = Video::update();
-        if (!UI::is_modal()){
-            ula.frame_setup(frame_buffer);
-            cpu.frame(&ula, this, frame_clk);
-            cpu.interrupt(&ula);
-            cpu.clk -= frame_clk;
-            fdc.frame(frame_clk);
-            tape.frame(frame_clk);
-            sound.frame(frame_clk);
-            ula.frame(frame_clk);
-            if (!cfg.main.full_speed)
-                sound.queue();
-        }else
-            SDL_Delay(100);
-        Video::frame();
-
-        if (UI::frame(cfg, this))
-            break;
-        SDL_GL_SwapWindow(window);
-#ifdef TIME
-        if (++frame_count > FRAME_LIMIT)
+// One displayed frame: the held rewind, netplay, or the frames of the speed set and the run ahead.
+// False if the machine didn't go forward, there is no sound to queue then.
+bool Board::run_frame(u16 *frame_buffer){
+    if (rewinding){
+        // The frames run back at several per displayed one, the screen is drawn from the restored state.
+        for (int i = 0; i < REWIND_STEP; i++)
+            rewind_step();
+        ula.redraw(frame_buffer, frame_clk);
+        return false;
+    }
+    if (netplay.is_on()){
+        // One frame per displayed one, the screen stays as the machine waits for the peer.
+        if (net_frame(frame_buffer))
+            return true;
+        ula.redraw(frame_buffer, frame_clk);
+        return false;
+    }
+    update_turbo();
+    bool run_ahead_on = can_run_ahead();
+    // Fast forward runs several frames per displayed one, the sound is time-compressed to fit.
+    // Only the last one is drawn, the ULA just moves the beam in the others.
+    int frames = turbo ? cfg.main.turbo_frames : 1 << cfg.main.fast_forward;
+    for (int i = 0; i < frames; i++){
+        ula.frame_setup(run_ahead_on || i + 1 < frames ? NULL : frame_buffer);
+        frame();
+    }
+    if (run_ahead_on)
+        run_ahead(frame_buffer);
+    return true;
+}
+
+// Whole instructions for the T-states given, the frames are finished on the way as in frame().
+// The frame buffer is set from the frame start, the part of the frame run before is drawn already.
+void Board::run_clk(s32 clk, u16 *frame_buffer){
+    while (clk > 0){
+        if (cpu.clk + clk < frame_clk){
+            cpu.frame(&ula, this, cpu.clk + clk);
             break;
-#endif
+        }
+        clk -= frame_clk - cpu.clk;
+        frame();
+        ula.frame_setup(frame_buffer);
     }
-#ifdef TIME
-    printf("Frames: %d, Time: %d\n", frame_count, (SDL_GetTicks() - time_start));
-    cfg.video.vsync = true;
-#endif
 }
 
 bool Board::load_file(const char *path){
     int len = strlen(path);
     if (len < 4)
         return false;
+    movie.stop();
+    netplay.close();
+    bool loaded = true;
     if (!strcmp(path+len-4, ".z80") || !strcmp(path+len-4, ".Z80"))
         setup(Snapshot::load_z80(path, cpu, &ula, this));
-    if (!strcmp(path+len-4, ".trd") || !strcmp(path+len-4, ".TRD"))
+    else if (!strcmp(path+len-4, ".sna") || !strcmp(path+len-4, ".SNA"))
+        setup(Snapshot::load_sna(path, cpu, &ula, this));
+    else if (!strcmp(path+len-4, ".szx") || !strcmp(path+len-4, ".SZX"))
+        setup(Snapshot::load_szx(path, cpu, &ula, this, &sound, &tape, &fdc));
+    else if (!strcmp(path+len-4, ".zxm") || !strcmp(path+len-4, ".ZXM")){
+        setup(Snapshot::load_szx(path, cpu, &ula, this, &sound, &tape, &fdc));
+        movie.play(path);
+    }
+    else if (!strcmp(path+len-4, ".trd") || !strcmp(path+len-4, ".TRD"))
         fdc.load_trd(0, path);
-    if (!strcmp(path+len-4, ".scl") || !strcmp(path+len-4, ".SCL"))
+    else if (!strcmp(path+len-4, ".scl") || !strcmp(path+len-4, ".SCL"))
         fdc.load_scl(0, path);
-    if (!strcmp(path+len-4, ".tap") || !strcmp(path+len-4, ".TAP"))
-        tape.load_tap(path);
-    return true;
+    else if (!strcmp(path+len-4, ".udi") || !strcmp(path+len-4, ".UDI"))
+        fdc.load_udi(0, path);
+    else if (!strcmp(path+len-4, ".fdi") || !strcmp(path+len-4, ".FDI"))
+        fdc.load_fdi(0, path);
+    else if (!strcmp(path+len-4, ".td0") || !strcmp(path+len-4, ".TD0"))
+        fdc.load_td0(0, path);
+    else if (!strcmp(path+len-4, ".img") || !strcmp(path+len-4, ".IMG"))
+        loaded = divmmc.open_card(path);
+    else if (!strcmp(path+len-4, ".tap") || !strcmp(path+len-4, ".TAP"))
+        loaded = tape.load_tap(path);
+    else if (!strcmp(path+len-4, ".tzx") || !strcmp(path+len-4, ".TZX"))
+        loaded = tape.load_tzx(path);
+    else if (!strcmp(path+len-4, ".csw") || !strcmp(path+len-4, ".CSW"))
+        loaded = tape.load_csw(path);
+    else{
+        printf("WARN: Unknown file type %s.\n", path);
+        loaded = false;
+    }
+    rewind.clear();
+    update_traps();
+    return loaded;
 }
 
 bool Board::save_file(const char *path){
     int len = strlen(path);
     if (len < 4)
         return false;
+    bool saved = true;
     if (!strcmp(path+len-4, ".z80") || !strcmp(path+len-4, ".Z80"))
-        Snapshot::save_z80(path, cpu, &ula, this);
-    if (!strcmp(path+len-4, ".trd") || !strcmp(path+len-4, ".TRD"))
+        Snapshot::save_z80(path, hardware, cpu, &ula, &sound);
+    else if (!strcmp(path+len-4, ".sna") || !strcmp(path+len-4, ".SNA"))
+        Snapshot::save_sna(path, hardware, cpu, &ula, this);
+    else if (!strcmp(path+len-4, ".szx") || !strcmp(path+len-4, ".SZX"))
+        Snapshot::save_szx(path, hardware, cpu, &ula, &sound, &tape, &fdc);
+    else if (!strcmp(path+len-4, ".zxm") || !strcmp(path+len-4, ".ZXM")){
+        // The machine goes on from the snapshot as it's loaded, the same way as the playback does.
+        movie.stop();
+        Snapshot::save_szx(path, hardware, cpu, &ula, &sound, &tape, &fdc);
+        setup(Snapshot::load_szx(path, cpu, &ula, this, &sound, &tape, &fdc));
+        movie.record(path);
+    }
+    else if (!strcmp(path+len-4, ".trd") || !strcmp(path+len-4, ".TRD"))
         fdc.save_trd(0, path);
-    return true;
+    else if (!strcmp(path+len-4, ".tap") || !strcmp(path+len-4, ".TAP")){
+        saved = tape.record(path);
+        update_traps();
+    }
+    else if (!strcmp(path+len-4, ".wav") || !strcmp(path+len-4, ".WAV"))
+        sound.record_wav(path);
+    else if (!strcmp(path+len-4, ".psg") || !strcmp(path+len-4, ".PSG"))
+        sound.record_psg(path);
+    else{
+        printf("WARN: Unknown file type %s.\n", path);
+        saved = false;
+    }
+    return saved;
 }
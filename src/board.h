@@ -1,3 +1,37 @@
+// Disk file run: a command is typed into the 48K BASIC editor through the keyboard system variables.
+#define AUTOTYPE_DELAY              100                      // Frames of the 48K ROM start up.
+#define LAST_K                      0x5C08                  // The last key pressed.
+#define FLAGS                       0x5C3B                  // Bit 5 - a new key in LAST_K.
+#define QUICK_SLOTS                 10                      // Alt+0..9 restores a slot, Alt+Shift+0..9 saves it.
+
+// The whole machine between frames, kept in memory. Tape and disk images are not a part of it, the loaded ones are used.
+struct Board_State {
+    bool valid = false;
+    Hardware hardware;
+    Z80_State cpu;
+    u8 ram[RAM_PAGES][PAGE_SIZE];
+    ULA_State ula;
+    AY_State ay;
+    Tape_State tape;
+    FDC_State fdc;
+    std::vector<u8> fdc_stream;
+    std::vector<u8> autotype_keys;
+    size_t autotype_pos;
+    int autotype_wait;
+};
+
+// Device state of a rewind frame, followed by the FDC stream. The RAM goes to the rewind buffer as changed blocks.
+struct Rewind_State {
+    Hardware hardware;
+    Z80_State cpu;
+    ULA_State ula;
+    AY_State ay;
+    Tape_State tape;
+    FDC_State fdc;
+    u32 autotype_pos;
+    s32 autotype_wait;
+};
+
 class Board : public IO {
     public:
         Board(Cfg &cfg);
@@ -9,16 +43,32 @@ class Board : public IO {
         bool load_file(const char *path);
         bool save_file(const char *path);
 
-        void run(Cfg &cfg);
+        bool run_frame(u16 *frame_buffer);
+        void run_clk(s32 clk, u16 *frame_buffer);
 
-        void viewport_setup(int width, int height);
-        void set_window_size(int width, int height);
-        void set_texture_filter(Filter filter);
-        void set_full_screen(bool state);
-        void set_vsync(bool state);
+        void set_fast_forward(int shift);
+        void set_fast_disk(bool state);
+        void set_divmmc(bool state);
+        bool is_turbo() { return turbo; };
+        bool disk_catalog(std::vector<TRD_File> &files, char *label = NULL) { return fdc.get_disk(0).catalog(files, label); };
+        void disk_run(const TRD_File &file);
+        void save_state(Board_State &state);
+        void load_state(const Board_State &state);
+        void quick_save(int slot);
+        void quick_load(int slot);
+        void fork(Board &parent);
+        bool replay();
+        u32 state_hash();
+        void set_rewind(int size);
+        bool rewind_step();
+        void set_rewinding(bool state) { rewinding = state; };
+        bool is_rewinding() { return rewinding; };
+        bool netplay_start(int port, const char *peer, int player);
 
         void read(u16 port, u8 *byte, s32 clk=0);
         void write(u16 port, u8 byte, s32 clk=0);
+        bool trap(u16 pc);
+        void update_traps();
 
         Z80_State& cpu_state() { return cpu; };
 
@@ -26,15 +76,42 @@ class Board : public IO {
         Sound sound;
         Tape tape;
         Keyboard keyboard;
+        Joystick joystick;
+        Mouse mouse;
+        Movie movie;
+        GDB_Stub gdb;
         s32 frame_clk;
     private:
+        void read_devices(u16 port, u8 *byte, s32 clk);
+        void update_turbo();
+        void autotype();
+        void rewind_push();
+        bool can_run_ahead();
+        void run_ahead(u16 *frame_buffer);
+        void restore_state(const Board_State &state);
+        void get_input(Movie_Input &input);
+        void set_input(const Movie_Input &input);
+        bool net_frame(u16 *frame_buffer);
+
         Z80 cpu;
         Cfg &cfg;
-        SDL_Window *window = NULL;
-        int viewport_width = SCREEN_WIDTH;
-        int viewport_height = SCREEN_HEIGHT;
+        Hardware hardware;
+        bool turbo = false;
+        bool tape_block = false;                            // A standard block is ahead on the tape as the traps were set.
+        std::vector<u8> autotype_keys;
+        size_t autotype_pos = 0;
+        int autotype_wait = 0;
+        std::vector<Board_State> slots;
+        Rewind rewind;
+        std::vector<u8> rewind_record;
+        std::vector<u8> rewind_stream;
+        bool rewinding = false;
+        Board_State ahead_state;
+        bool ahead = false;                                 // Frames run ahead or netplay ones, they may be thrown away.
+        Netplay netplay;
+        std::vector<Board_State> net_states;                // Before the frames not confirmed by the peer.
+        u32 net_count;
         // Devices
         FDC fdc;
-        Joystick joystick;
-        Mouse mouse;
+        DivMMC divmmc;
 };
@@ -4,6 +4,9 @@
 #define SCREEN_HEIGHT               (DISPLAY_HEIGHT*2L)
 #define ASPECT_RATIO                ((float)DISPLAY_WIDTH/(float)DISPLAY_HEIGHT)
 #define CONFIG_MODIFIED             __TIMESTAMP__
+#define FAST_FORWARD_MAX            3
+#define AUTO_TURBO_FRAMES_MAX       32
+#define RUN_AHEAD_MAX               4
 
 enum Hardware { HW_Pentagon_128, HW_Sinclair_128, HW_Sinclair_48 };
 enum AY_Mixer { ABC, ACB, Mono };
@@ -20,6 +23,16 @@ struct Cfg {
             "data/rom/48.rom"
         };
         bool full_speed = false;
+        int fast_forward = 0;           // Speed multiplier as power of two: x1, x2, x4, x8.
+        bool tape_traps = true;         // Load tape blocks through the ROM routine trap.
+        bool edge_loading = true;       // Skip tape loader sampling loops to the next edge.
+        bool fast_disk = false;         // FDC commands without mechanical and data rate delays.
+        bool auto_turbo = true;         // Run uncapped while the tape plays or the disk is busy.
+        int turbo_frames = 8;           // Frames emulated per displayed one in auto turbo.
+        bool divmmc = false;            // DivMMC interface, SD card images are opened as .img.
+        char divmmc_rom[4096] = "data/rom/esxmmc.bin";
+        int run_ahead = 0;              // Frames emulated ahead of the displayed one with the current input, 0 - off.
+        int rewind_size = 32;           // Rewind buffer, MB, 0 - off. Held Alt+Backspace runs the frames back.
     } main;
     struct Video {
         int screen_width = SCREEN_WIDTH;
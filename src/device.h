@@ -4,6 +4,7 @@ class IO {
         virtual ~IO() {};
         virtual void read(u16 port, u8* byte, s32 clk=0) {};
         virtual void write(u16 port, u8 byte, s32 clk=0) {};
+        virtual bool trap(u16 pc) { return false; };
 };
 
 class Device : public IO {
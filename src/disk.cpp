@@ -0,0 +1,711 @@
+#include <cstddef>
+#include <stdio.h>
+#include <string.h>
+#include <stdexcept>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "types.h"
+#include "utils.h"
+#include "filemap.h"
+#include "disk.h"
+
+#define LE16(p) ((u32)((p)[0] | (p)[1] << 8))
+#define LE32(p) ((u32)((p)[0] | (p)[1] << 8 | (p)[2] << 16 | (p)[3] << 24))
+
+u16 Disk::crc(const u8 *data, size_t size, u16 crc){
+    while (size--){
+        crc ^= *data++ << 8;
+        for (int i = 0; i < 8; i++)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+void Disk::close(){
+    stop_writeback();
+    if (flat != file.data()) // Not mapped.
+        DELETE_ARRAY(flat);
+    flat = NULL;
+    format = None;
+    file.close();
+    flat_size = 0;
+    tracks.clear();
+}
+
+void Disk::open(const char *path, Format type, File_Map::Mode mode){
+    close();
+    if (!file.open(path, mode))
+        throw std::runtime_error("Open disk image");
+    tracks.resize(DISK_CYLINDERS * DISK_SIDES);
+    format = type;
+}
+
+// An in-memory image has no file to write back to or a journal, its changes are kept in memory.
+void Disk::load_trd(const char *path){
+    bool memory = File_Map::is_memory(path);
+    if (!memory)
+        replay(path);
+    open(path, TRD, File_Map::Private);
+    flat = file.data();
+    flat_size = file.size();
+    if (!memory)
+        start_writeback(path);
+}
+
+void Disk::start_writeback(const char *path){
+    if (!(image = fopen(path, "r+b"))){
+        printf("WARN: Disk image is read only, the changes are kept in memory.\n");
+        return;
+    }
+    snprintf(image_path, sizeof(image_path), "%s", path);
+    snprintf(journal_path, sizeof(journal_path), "%s.jnl", path);
+    pending.clear();
+    pending_data.clear();
+    stop = false;
+    thread = std::thread(&Disk::worker, this);
+}
+
+// The queued tracks are written before the thread ends.
+void Disk::stop_writeback(){
+    if (!image)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    ready.notify_one();
+    thread.join();
+    fclose(image);
+    image = NULL;
+    image_path[0] = 0x00;
+}
+
+void Disk::load_scl(const char *path){
+    open(path, TRD);
+    flat_size = TRD_SIZE;
+    flat = new u8[flat_size];
+    memset(flat, 0x00, flat_size);
+    u8 *data = file.data();
+    SCL_Header *header = (SCL_Header*)data;
+    if (file.size() < sizeof(SCL_Header) || memcmp(header->signature, "SINCLAIR", 8) || header->files > 128){
+        close();
+        throw std::runtime_error("SCL format");
+    }
+    u8 *src = data + sizeof(SCL_Header);
+    u8 *dst = flat;
+    u8 del_files = 0;
+    u32 sectors = 0;
+    for (int file = 0; file < header->files; file++){
+        if (*src == 0x00) // Directory end.
+            break;
+        if (*src == 0x01) // Deleted file.
+            del_files++;
+        memcpy(dst, src, 0x0E);
+        dst[0x0E] = sectors % 0x10;
+        dst[0x0F] = sectors / 0x10 + 1;
+        sectors += src[0x0D];
+        src += 0x0E, dst += 0x10;
+    }
+    sectors = MIN(sectors, (u32)(file.data() + file.size() - src) / TRD_SECTOR_SIZE);
+    memcpy(flat + TRD_SECTOR_SIZE * TRD_SECTORS, src, MIN(sectors * TRD_SECTOR_SIZE, (u32)(flat_size - TRD_SECTOR_SIZE * TRD_SECTORS)));
+    dst = &flat[TRD_SECTOR_SIZE * 8];
+    //Free space start at
+    dst[0xE1] = sectors % 0x10;
+    dst[0xE2] = sectors / 0x10 + 1;
+    // FMT DD2S80T
+    dst[0xE3] = 0x16;
+    dst[0xE4] = header->files;
+    // Free space amount
+    dst[0xE5] = (2544 - sectors) % 0x100;
+    dst[0xE6] = (2544 - sectors) / 0x100;
+    // TRDOS ID
+    dst[0xE7] = 0x10;
+    dst[0xE8] = 0x00;
+    dst[0xE9] = 0x00;
+    // Just spaces
+    memset(dst + 0xEA, ' ', 9);
+    dst[0xF3] = 0x00;
+    dst[0xF4] = del_files;
+    // Label
+    memcpy(dst + 0xF5, "Emulator", 8);
+    dst[0xFD] = 0x00;
+    dst[0xFE] = 0x00;
+    dst[0xFF] = 0x00;
+    file.close();
+}
+
+// Track headers are walked to find track locations, the tracks are decoded on access.
+void Disk::load_udi(const char *path){
+    open(path, UDI);
+    const u8 *data = file.data();
+    const u8 *end = data + file.size();
+    UDI_Header *header = (UDI_Header*)data;
+    if (file.size() < sizeof(UDI_Header) || memcmp(header->signature, "UDI!", 4)){
+        close();
+        throw std::runtime_error("UDI format");
+    }
+    const u8 *p = data + sizeof(UDI_Header) + header->header_ext;
+    for (int cyl = 0; cyl <= header->cylinders; cyl++){
+        for (int side = 0; side <= header->sides; side++){
+            if (p + 3 > end)
+                return;
+            u32 len = LE16(p + 1);
+            if (cyl < DISK_CYLINDERS && side < DISK_SIDES && p + 3 + len + (len + 7) / 8 <= end){
+                if (!p[0]) // MFM.
+                    tracks[cyl * DISK_SIDES + side].src = p;
+                else
+                    printf("WARN: UDI track type %02X is not supported.\n", p[0]);
+            }
+            p += 3 + len + (len + 7) / 8;
+        }
+    }
+}
+
+void Disk::load_fdi(const char *path){
+    open(path, FDI);
+    const u8 *data = file.data();
+    const u8 *end = data + file.size();
+    FDI_Header *header = (FDI_Header*)data;
+    if (file.size() < sizeof(FDI_Header) || memcmp(header->signature, "FDI", 3)){
+        close();
+        throw std::runtime_error("FDI format");
+    }
+    const u8 *p = data + sizeof(FDI_Header) + header->header_ext;
+    for (int cyl = 0; cyl < header->cylinders; cyl++){
+        for (int side = 0; side < header->sides; side++){
+            if (p + 7 > end || p + 7 + p[6] * 7 > end)
+                return;
+            if (cyl < DISK_CYLINDERS && side < DISK_SIDES)
+                tracks[cyl * DISK_SIDES + side].src = p;
+            p += 7 + p[6] * 7;
+        }
+    }
+}
+
+void Disk::load_td0(const char *path){
+    open(path, TD0);
+    const u8 *data = file.data();
+    const u8 *end = data + file.size();
+    TD0_Header *header = (TD0_Header*)data;
+    if (file.size() < sizeof(TD0_Header) || (memcmp(header->signature, "TD", 2) && memcmp(header->signature, "td", 2))){
+        close();
+        throw std::runtime_error("TD0 format");
+    }
+    if (header->signature[0] == 't'){ // LZHUF.
+        close();
+        throw std::runtime_error("TD0 advanced compression is not supported");
+    }
+    const u8 *p = data + sizeof(TD0_Header);
+    if (header->stepping & 0x80){ // Comment: CRC, length, date and time.
+        if (p + 10 > end)
+            return;
+        p += 10 + LE16(p + 2);
+    }
+    while (p + 4 <= end && p[0] != 0xFF){
+        int cyl = p[1], side = p[2] & 0x01;
+        if (cyl < DISK_CYLINDERS)
+            tracks[cyl * DISK_SIDES + side].src = p;
+        int sectors = p[0];
+        p += 4;
+        for (int i = 0; i < sectors && p + 6 <= end; i++){
+            u8 flags = p[4];
+            p += 6;
+            if (!(flags & 0x30) && p + 2 <= end)
+                p += 2 + LE16(p);
+        }
+    }
+}
+
+// The image is written to a temporary file renamed over the target, the target may be the mapped image itself.
+void Disk::save_trd(const char *path){
+    if (format == None)
+        throw std::runtime_error("Disk image is not exist");
+    char temp[4096];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE *fp = fopen(temp, "wb");
+    if (!fp)
+        throw std::runtime_error("Write TRD");
+    bool written;
+    if (format == TRD)
+        written = fwrite(flat, 1, flat_size, fp) == flat_size;
+    else{ // Standard TR-DOS sectors of a track image.
+        std::vector<u8> image(TRD_SIZE, 0x00);
+        for (int i = 0; i < TRD_SIZE / TRD_TRACK_SIZE; i++){
+            Track *track = get_track(i / DISK_SIDES, i % DISK_SIDES);
+            for (size_t j = 0; j < track->sectors.size(); j++){
+                Sector &sector = track->sectors[j];
+                if (sector.data && sector.n == 1 && sector.r >= 1 && sector.r <= TRD_SECTORS)
+                    memcpy(&image[(i * TRD_SECTORS + sector.r - 1) * TRD_SECTOR_SIZE], sector.data, TRD_SECTOR_SIZE);
+            }
+        }
+        written = fwrite(image.data(), 1, image.size(), fp) == image.size();
+    }
+    written &= !fclose(fp);
+    if (!written){
+        remove(temp);
+        throw std::runtime_error("Write TRD");
+    }
+    bool loaded = format == TRD && image && !strcmp(path, image_path);
+    if (loaded){
+        stop_writeback();
+        file.close();
+        flat = NULL;
+    }
+#ifdef _WIN32
+    remove(path);
+#endif
+    bool renamed = !rename(temp, path);
+    if (!renamed)
+        remove(temp);
+    if (loaded)
+        remap(path);
+    if (!renamed)
+        throw std::runtime_error("Write TRD");
+}
+
+// The saved image is mapped again, the sectors of the decoded tracks point into the new mapping.
+void Disk::remap(const char *path){
+    if (!file.open(path, File_Map::Private) || file.size() != flat_size){
+        close();
+        throw std::runtime_error("Open disk image");
+    }
+    flat = file.data();
+    for (size_t i = 0; i < tracks.size(); i++)
+        for (size_t j = 0; j < tracks[i].sectors.size(); j++)
+            tracks[i].sectors[j].data = flat + (i * TRD_SECTORS + j) * TRD_SECTOR_SIZE;
+    start_writeback(path);
+}
+
+Track* Disk::get_track(int cyl, int side){
+    if (format == None || cyl < 0 || cyl >= DISK_CYLINDERS || side < 0 || side >= DISK_SIDES)
+        return NULL;
+    Track &track = tracks[cyl * DISK_SIDES + side];
+    if (!track.decoded)
+        decode(track, cyl, side);
+    return &track;
+}
+
+Sector* Disk::find_sector(int cyl, int side, u8 c, u8 r){
+    Track *track = get_track(cyl, side);
+    if (!track)
+        return NULL;
+    if (format == TRD){ // Sectors are in order.
+        if (r < 1 || r > track->sectors.size() || track->sectors[r - 1].c != c)
+            return NULL;
+        return &track->sectors[r - 1];
+    }
+    for (size_t i = 0; i < track->sectors.size(); i++)
+        if (track->sectors[i].c == c && track->sectors[i].r == r)
+            return &track->sectors[i];
+    return NULL;
+}
+
+void Disk::decode(Track &track, int cyl, int side){
+    track.decoded = true;
+    switch (format){
+        case TRD:
+            if ((size_t)(cyl * DISK_SIDES + side + 1) * TRD_TRACK_SIZE > flat_size)
+                break;
+            for (int r = 1; r <= TRD_SECTORS; r++){
+                Sector sector = { (u8)cyl, (u8)side, (u8)r, 1, 0, flat + ((cyl * DISK_SIDES + side) * TRD_SECTORS + r - 1) * TRD_SECTOR_SIZE };
+                track.sectors.push_back(sector);
+            }
+            break;
+        case UDI:
+            if (track.src)
+                decode_udi(track);
+            break;
+        case FDI:
+            if (track.src)
+                decode_fdi(track);
+            break;
+        case TD0:
+            if (track.src)
+                decode_td0(track);
+            break;
+        default:
+            break;
+    }
+}
+
+// Sector data is copied, so the track can be written.
+void Disk::set_sectors(Track &track, std::vector<Sector> &ids, std::vector<const u8*> &src){
+    size_t total = 0;
+    for (size_t i = 0; i < ids.size(); i++)
+        if (src[i])
+            total += ids[i].size();
+    track.data.assign(total, 0x00);
+    track.sectors.clear();
+    u8 *dst = track.data.data();
+    for (size_t i = 0; i < ids.size(); i++){
+        Sector sector = ids[i];
+        sector.data = NULL;
+        if (src[i]){
+            memcpy(dst, src[i], sector.size());
+            sector.data = dst;
+            dst += sector.size();
+        }
+        track.sectors.push_back(sector);
+    }
+}
+
+// MFM bytes with a bitmap of sync marks: A1 with a missing clock bit starts an address mark.
+void Disk::decode_udi(Track &track){
+    u32 len = LE16(track.src + 1);
+    const u8 *raw = track.src + 3;
+    const u8 *marks = raw + len;
+    std::vector<Sector> ids;
+    std::vector<const u8*> src;
+    track.raw.assign(raw, raw + len);
+    for (u32 i = 0; i + 1 < len; i++){
+        if (raw[i] != 0xA1 || !(marks[i >> 3] & (1 << (i & 0x07))) || raw[i + 1] == 0xA1)
+            continue;
+        u8 mark = raw[i + 1];
+        u8 head[4] = { 0xA1, 0xA1, 0xA1, mark };
+        if (mark == 0xFE && i + 8 <= len){
+            if (crc(raw + i + 2, 4, crc(head, 4)) != (raw[i + 6] << 8 | raw[i + 7]))
+                continue; // ID CRC error, the sector is not seen.
+            Sector sector = { raw[i + 2], raw[i + 3], raw[i + 4], raw[i + 5], SECTOR_NO_DATA, NULL };
+            ids.push_back(sector);
+            src.push_back(NULL);
+            i += 7;
+        }else if ((mark == 0xFB || mark == 0xF8) && ids.size() && !src.back()){
+            Sector &sector = ids.back();
+            if (i + 2 + sector.size() + 2 > len)
+                break;
+            const u8 *data = raw + i + 2;
+            sector.flags = mark == 0xF8 ? SECTOR_DELETED : 0;
+            if (crc(data, sector.size(), crc(head, 4)) != (data[sector.size()] << 8 | data[sector.size() + 1]))
+                sector.flags |= SECTOR_CRC_ERROR;
+            src.back() = data;
+            i += 1 + sector.size();
+        }
+    }
+    set_sectors(track, ids, src);
+}
+
+// Track header: data offset, reserved, sectors, then C, H, R, N, flags, data offset for every sector.
+void Disk::decode_fdi(Track &track){
+    const u8 *data = file.data();
+    const u8 *end = data + file.size();
+    const u8 *base = data + ((FDI_Header*)data)->data_offset + LE32(track.src);
+    std::vector<Sector> ids;
+    std::vector<const u8*> src;
+    for (int i = 0; i < track.src[6]; i++){
+        const u8 *p = track.src + 7 + i * 7;
+        Sector sector = { p[0], p[1], p[2], p[3], 0, NULL };
+        if (!(p[4] & (1 << (sector.n & 0x07)))) // CRC is valid for the size.
+            sector.flags |= SECTOR_CRC_ERROR;
+        if (p[4] & 0x80)
+            sector.flags |= SECTOR_DELETED;
+        const u8 *sector_data = base + LE16(p + 5);
+        if (sector_data + sector.size() > end){
+            sector.flags |= SECTOR_NO_DATA;
+            sector_data = NULL;
+        }
+        ids.push_back(sector);
+        src.push_back(sector_data);
+    }
+    set_sectors(track, ids, src);
+}
+
+// Sector data is raw, a repeated 2 byte pattern, or RLE blocks.
+void Disk::decode_td0(Track &track){
+    const u8 *end = file.data() + file.size();
+    const u8 *p = track.src + 4;
+    std::vector<Sector> ids;
+    std::vector<size_t> offsets;
+    std::vector<u8> buffer;
+    for (int i = 0; i < track.src[0] && p + 6 <= end; i++){
+        Sector sector = { p[0], p[1], p[2], p[3], 0, NULL };
+        u8 flags = p[4];
+        p += 6;
+        if (flags & 0x02)
+            sector.flags |= SECTOR_CRC_ERROR;
+        if (flags & 0x04)
+            sector.flags |= SECTOR_DELETED;
+        if ((flags & 0x30) || p + 3 > end){
+            sector.flags |= SECTOR_NO_DATA;
+            ids.push_back(sector);
+            offsets.push_back(SIZE_MAX);
+            continue;
+        }
+        const u8 *block = p + 3;
+        const u8 *block_end = p + 2 + LE16(p) < end ? p + 2 + LE16(p) : end;
+        u8 encoding = p[2];
+        p = block_end;
+        size_t offset = buffer.size();
+        size_t size = sector.size();
+        switch (encoding){
+            case 0x00: // Raw.
+                buffer.insert(buffer.end(), block, block + MIN(size, (size_t)(block_end - block)));
+                break;
+            case 0x01: // Repeated pattern: count, 2 bytes.
+                if (block + 4 <= block_end)
+                    for (u32 count = LE16(block); count && buffer.size() - offset < size; count--)
+                        buffer.insert(buffer.end(), block + 2, block + 4);
+                break;
+            case 0x02: // Blocks: 0, length, literal bytes or 2^N pattern length, count, pattern.
+                while (block + 2 <= block_end && buffer.size() - offset < size){
+                    if (!block[0]){
+                        u32 len = MIN((u32)block[1], (u32)(block_end - block - 2));
+                        buffer.insert(buffer.end(), block + 2, block + 2 + len);
+                        block += 2 + len;
+                    }else{
+                        u32 len = 1 << block[0];
+                        u32 count = block[1];
+                        if (block + 2 + len > block_end)
+                            break;
+                        while (count--)
+                            buffer.insert(buffer.end(), block + 2, block + 2 + len);
+                        block += 2 + len;
+                    }
+                }
+                break;
+            default:
+                printf("WARN: TD0 sector encoding %d is not supported.\n", encoding);
+                break;
+        }
+        buffer.resize(offset + size, 0x00);
+        ids.push_back(sector);
+        offsets.push_back(offset);
+    }
+    std::vector<const u8*> src;
+    for (size_t i = 0; i < ids.size(); i++)
+        src.push_back(offsets[i] == SIZE_MAX ? NULL : buffer.data() + offsets[i]);
+    set_sectors(track, ids, src);
+}
+
+// MFM track built from sectors in the IBM System 34 layout.
+std::vector<u8>& Disk::get_raw(int cyl, int side){
+    static std::vector<u8> unformatted;
+    Track *track = get_track(cyl, side);
+    if (!track)
+        return unformatted;
+    std::vector<u8> &raw = track->raw;
+    if (!raw.empty() || track->sectors.empty())
+        return raw;
+    size_t used = 80 + 12 + 4 + 50;
+    for (size_t i = 0; i < track->sectors.size(); i++)
+        used += 12 + 4 + 4 + 2 + 22 + (track->sectors[i].data ? 12 + 4 + track->sectors[i].size() + 2 : 0);
+    int gap = used < TRACK_RAW_SIZE ? MIN((int)((TRACK_RAW_SIZE - used) / track->sectors.size()), 54) : 1;
+    raw.insert(raw.end(), 80, 0x4E);
+    raw.insert(raw.end(), 12, 0x00);
+    raw.insert(raw.end(), 3, 0xC2);
+    raw.push_back(0xFC);
+    raw.insert(raw.end(), 50, 0x4E);
+    for (size_t i = 0; i < track->sectors.size(); i++){
+        Sector &sector = track->sectors[i];
+        raw.insert(raw.end(), 12, 0x00);
+        size_t start = raw.size();
+        raw.insert(raw.end(), 3, 0xA1);
+        u8 id[] = { 0xFE, sector.c, sector.h, sector.r, sector.n };
+        raw.insert(raw.end(), id, id + sizeof(id));
+        u16 value = crc(&raw[start], raw.size() - start);
+        raw.push_back(value >> 8);
+        raw.push_back(value & 0xFF);
+        raw.insert(raw.end(), 22, 0x4E);
+        if (!sector.data)
+            continue;
+        raw.insert(raw.end(), 12, 0x00);
+        start = raw.size();
+        raw.insert(raw.end(), 3, 0xA1);
+        raw.push_back(sector.flags & SECTOR_DELETED ? 0xF8 : 0xFB);
+        raw.insert(raw.end(), sector.data, sector.data + sector.size());
+        value = crc(&raw[start], raw.size() - start);
+        if (sector.flags & SECTOR_CRC_ERROR)
+            value ^= 0xFFFF;
+        raw.push_back(value >> 8);
+        raw.push_back(value & 0xFF);
+        raw.insert(raw.end(), gap, 0x4E);
+    }
+    raw.resize(TRACK_RAW_SIZE, 0x4E);
+    return raw;
+}
+
+// "Write track" stream: F5 writes A1 sync, F6 - C2, F7 - two CRC bytes.
+void Disk::write_track(int cyl, int side, const u8 *data, size_t size){
+    Track *track = get_track(cyl, side);
+    if (!track)
+        return;
+    std::vector<Sector> ids;
+    std::vector<const u8*> src;
+    for (size_t i = 0; i < size; i++){
+        if (data[i] != 0xF5)
+            continue;
+        while (i < size && data[i] == 0xF5)
+            i++;
+        if (i + 5 > size)
+            break;
+        if (data[i] == 0xFE){
+            Sector sector = { data[i + 1], data[i + 2], data[i + 3], data[i + 4], SECTOR_NO_DATA, NULL };
+            ids.push_back(sector);
+            src.push_back(NULL);
+            i += 4;
+        }else if ((data[i] == 0xFB || data[i] == 0xF8) && ids.size() && !src.back()){
+            Sector &sector = ids.back();
+            if (i + 1 + sector.size() > size)
+                break;
+            sector.flags = data[i] == 0xF8 ? SECTOR_DELETED : 0;
+            src.back() = data + i + 1;
+            i += sector.size();
+        }
+    }
+    if (format == TRD){ // The image layout is fixed, only the sector data is taken.
+        for (size_t i = 0; i < ids.size(); i++)
+            if (src[i] && ids[i].n == 1 && ids[i].r >= 1 && ids[i].r <= track->sectors.size())
+                memcpy(track->sectors[ids[i].r - 1].data, src[i], TRD_SECTOR_SIZE);
+    }else
+        set_sectors(*track, ids, src);
+    modify(cyl, side);
+}
+
+// TR-DOS catalog: 16 byte file entries in sectors 1-8 of the track 0, the disk info in the sector 9.
+bool Disk::catalog(std::vector<TRD_File> &files, char *label){
+    files.clear();
+    Sector *info = find_sector(0, 0, 0, TRD_INFO_SECTOR);
+    if (!info || !info->data || info->size() != TRD_SECTOR_SIZE || info->data[0xE7] != TRD_ID)
+        return false;
+    if (label){
+        memcpy(label, info->data + 0xF5, 8);
+        label[8] = 0x00;
+    }
+    for (int r = 1; r <= TRD_CATALOG_SECTORS; r++){
+        Sector *sector = find_sector(0, 0, 0, r);
+        if (!sector || !sector->data || sector->size() != TRD_SECTOR_SIZE)
+            break;
+        for (int i = 0; i < TRD_SECTOR_SIZE; i += 0x10){
+            const u8 *entry = sector->data + i;
+            if (entry[0] == 0x00) // Catalog end.
+                return true;
+            if (entry[0] == 0x01) // Deleted file.
+                continue;
+            TRD_File file;
+            memcpy(file.name, entry, 8);
+            file.name[8] = 0x00;
+            file.type = entry[8];
+            file.start = LE16(entry + 9);
+            file.length = LE16(entry + 11);
+            file.sectors = entry[13];
+            file.sector = entry[14];
+            file.track = entry[15];
+            files.push_back(file);
+        }
+    }
+    return true;
+}
+
+bool Disk::read_file(const TRD_File &file, std::vector<u8> &data){
+    data.clear();
+    for (int pos = file.track * TRD_SECTORS + file.sector; pos < file.track * TRD_SECTORS + file.sector + file.sectors; pos++){
+        int track = pos / TRD_SECTORS;
+        Sector *sector = find_sector(track / DISK_SIDES, track % DISK_SIDES, track / DISK_SIDES, pos % TRD_SECTORS + 1);
+        if (!sector || !sector->data || sector->size() != TRD_SECTOR_SIZE)
+            return false;
+        data.insert(data.end(), sector->data, sector->data + TRD_SECTOR_SIZE);
+    }
+    return true;
+}
+
+// Called from the emulation thread after the track data is changed, the track copy is queued for write-back.
+void Disk::modify(int cyl, int side){
+    Track *track = get_track(cyl, side);
+    if (!track)
+        return;
+    track->raw.clear();
+    if (!image)
+        return;
+    u32 idx = cyl * DISK_SIDES + side;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t i = 0;
+        while (i < pending.size() && pending[i] != idx)
+            i++;
+        if (i == pending.size()){
+            pending.push_back(idx);
+            pending_data.resize(pending.size() * TRD_TRACK_SIZE);
+        }
+        memcpy(&pending_data[i * TRD_TRACK_SIZE], flat + idx * TRD_TRACK_SIZE, TRD_TRACK_SIZE);
+    }
+    ready.notify_one();
+}
+
+void Disk::worker(){
+    std::vector<u32> ids;
+    std::vector<u8> data;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true){
+        ready.wait(lock, [this]{ return stop || !pending.empty(); });
+        if (pending.empty())
+            break;
+        ready.wait_for(lock, std::chrono::milliseconds(JOURNAL_DELAY), [this]{ return stop; });
+        ids.swap(pending);
+        data.swap(pending_data);
+        pending.clear();
+        pending_data.clear();
+        lock.unlock();
+        flush(ids, data);
+        lock.lock();
+    }
+}
+
+// The tracks are appended to the journal first, it's removed when the image is updated.
+void Disk::flush(std::vector<u32> &ids, std::vector<u8> &data){
+    FILE *fp = fopen(journal_path, "ab");
+    bool journaled = fp != NULL;
+    for (size_t i = 0; fp && i < ids.size(); i++){
+        Journal_Record record = { { 'T', 'R', 'K', 'J' }, ids[i] };
+        journaled &= fwrite(&record, sizeof(record), 1, fp) == 1;
+        journaled &= fwrite(&data[i * TRD_TRACK_SIZE], 1, TRD_TRACK_SIZE, fp) == TRD_TRACK_SIZE;
+    }
+    if (fp){
+        journaled &= !fflush(fp);
+        fclose(fp);
+    }
+    bool written = true;
+    for (size_t i = 0; i < ids.size(); i++){
+        written &= !fseek(image, ids[i] * TRD_TRACK_SIZE, SEEK_SET);
+        written &= fwrite(&data[i * TRD_TRACK_SIZE], 1, TRD_TRACK_SIZE, image) == TRD_TRACK_SIZE;
+    }
+    written &= !fflush(image);
+    if (written)
+        remove(journal_path);
+    else
+        printf(journaled ? "WARN: Write disk image, the journal is kept.\n" : "WARN: Write disk image.\n");
+}
+
+// The tracks of an interrupted write-back are applied to the image.
+void Disk::replay(const char *path){
+    char name[4096];
+    snprintf(name, sizeof(name), "%s.jnl", path);
+    FILE *fp = fopen(name, "rb");
+    if (!fp)
+        return;
+    FILE *img = fopen(path, "r+b");
+    if (!img){
+        fclose(fp);
+        printf("WARN: Disk journal %s is not applied.\n", name);
+        return;
+    }
+    Journal_Record record;
+    std::vector<u8> data(TRD_TRACK_SIZE);
+    bool written = true;
+    while (fread(&record, sizeof(record), 1, fp) == 1 && !memcmp(record.signature, "TRKJ", 4) && fread(data.data(), 1, TRD_TRACK_SIZE, fp) == TRD_TRACK_SIZE){
+        if (record.track >= TRD_SIZE / TRD_TRACK_SIZE){ // Damaged, the image is not grown.
+            written = false;
+            continue;
+        }
+        written &= !fseek(img, record.track * TRD_TRACK_SIZE, SEEK_SET);
+        written &= fwrite(data.data(), 1, TRD_TRACK_SIZE, img) == TRD_TRACK_SIZE;
+    }
+    written &= !fclose(img);
+    fclose(fp);
+    if (!written){
+        printf("WARN: Disk journal %s is not fully applied, it's kept.\n", name);
+        return;
+    }
+    remove(name);
+    printf("Disk journal %s is applied.\n", name);
+}
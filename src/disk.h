@@ -0,0 +1,144 @@
+// Disk image with track level access.
+// TRD and SCL are kept flat, sectors of a track point right into the image.
+// UDI, FDI and TD0 are indexed at load, a track is decoded into sectors on the first access and cached.
+// A TRD image is mapped copy-on-write. Modified tracks are written back by a background thread,
+// through a sidecar journal replayed on the next load if the write was interrupted.
+
+#define DISK_CYLINDERS              86
+#define DISK_SIDES                  2
+#define TRD_SECTORS                 16
+#define TRD_SECTOR_SIZE             0x100
+#define TRD_TRACK_SIZE              (TRD_SECTORS * TRD_SECTOR_SIZE)
+#define TRD_SIZE                    (80 * DISK_SIDES * TRD_TRACK_SIZE)
+#define TRD_CATALOG_SECTORS         8
+#define TRD_INFO_SECTOR             9                       // Disk info, the same as at 0x8E1 of the image.
+#define TRD_ID                      0x10                    // TR-DOS disk ID at 0xE7 of the info sector.
+#define TRACK_RAW_SIZE              6250                    // MFM track bytes, 250 kbit/s at 300 rpm.
+#define JOURNAL_DELAY               500                     // Msec, tracks written within are flushed together.
+
+// Sector flags.
+#define SECTOR_CRC_ERROR            0b00000001              // Data CRC error.
+#define SECTOR_DELETED              0b00000010              // Deleted data mark F8.
+#define SECTOR_NO_DATA              0b00000100              // ID without data.
+
+struct Sector {
+    u8 c, h, r, n;                                          // ID: cylinder, head, sector, size code.
+    u8 flags;
+    u8 *data;
+    u32 size() { return 0x80 << (n & 0x07); };
+};
+
+struct TRD_File {
+    char name[9];
+    char type;                                              // B - Basic, C - code, D - data, # - stream.
+    u16 start;                                              // Load address, or the program and variables length of BASIC.
+    u16 length;
+    u8 sectors;
+    u8 sector;                                              // The first one.
+    u8 track;                                               // Logical track, cylinder * 2 + side.
+};
+
+struct Track {
+    bool decoded = false;
+    const u8 *src = NULL;                                   // Track location in the image file.
+    std::vector<Sector> sectors;
+    std::vector<u8> data;                                   // Sector data of a decoded track.
+    std::vector<u8> raw;                                    // MFM bytes, built for "Read track".
+};
+
+#pragma pack(1)
+struct UDI_Header {
+    char signature[4];                                      // "UDI!"
+    u32 size;                                               // File size without CRC.
+    u8 version;
+    u8 cylinders;                                           // The last cylinder.
+    u8 sides;                                               // The last side.
+    u8 reserved;
+    u32 header_ext;
+};
+struct FDI_Header {
+    char signature[3];                                      // "FDI"
+    u8 write_protect;
+    u16 cylinders;
+    u16 sides;
+    u16 text_offset;
+    u16 data_offset;
+    u16 header_ext;
+};
+struct SCL_Entry {
+    char file_name[8];
+    char file_type;
+};
+struct SCL_Header {
+    char signature[8];
+    unsigned char files;
+};
+struct Journal_Record {
+    char signature[4];                                      // "TRKJ", the track data follows.
+    u32 track;                                              // Cylinder * 2 + side.
+};
+struct TD0_Header {
+    char signature[2];                                      // "TD", "td" is the compressed one.
+    u8 sequence;
+    u8 check_sig;
+    u8 version;
+    u8 data_rate;
+    u8 drive_type;
+    u8 stepping;                                            // Bit 7 - the comment block follows.
+    u8 dos_alloc;
+    u8 sides;
+    u16 crc;
+};
+#pragma pack()
+
+class Disk {
+    public:
+        enum Format { None, TRD, UDI, FDI, TD0 };
+        Disk() {};
+        ~Disk() { close(); };
+        void load_trd(const char *path);
+        void load_scl(const char *path);
+        void load_udi(const char *path);
+        void load_fdi(const char *path);
+        void load_td0(const char *path);
+        void save_trd(const char *path);
+        void close();
+        bool is_loaded() { return format != None; };
+        Track* get_track(int cyl, int side);
+        Sector* find_sector(int cyl, int side, u8 c, u8 r);
+        std::vector<u8>& get_raw(int cyl, int side);
+        void write_track(int cyl, int side, const u8 *data, size_t size);
+        void modify(int cyl, int side);
+        bool catalog(std::vector<TRD_File> &files, char *label = NULL);
+        bool read_file(const TRD_File &file, std::vector<u8> &data);
+        static u16 crc(const u8 *data, size_t size, u16 crc = 0xFFFF);
+    private:
+        void open(const char *path, Format format, File_Map::Mode mode = File_Map::Read);
+        void decode(Track &track, int cyl, int side);
+        void decode_udi(Track &track);
+        void decode_fdi(Track &track);
+        void decode_td0(Track &track);
+        void set_sectors(Track &track, std::vector<Sector> &ids, std::vector<const u8*> &src);
+        void replay(const char *path);
+        void start_writeback(const char *path);
+        void stop_writeback();
+        void remap(const char *path);
+        void worker();
+        void flush(std::vector<u32> &ids, std::vector<u8> &data);
+
+        Format format = None;
+        File_Map file;
+        u8 *flat = NULL;                                    // TRD sectors, mapped or converted from SCL.
+        size_t flat_size = 0;
+        std::vector<Track> tracks;                          // Cylinder major, side minor.
+        // TRD write-back.
+        FILE *image = NULL;
+        char image_path[4096] = "";
+        char journal_path[4096];
+        std::vector<u32> pending;                           // Modified tracks, written by the emulation thread.
+        std::vector<u8> pending_data;
+        bool stop;
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable ready;
+};
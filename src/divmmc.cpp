@@ -0,0 +1,296 @@
+#include <cstddef>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "types.h"
+#include "utils.h"
+#include "config.h"
+#include "device.h"
+#include "memory.h"
+#include "filemap.h"
+#include "divmmc.h"
+
+static const u16 entry_points[] = { 0x0000, 0x0008, 0x0038, 0x0066, 0x04C6, 0x0562 };
+
+bool SD_Card::open(const char *path){
+    close();
+    read_only = false;
+    if (!file.open(path, File_Map::Shared)){
+        read_only = true;
+        if (!file.open(path)){
+            printf("WARN: Open SD card image.\n");
+            return false;
+        }
+        printf("WARN: SD card image is read only.\n");
+    }
+    if (file.size() < SD_SIZE_UNIT){
+        printf("WARN: SD card image is smaller than 512K.\n");
+        close();
+        return false;
+    }
+    idle = true;
+    app_cmd = false;
+    state = SD_Command;
+    cmd_len = 0;
+    out.clear();
+    out_pos = 0;
+    return true;
+}
+
+void SD_Card::close(){
+    file.sync();
+    file.close();
+}
+
+void SD_Card::select(bool state){
+    if (state == selected)
+        return;
+    selected = state;
+    cmd_len = 0;
+}
+
+void SD_Card::queue(const u8 *data, size_t size){
+    if (out_pos == out.size()){
+        out.clear();
+        out_pos = 0;
+    }
+    out.insert(out.end(), data, data + size);
+}
+
+void SD_Card::queue_block(u32 block){
+    u8 token = SD_TOKEN_START;
+    u8 crc[2] = { 0xFF, 0xFF };
+    queue(&token, 1);
+    queue(file.data() + (size_t)block * SD_BLOCK_SIZE, SD_BLOCK_SIZE);
+    queue(crc, 2);
+}
+
+// The card returns the byte queued by the previous exchanges while it takes the host one.
+u8 SD_Card::exchange(u8 byte){
+    if (!selected || !file.is_open())
+        return 0xFF;
+    if (out_pos == out.size() && state == SD_Read_Multi){
+        if ((size_t)(block + 1) * SD_BLOCK_SIZE <= file.size())
+            queue_block(block++);
+    }
+    u8 result = out_pos < out.size() ? out[out_pos++] : 0xFF;
+    switch (state){
+        case SD_Write_Token:
+            if (byte == (multi ? SD_TOKEN_MULTI : SD_TOKEN_START)){
+                in.clear();
+                state = SD_Write_Data;
+            }else if (multi && byte == SD_TOKEN_STOP){
+                u8 busy[] = { 0x00, 0xFF };
+                queue(busy, sizeof(busy));
+                state = SD_Command;
+            }
+            break;
+        case SD_Write_Data:{
+            in.push_back(byte);
+            if (in.size() < SD_BLOCK_SIZE + 2)
+                break;
+            u8 response[] = { SD_DATA_ACCEPTED, 0x00, 0xFF };
+            if (read_only || (size_t)(block + 1) * SD_BLOCK_SIZE > file.size())
+                response[0] = SD_DATA_WRITE_ERROR;
+            else
+                memcpy(file.data() + (size_t)block * SD_BLOCK_SIZE, in.data(), SD_BLOCK_SIZE);
+            block++;
+            queue(response, sizeof(response));
+            state = multi ? SD_Write_Token : SD_Command;
+            break;
+        }
+        case SD_Command:
+        case SD_Read_Multi:
+            if (!cmd_len && (byte & 0xC0) != 0x40) // Start and transmission bits.
+                break;
+            cmd[cmd_len++] = byte;
+            if (cmd_len == 6){
+                cmd_len = 0;
+                command();
+            }
+            break;
+    }
+    return result;
+}
+
+void SD_Card::command(){
+    u8 index = cmd[0] & 0x3F;
+    u32 arg = cmd[1] << 24 | cmd[2] << 16 | cmd[3] << 8 | cmd[4];
+    u8 r1 = idle ? SD_R1_IDLE : 0x00;
+    u8 response[6] = { 0xFF, r1 };                         // A byte of command response time, R1 and the rest.
+    size_t size = 2;
+    if (app_cmd){
+        app_cmd = false;
+        index |= 0x80;
+    }
+    if (state == SD_Read_Multi && index != 12)
+        return;
+    switch (index){
+        case 0: // GO_IDLE_STATE
+            idle = true;
+            response[1] = SD_R1_IDLE;
+            break;
+        case 1: // SEND_OP_COND
+        case 0x80 | 41: // SD_SEND_OP_COND
+            idle = false;
+            response[1] = 0x00;
+            break;
+        case 8: // SEND_IF_COND, voltage accepted and the check pattern.
+            response[2] = 0x00;
+            response[3] = 0x00;
+            response[4] = 0x01;
+            response[5] = arg & 0xFF;
+            size = 6;
+            break;
+        case 9:{ // SEND_CSD, version 2.0.
+            u32 c_size = file.size() / SD_SIZE_UNIT - 1;
+            u8 csd[] = { SD_TOKEN_START, 0x40, 0x0E, 0x00, 0x32, 0x5B, 0x59, 0x00, (u8)((c_size >> 16) & 0x3F), (u8)(c_size >> 8), (u8)c_size, 0x7F, 0x80, 0x0A, 0x40, 0x00, 0x01, 0xFF, 0xFF };
+            queue(response, size);
+            queue(csd, sizeof(csd));
+            return;
+        }
+        case 10:{ // SEND_CID
+            u8 cid[] = { SD_TOKEN_START, 0x01, 'Z', 'X', 'E', 'M', 'U', 'S', 'D', 0x10, 0x00, 0x00, 0x00, 0x01, 0x01, 0x01, 0x01, 0xFF, 0xFF };
+            queue(response, size);
+            queue(cid, sizeof(cid));
+            return;
+        }
+        case 12: // STOP_TRANSMISSION
+            out.clear();
+            out_pos = 0;
+            state = SD_Command;
+            response[1] = 0x00;
+            break;
+        case 16: // SET_BLOCKLEN
+        case 59: // CRC_ON_OFF
+        case 0x80 | 23: // SET_WR_BLK_ERASE_COUNT
+            break;
+        case 17: // READ_SINGLE_BLOCK
+        case 18: // READ_MULTIPLE_BLOCK
+        case 24: // WRITE_BLOCK
+        case 25: // WRITE_MULTIPLE_BLOCK
+            if ((size_t)(arg + 1) * SD_BLOCK_SIZE > file.size()){
+                response[1] = r1 | SD_R1_PARAMETER;
+                break;
+            }
+            block = arg;
+            multi = index == 18 || index == 25;
+            if (index == 17){
+                queue(response, size);
+                queue_block(block);
+                return;
+            }
+            state = index == 18 ? SD_Read_Multi : SD_Write_Token;
+            break;
+        case 55: // APP_CMD
+            app_cmd = true;
+            break;
+        case 58:{ // READ_OCR: powered up, high capacity.
+            u8 ocr[] = { 0xC0, 0xFF, 0x80, 0x00 };
+            memcpy(response + 2, ocr, sizeof(ocr));
+            size = 6;
+            break;
+        }
+        default:
+            response[1] = r1 | SD_R1_ILLEGAL;
+            break;
+    }
+    queue(response, size);
+}
+
+DivMMC::DivMMC(Memory *memory) : memory(memory) {
+    rom = new u8[DIVMMC_BANK_SIZE]();
+    ram = new u8[DIVMMC_BANK_SIZE * DIVMMC_BANKS]();
+    window = new u8[DIVMMC_BANK_SIZE * 2]();
+    spi = 0xFF;
+}
+
+DivMMC::~DivMMC(){
+    card.close();
+    DELETE_ARRAY(rom);
+    DELETE_ARRAY(ram);
+    DELETE_ARRAY(window);
+}
+
+bool DivMMC::load_rom(const char *path){
+    FILE *fp = fopen(path, "rb");
+    if (!fp){
+        printf("WARN: Load DivMMC ROM file.\n");
+        return false;
+    }
+    memset(rom, 0xFF, DIVMMC_BANK_SIZE);
+    fread(rom, 1, DIVMMC_BANK_SIZE, fp);
+    fclose(fp);
+    update();
+    return true;
+}
+
+void DivMMC::set_traps(bool state){
+    for (u16 entry : entry_points){
+        memory->set_trap(ROM_48, entry, state);
+        memory->set_trap(ROM_128, entry, state);
+    }
+}
+
+bool DivMMC::is_entry(u16 pc){
+    for (u16 entry : entry_points)
+        if (pc == entry)
+            return true;
+    return false;
+}
+
+void DivMMC::automap(bool state){
+    automapped = state;
+    update();
+}
+
+// The instruction of the off-mapping area runs from the real bytes, the traps are set back by the next update.
+u8 DivMMC::restore_off_area(u16 pc){
+    memcpy(window + DIVMMC_OFF_AREA, (control & DC_MAPRAM) && !(control & DC_CONMEM) ? ram + DIVMMC_MAPRAM_BANK * DIVMMC_BANK_SIZE + DIVMMC_OFF_AREA : rom + DIVMMC_OFF_AREA, DIVMMC_BANK_SIZE - DIVMMC_OFF_AREA);
+    return window[pc];
+}
+
+void DivMMC::update(){
+    if (window_bank >= 0)
+        memcpy(ram + window_bank * DIVMMC_BANK_SIZE, window + DIVMMC_BANK_SIZE, DIVMMC_BANK_SIZE);
+    window_bank = control & DC_BANK;
+    bool mapram = (control & DC_MAPRAM) && !(control & DC_CONMEM);
+    memcpy(window, mapram ? ram + DIVMMC_MAPRAM_BANK * DIVMMC_BANK_SIZE : rom, DIVMMC_BANK_SIZE);
+    memcpy(window + DIVMMC_BANK_SIZE, ram + window_bank * DIVMMC_BANK_SIZE, DIVMMC_BANK_SIZE);
+    memset(window + DIVMMC_OFF_AREA, TRAP_BYTE, DIVMMC_BANK_SIZE - DIVMMC_OFF_AREA);
+    if (mapped())
+        memory->map_overlay(window, !(mapram && window_bank == DIVMMC_MAPRAM_BANK));
+    else
+        memory->unmap_overlay();
+}
+
+void DivMMC::read(u16 port, u8 *byte, s32 clk){
+    if ((port & 0xFF) == DIVMMC_SPI){
+        *byte = spi;
+        spi = card.exchange(0xFF);
+    }
+}
+
+void DivMMC::write(u16 port, u8 byte, s32 clk){
+    switch (port & 0xFF){
+        case DIVMMC_CONTROL:
+            control = byte | (control & DC_MAPRAM);
+            update();
+            break;
+        case DIVMMC_CARD_SELECT:
+            card.select(!(byte & 0x01));
+            break;
+        case DIVMMC_SPI:
+            spi = card.exchange(byte);
+            break;
+    }
+}
+
+void DivMMC::reset(){
+    control &= DC_MAPRAM;
+    automapped = false;
+    spi = 0xFF;
+    card.select(false);
+    update();
+}
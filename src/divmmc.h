@@ -0,0 +1,85 @@
+// DivMMC interface: 8K EEPROM (esxDOS), 128K RAM and SD card over SPI.
+// The memory is paged into 0x0000-0x3FFF on an instruction fetch at the entry points and paged out at 0x1FF8-0x1FFF.
+// Both 8K halves are kept in a 16K window, the RAM bank is copied back to the bank on a paging change.
+
+#define DIVMMC_CONTROL              0xE3                    // Write only.
+#define DIVMMC_CARD_SELECT          0xE7                    // Write only, active low.
+#define DIVMMC_SPI                  0xEB                    // SPI data, read or write starts a byte exchange.
+#define DIVMMC_BANK_SIZE            0x2000
+#define DIVMMC_BANKS                16
+#define DIVMMC_MAPRAM_BANK          3                       // The bank mapped at 0x0000 instead of EEPROM.
+#define DIVMMC_OFF_AREA             0x1FF8                  // Fetch at 0x1FF8-0x1FFF pages it out after the instruction.
+
+// Control register.
+#define DC_CONMEM                   0b10000000              // Page in, EEPROM at 0x0000 is writable.
+#define DC_MAPRAM                   0b01000000              // Bank 3 instead of EEPROM, read only. Set until power off.
+#define DC_BANK                     0b00001111
+
+// SD card in SPI mode, SDHC with 512 byte blocks.
+#define SD_BLOCK_SIZE               512
+#define SD_SIZE_UNIT                (SD_BLOCK_SIZE * 1024)  // CSD 2.0 capacity unit, the smallest card.
+#define SD_R1_IDLE                  0x01
+#define SD_R1_ILLEGAL               0x04
+#define SD_R1_PARAMETER             0x40
+#define SD_TOKEN_START              0xFE
+#define SD_TOKEN_MULTI              0xFC                    // Start of a multiple block write.
+#define SD_TOKEN_STOP               0xFD
+#define SD_DATA_ACCEPTED            0x05
+#define SD_DATA_WRITE_ERROR         0x0D
+
+class SD_Card {
+    enum State { SD_Command, SD_Write_Token, SD_Write_Data, SD_Read_Multi };
+    public:
+        bool open(const char *path);
+        void close();
+        bool is_open() { return file.is_open(); };
+        void select(bool state);
+        u8 exchange(u8 byte);
+    private:
+        void command();
+        void queue(const u8 *data, size_t size);
+        void queue_block(u32 block);
+
+        File_Map file;
+        bool read_only;
+        bool selected = false;
+        bool idle;
+        bool app_cmd;
+        State state = SD_Command;
+        u8 cmd[6];
+        int cmd_len = 0;
+        std::vector<u8> out;                                // Response bytes, shifted out by the next exchanges.
+        size_t out_pos = 0;
+        std::vector<u8> in;                                 // Written block with CRC.
+        u32 block;                                          // Next block of a multiple block transfer.
+        bool multi;
+};
+
+class DivMMC : public Device {
+    public:
+        DivMMC(Memory *memory);
+        ~DivMMC();
+        bool load_rom(const char *path);
+        bool open_card(const char *path) { return card.open(path); };
+        void set_traps(bool state);
+        bool is_entry(u16 pc);
+        bool is_off_area(u16 pc) { return mapped() && pc >= DIVMMC_OFF_AREA && pc < DIVMMC_BANK_SIZE; };
+        void automap(bool state);
+        u8 restore_off_area(u16 pc);
+        void read(u16 port, u8 *byte, s32 clk);
+        void write(u16 port, u8 byte, s32 clk);
+        void reset();
+    private:
+        bool mapped() { return (control & DC_CONMEM) || automapped; };
+        void update();
+
+        Memory *memory;
+        SD_Card card;
+        u8 *rom;
+        u8 *ram;
+        u8 *window;                                         // 0x0000-0x3FFF while paged in.
+        int window_bank = -1;                               // The bank in the upper half of the window.
+        u8 control = 0x00;
+        bool automapped = false;
+        u8 spi;                                             // The byte received by the last exchange.
+};
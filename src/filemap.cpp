@@ -0,0 +1,139 @@
+#include <cstddef>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <mutex>
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+#include "types.h"
+#include "utils.h"
+#include "filemap.h"
+
+static std::mutex memory_mutex;
+static std::map<std::string, std::vector<u8>> memory_files;
+
+void File_Map::add(const char *path, const void *data, size_t size){
+    std::lock_guard<std::mutex> lock(memory_mutex);
+    memory_files[path].assign((const u8*)data, (const u8*)data + size);
+}
+
+void File_Map::remove(const char *path){
+    std::lock_guard<std::mutex> lock(memory_mutex);
+    memory_files.erase(path);
+}
+
+bool File_Map::is_memory(const char *path){
+    std::lock_guard<std::mutex> lock(memory_mutex);
+    auto file = memory_files.find(path);
+    return file != memory_files.end() && !file->second.empty();
+}
+
+// In-memory files are opened as a copy, the writes don't go back to them.
+bool File_Map::open_memory(const char *path){
+    std::lock_guard<std::mutex> lock(memory_mutex);
+    auto file = memory_files.find(path);
+    if (file == memory_files.end() || file->second.empty())
+        return false;
+    length = file->second.size();
+    ptr = new u8[length];
+    memcpy(ptr, file->second.data(), length);
+    owned = true;
+    return true;
+}
+
+#ifdef _WIN32
+bool File_Map::open(const char *path, Mode mode){
+    close();
+    if (open_memory(path))
+        return true;
+    file = CreateFileA(path, mode == Shared ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE){
+        file = NULL;
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file, &file_size);
+    length = file_size.QuadPart;
+    if (length)
+        mapping = CreateFileMappingA(file, NULL, mode == Shared ? PAGE_READWRITE : mode == Private ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+    if (mapping)
+        ptr = (u8*)MapViewOfFile(mapping, mode == Shared ? FILE_MAP_WRITE : mode == Private ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+    if (!ptr){
+        close();
+        return false;
+    }
+    return true;
+}
+
+void File_Map::close(){
+    if (owned){
+        DELETE_ARRAY(ptr);
+        length = 0;
+        owned = false;
+        return;
+    }
+    if (ptr)
+        UnmapViewOfFile(ptr);
+    if (mapping)
+        CloseHandle(mapping);
+    if (file)
+        CloseHandle(file);
+    ptr = NULL;
+    mapping = file = NULL;
+    length = 0;
+}
+
+void File_Map::sync(){
+    if (owned)
+        return;
+    if (ptr)
+        FlushViewOfFile(ptr, 0);
+}
+#else
+bool File_Map::open(const char *path, Mode mode){
+    close();
+    if (open_memory(path))
+        return true;
+    int fd = ::open(path, mode == Shared ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (!fstat(fd, &st) && st.st_size){
+        void *map = mmap(NULL, st.st_size, mode == Read ? PROT_READ : PROT_READ | PROT_WRITE, mode == Shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED){
+            ptr = (u8*)map;
+            length = st.st_size;
+        }
+    }
+    ::close(fd);
+    return ptr != NULL;
+}
+
+void File_Map::close(){
+    if (owned){
+        DELETE_ARRAY(ptr);
+        length = 0;
+        owned = false;
+        return;
+    }
+    if (ptr)
+        munmap(ptr, length);
+    ptr = NULL;
+    length = 0;
+}
+
+void File_Map::sync(){
+    if (owned)
+        return;
+    if (ptr)
+        msync(ptr, length, MS_SYNC);
+}
+#endif
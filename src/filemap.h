@@ -0,0 +1,28 @@
+// Memory mapped file. Private mode gives copy-on-write pages, the file itself is never modified.
+// A path added as an in-memory file opens a copy of its data instead, the loaders take media from buffers that way.
+
+class File_Map {
+    public:
+        enum Mode { Read, Private, Shared };
+        File_Map() {};
+        ~File_Map() { close(); };
+        bool open(const char *path, Mode mode = Read);
+        void close();
+        void sync();
+        u8* data() { return ptr; };
+        size_t size() { return length; };
+        bool is_open() { return ptr != NULL; };
+        static void add(const char *path, const void *data, size_t size);
+        static void remove(const char *path);
+        static bool is_memory(const char *path);
+    private:
+        bool open_memory(const char *path);
+
+        u8 *ptr = NULL;
+        size_t length = 0;
+        bool owned = false;
+#ifdef _WIN32
+        void *file = NULL;
+        void *mapping = NULL;
+#endif
+};
@@ -2,6 +2,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdexcept>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "types.h"
 #include "utils.h"
 #include "config.h"
@@ -9,20 +13,69 @@
 #include "memory.h"
 #include "ula.h"
 #include "z80.h"
+#include "filemap.h"
+#include "disk.h"
 #include "floppy.h"
 
 //#define DEBUG
 
 FDC::FDC(){
-    fdd[0].data = fdd[1].data = fdd[2].data = fdd[3].data = NULL;
     reset();
 }
 
 FDC::~FDC(){
-    DELETE_ARRAY(fdd[0].data);
-    DELETE_ARRAY(fdd[1].data);
-    DELETE_ARRAY(fdd[2].data);
-    DELETE_ARRAY(fdd[3].data);
+}
+
+// Command phase delay, true while it lasts. It's over at once in fast mode.
+bool FDC::wait(s32 period){
+    if (fast){
+        cmd_time = time;
+        return false;
+    }
+    if (time - cmd_time < period)
+        return true;
+    cmd_time += period;
+    return false;
+}
+
+// Finds the ID of a sector for the type II commands and "Read address", true when the data transfer can start.
+bool FDC::locate(){
+    u8 cmd = reg_command >> 4;
+    if (sector || cmd >= 0x0E)
+        return true;
+    if (cmd == 0x0C){ // The ID under the head.
+        Track *track = drive->disk.get_track(drive->track, side());
+        if (track && track->sectors.size())
+            sector = &track->sectors[(time / (DISK_TURN_PERIOD / track->sectors.size())) % track->sectors.size()];
+    }else{
+        sector = drive->disk.find_sector(drive->track, side(), reg_track, reg_sector);
+        if (sector && !sector->data)
+            sector = NULL;
+    }
+    if (!sector){
+        if (wait(DISK_TURN_PERIOD*5))
+            return false;
+        reg_status |= ST_RNF;
+        reg_status &= ~ST_BUSY;
+        return false;
+    }
+    if (cmd <= 0x09 && sector->flags & SECTOR_DELETED)
+        reg_status |= ST_RECORD_TYPE;
+    return true;
+}
+
+// Data of a sector is transferred, continue with the next one for multiple sectors command.
+void FDC::sector_end(){
+    if (sector->flags & SECTOR_CRC_ERROR){
+        reg_status |= ST_CRC_ERROR;
+        reg_status &= ~ST_BUSY;
+    }else if (!(reg_command & CM_MULTISEC)){
+        reg_status &= ~ST_BUSY;
+    }else{
+        reg_sector++;
+        data_idx = 0;
+    }
+    sector = NULL;
 }
 
 void FDC::update(s32 clk){
@@ -33,7 +86,7 @@ void FDC::update(s32 clk){
             printf("Command %02x, status: %02x, sys: %02x, fdd.track: %02x, reg_trk: %02x, reg_sec: %02x, reg_dat: %02x, step_dir: %02x, idx: %02x, time: %d, clk: %d\n", reg_command, reg_status, reg_system, drive->track, reg_track, reg_sector, reg_data, step_dir, data_idx, time, clk);
     #endif
     reg_status &= ~ST_NOT_READY;
-    if (!drive->data){
+    if (!drive->disk.is_loaded()){
         reg_status |= ST_NOT_READY;
         reg_status &= ~ST_BUSY;
         return;
@@ -62,7 +115,7 @@ void FDC::update(s32 clk){
                 case 0x06: // Step backward
                 case 0x07: // Step backward modify
                     if (step_cnt){
-                        int steps = MIN(step_cnt, (time - cmd_time) / step_rate[reg_command & CM_STEP_RATE]);
+                        int steps = fast ? step_cnt : MIN(step_cnt, (time - cmd_time) / step_rate[reg_command & CM_STEP_RATE]);
                         if (!steps)
                             break;
                         if (reg_command & CM_TRACK_MODIFY)
@@ -72,28 +125,25 @@ void FDC::update(s32 clk){
                             reg_track = 0;
                         }
                         drive->track = MIN(drive->track + steps*step_dir, 79);
-                        cmd_time += steps*step_rate[reg_command & CM_STEP_RATE];
+                        cmd_time = fast ? time : cmd_time + steps*step_rate[reg_command & CM_STEP_RATE];
                         step_cnt -= steps;
                         if (step_cnt)
                             break;
                     }
                     if (reg_command & CM_VERIFY){
                         if (!hld){
-                            if (time - cmd_time < DELAY_15MS)
+                            if (wait(DELAY_15MS))
                                 break;
-                            cmd_time += DELAY_15MS;
                             hld = true;
                         }
                         if (!drive->hlt){
-                            if (time - cmd_time < HLT_TIME)
+                            if (wait(HLT_TIME))
                                 break;
                             drive->hlt = true;
-                            cmd_time += HLT_TIME;
                         }
                         if (reg_track != drive->track){
-                            if (time - cmd_time < DISK_TURN_PERIOD*5)
+                            if (wait(DISK_TURN_PERIOD*5))
                                 break;
-                            cmd_time += DISK_TURN_PERIOD*5;
                             reg_status |= ST_SEEK_ERROR;
                         }
                     }
@@ -104,29 +154,33 @@ void FDC::update(s32 clk){
                 case 0x0A: // Write sector
                 case 0x0B: // Write sectors
                 case 0x0C: // Read address
+                case 0x0E: // Read track
+                case 0x0F: // Write track
                     if (reg_command & CM_DELAY){
-                        if (time - cmd_time < DELAY_15MS)
+                        if (wait(DELAY_15MS))
                             break;
-                        cmd_time += DELAY_15MS;
                         reg_command &= ~CM_DELAY;
                     }
                     if (!drive->hlt){
-                        if (time - cmd_time < HLT_TIME)
+                        if (wait(HLT_TIME))
                             break;
-                        cmd_time += HLT_TIME;
                         drive->hlt = true;
                     }
-                    /*
-                    if (!data_idx && (reg_track != drive->track || reg_sector < 1 || reg_sector > 0x11)){
-                        if (time - cmd_time < DISK_TURN_PERIOD*5)
+                    if ((reg_command & 0xE0) == 0xA0 || (reg_command & 0xF0) == 0xF0){ // Write commands.
+                        if (drive->wprt || locked){
+                            reg_status |= ST_WRITE_PROTECT;
+                            reg_status &= ~ST_BUSY;
                             break;
-                        cmd_time += DISK_TURN_PERIOD*5;
-                        reg_status |= ST_RNF;
+                        }
+                    }
+                    if (!locate())
+                        break;
+                    if ((reg_command & 0xF0) == 0xE0 && drive->disk.get_raw(drive->track, side()).empty()){ // Unformatted.
                         reg_status &= ~ST_BUSY;
                         break;
-                    }*/
+                    }
                     if (reg_status & ST_DRQ){
-                        if (time - cmd_time < DRQ_WIDTH)
+                        if (fast || time - cmd_time < DRQ_WIDTH) // The data is never lost in fast mode.
                             break;
                         //printf("LOST DATA time: %d, cmd_time: %d, elapsed: %d, DRQ PERIOD: %d, DRQ_WIDTH: %d\n", time, cmd_time, time - cmd_time, DRQ_PERIOD, DRQ_WIDTH);
                         cmd_time += DRQ_WIDTH;
@@ -134,18 +188,13 @@ void FDC::update(s32 clk){
                         reg_status &= ~(ST_DRQ | ST_BUSY);
                         break;
                     }
-                    if (time - cmd_time < DRQ_PERIOD)
+                    if (wait(DRQ_PERIOD))
                         break;
                     //printf("Set DRQ time: %d, cmd_time: %d, elapsed: %d\n", time, cmd_time, time - cmd_time);
-                    cmd_time += DRQ_PERIOD;
                     reg_status |= ST_DRQ;
                     break;
                 case 0x0D: // Force interrupt
                     break;
-                case 0x0E: // Read track
-                case 0x0F: // Write track
-                    reg_status &= ~(ST_BUSY | ST_DRQ);
-                    break;
             }
         }
     }
@@ -175,45 +224,44 @@ void FDC::read(u16 port, u8 *byte, s32 clk){
                     switch (reg_command >> 4){
                         case 0x08: // Read sector
                         case 0x09: // Read sectors
-                        case 0x0E: // Read track
-                            reg_data = drive->data[drive->track * 0x2000 + (reg_system & SS_HEAD ? 0 : 0x1000) + (reg_sector - 1) * 0x100 + data_idx];
-                            if (++data_idx >= 0x100){
-                                if (!(reg_command & CM_MULTISEC) || reg_sector >= 0x11){
-                                    reg_status &= ~ST_BUSY;
-                                }else{
-                                    reg_sector++;
-                                    data_idx = 0;
-                                }
-                            }
+                            reg_data = sector->data[data_idx];
+                            if (++data_idx >= (s32)sector->size())
+                                sector_end();
                             reg_status &= ~ST_DRQ;
                             break;
-                        case 0x0C: // Read address
+                        case 0x0E:{ // Read track
+                            std::vector<u8> &raw = drive->disk.get_raw(drive->track, side());
+                            reg_data = raw[data_idx];
+                            if (++data_idx >= (s32)raw.size())
+                                reg_status &= ~ST_BUSY;
+                            reg_status &= ~ST_DRQ;
+                            break;
+                        }
+                        case 0x0C:{ // Read address
+                            u8 id[] = { 0xA1, 0xA1, 0xA1, 0xFE, sector->c, sector->h, sector->r, sector->n };
+                            u16 crc = Disk::crc(id, sizeof(id));
                             switch (data_idx){
                                 case 0x00:
-                                    reg_data = drive->track;
-                                    break;
                                 case 0x01:
-                                    reg_data = reg_system & SS_HEAD ? 1 : 0;
-                                    break;
                                 case 0x02:
-                                    reg_data = time % 0x10 + 1;
-                                    break;
-                                case 0x03: // Sector size = 256b
-                                    reg_data = 1;
+                                case 0x03:
+                                    reg_data = id[4 + data_idx];
                                     break;
                                 case 0x04: // CRC
-                                    reg_data = time % 0x100;
+                                    reg_data = crc >> 8;
                                     break;
-                                 case 0x05:
-                                    reg_data = time % 0x100;
+                                case 0x05:
+                                    reg_data = crc & 0xFF;
                                     break;
                             }
                             if (++data_idx >= 6){
-                                reg_sector = drive->track;
+                                reg_sector = sector->c;
                                 reg_status &= ~ST_BUSY;
+                                sector = NULL;
                             }
                             reg_status &= ~ST_DRQ;
                             break;
+                        }
                     }
                 }
                 *byte = reg_data;
@@ -298,7 +346,9 @@ void FDC::write(u16 port, u8 byte, s32 clk){
                     case 0x0F: // Write track
                         hld = true;
                         data_idx = 0;
-                        reg_status &= ~(ST_WRITE_PROTECT | ST_WRITE_FAULT | ST_RNF | ST_LOST_DATA | ST_DRQ);
+                        sector = NULL;
+                        track_data.clear();
+                        reg_status &= ~(ST_WRITE_PROTECT | ST_WRITE_FAULT | ST_RNF | ST_CRC_ERROR | ST_LOST_DATA | ST_DRQ);
                         reg_status |= ST_BUSY;
                         break;
                     case 0x0D: // Force interrupt
@@ -322,16 +372,23 @@ void FDC::write(u16 port, u8 byte, s32 clk){
                     switch (reg_command >> 4){
                         case 0x0A: // Write sector
                         case 0x0B: // Write sectors
+                            sector->data[data_idx] = reg_data;
+                            if (++data_idx >= (s32)sector->size()){
+                                sector->flags &= ~(SECTOR_CRC_ERROR | SECTOR_DELETED);
+                                if (reg_command & 0x01) // Deleted data mark.
+                                    sector->flags |= SECTOR_DELETED;
+                                drive->disk.modify(drive->track, side());
+                                cmd_time = time;
+                                sector_end();
+                            }
+                            reg_status &= ~ST_DRQ;
+                            break;
                         case 0x0F: // Write track
-                            drive->data[drive->track * 0x2000 + (reg_system & SS_HEAD ? 0 : 0x1000) + (reg_sector - 1) * 0x100 + data_idx] = reg_data;
-                            if (++data_idx >= 0x100){
-                                if (!(reg_command & CM_MULTISEC) || reg_sector >= 0x11){
-                                    cmd_time = time;
-                                    reg_status &= ~ST_BUSY;
-                                }else{
-                                    reg_sector++;
-                                    data_idx = 0;
-                                }
+                            track_data.push_back(reg_data);
+                            if (track_data.size() >= TRACK_RAW_SIZE){
+                                drive->disk.write_track(drive->track, side(), track_data.data(), track_data.size());
+                                cmd_time = time;
+                                reg_status &= ~ST_BUSY;
                             }
                             reg_status &= ~ST_DRQ;
                             break;
@@ -347,6 +404,62 @@ void FDC::frame(s32 clk){
     last_clk -= clk;
 }
 
+void FDC::get_state(FDC_State &state, std::vector<u8> &stream){
+    state.status = reg_status;
+    state.track = reg_track;
+    state.sector = reg_sector;
+    state.data = reg_data;
+    state.command = reg_command;
+    state.system = reg_system;
+    state.hld = hld;
+    state.step_dir = step_dir;
+    state.step_cnt = step_cnt;
+    state.cmd_time = cmd_time;
+    state.data_idx = data_idx;
+    state.time = time;
+    state.last_clk = last_clk;
+    state.drive = drive - fdd;
+    for (int i = 0; i < 4; i++){
+        state.fdd_track[i] = fdd[i].track;
+        state.fdd_hlt[i] = fdd[i].hlt;
+    }
+    state.sector_cyl = drive->track;
+    state.sector_side = side();
+    state.sector_idx = -1;
+    Track *track = sector ? drive->disk.get_track(drive->track, side()) : NULL;
+    if (track && sector >= track->sectors.data() && sector < track->sectors.data() + track->sectors.size())
+        state.sector_idx = sector - track->sectors.data();
+    state.stream_size = track_data.size();
+    stream = track_data;
+}
+
+// The disks are the ones loaded, only the controller and the heads are restored.
+void FDC::set_state(const FDC_State &state, const u8 *stream){
+    reg_status = state.status;
+    reg_track = state.track;
+    reg_sector = state.sector;
+    reg_data = state.data;
+    reg_command = state.command;
+    reg_system = state.system;
+    hld = state.hld;
+    step_dir = state.step_dir;
+    step_cnt = state.step_cnt;
+    cmd_time = state.cmd_time;
+    data_idx = state.data_idx;
+    time = state.time;
+    last_clk = state.last_clk;
+    drive = &fdd[state.drive & 0x03];
+    for (int i = 0; i < 4; i++){
+        fdd[i].track = state.fdd_track[i];
+        fdd[i].hlt = state.fdd_hlt[i];
+    }
+    sector = NULL;
+    Track *track = state.sector_idx >= 0 ? drive->disk.get_track(state.sector_cyl, state.sector_side) : NULL;
+    if (track && state.sector_idx < (s32)track->sectors.size())
+        sector = &track->sectors[state.sector_idx];
+    track_data.assign(stream, stream + state.stream_size);
+}
+
 void FDC::reset(){
     reg_system = SS_RESET | SS_HALT;
     reg_sector = 1;
@@ -356,89 +469,47 @@ void FDC::reset(){
     step_cnt = 0xFF;
     step_dir = -1;;
     hld = false;
+    sector = NULL;
     reg_status &= ~(ST_HEAD_LOADED | ST_CRC_ERROR);
     reg_status |= ST_BUSY;
 }
 
 void FDC::load_trd(int drive_id, const char *path, bool write_protect){
     drive = &fdd[drive_id & 0x03];
-    DELETE_ARRAY(drive->data);
-    FILE *file = fopen(path, "rb");
-    fseek(file, 0, SEEK_END);
-    drive->size = ftell(file);
-    drive->data = new unsigned char[drive->size];
-    fseek(file, 0, SEEK_SET);
-    if (fread(drive->data, 1, drive->size, file) != drive->size)
-        throw std::runtime_error("Read TRD");
-    fclose(file);
+    sector = NULL;
+    drive->disk.load_trd(path);
     drive->wprt = write_protect;
 }
 
-void FDC::save_trd(int drive_id, const char *path){
+void FDC::load_scl(int drive_id, const char *path, bool write_protect){
     drive = &fdd[drive_id & 0x03];
-    if (!drive->data)
-        throw std::runtime_error("Disk image is not exist");
-    FILE *file = fopen(path, "wb");
-    if (fwrite(drive->data, 1, drive->size, file) != drive->size)
-        throw std::runtime_error("Write TRD");
-    fclose(file);
+    sector = NULL;
+    drive->disk.load_scl(path);
+    drive->wprt = write_protect;
 }
 
-void FDC::load_scl(int drive_id, const char *path, bool write_protect){
+void FDC::load_udi(int drive_id, const char *path, bool write_protect){
     drive = &fdd[drive_id & 0x03];
-    DELETE_ARRAY(drive->data);
-    drive->size = 655360;
-    drive->data = new u8[drive->size];
-    memset(drive->data, 0x00, drive->size);
-    FILE *file = fopen(path, "rb");
-    fseek(file, 0, SEEK_END);
-    size_t size = ftell(file);
-    u8 *data = new u8[size];
-    fseek(file, 0, SEEK_SET);
-    if (fread(data, 1, size, file) != size)
-        std::runtime_error("Read SCL");
-    fclose(file);
-    SCL_Header *header = (SCL_Header*)data;
-    if (memcmp(header->signature, "SINCLAIR", 8) || header->files > 128)
-        throw std::runtime_error("SCL format");
-    u8 *src = data + sizeof(SCL_Header);
-    u8 *dst = drive->data;
-    u8 del_files = 0, sectors = 0;
-    for (int file = 0; file < header->files; file++){
-        if (*src == 0x00) // Directory end.
-            break;
-        if (*src == 0x01) // Deleted file.
-            del_files++;
-        memcpy(dst, src, 0x0E);
-        dst[0x0E] = sectors % 0x10;
-        dst[0x0F] = sectors / 0x10 + 1;
-        sectors += src[0x0D];
-        src += 0x0E, dst += 0x10;
-    }
-    memcpy(drive->data + 0x100 * 0x10, src, sectors * 0x100);
-    DELETE_ARRAY(data);
-    dst = &drive->data[0x100 * 8];
-    //Free space start at
-    dst[0xE1] = sectors % 0x10;
-    dst[0xE2] = sectors / 0x10 + 1;
-    // FMT DD2S80T
-    dst[0xE3] = 0x16;
-    dst[0xE4] = header->files;
-    // Free space amount
-    dst[0xE5] = (2544 - sectors) % 0x100;
-    dst[0xE6] = (2544 - sectors) / 0x100;
-    // TRDOS ID
-    dst[0xE7] = 0x10;
-    dst[0xE8] = 0x00;
-    dst[0xE9] = 0x00;
-    // Just spaces
-    memset(dst + 0xEA, ' ', 9);
-    dst[0xF3] = 0x00;
-    dst[0xF4] = del_files;
-    // Label
-    memcpy(dst + 0xF5, "Emulator", 8);
-    dst[0xFD] = 0x00;
-    dst[0xFE] = 0x00;
-    dst[0xFF] = 0x00;
+    sector = NULL;
+    drive->disk.load_udi(path);
+    drive->wprt = write_protect;
+}
+
+void FDC::load_fdi(int drive_id, const char *path, bool write_protect){
+    drive = &fdd[drive_id & 0x03];
+    sector = NULL;
+    drive->disk.load_fdi(path);
     drive->wprt = write_protect;
 }
+
+void FDC::load_td0(int drive_id, const char *path, bool write_protect){
+    drive = &fdd[drive_id & 0x03];
+    sector = NULL;
+    drive->disk.load_td0(path);
+    drive->wprt = write_protect;
+}
+
+void FDC::save_trd(int drive_id, const char *path){
+    drive = &fdd[drive_id & 0x03];
+    drive->disk.save_trd(path);
+}
@@ -37,6 +37,7 @@
 #define ST_LOST_DATA                0b00000100              // Data timeout.
 #define ST_RNF                      0b00010000              // Record not found.
 #define ST_WRITE_FAULT              0b00100000              // FDD fault to write.
+#define ST_RECORD_TYPE              0b00100000              // Deleted data mark read.
 
 // Time in CPU clocks.
 #define DISK_TURN_PERIOD            Msec(200)               // Disk revolution time.
@@ -49,12 +50,29 @@
 
 struct FDD {
     bool hlt = false;
-    s16 track;                                              // Drive head track positioned on.
-    bool wprt;                                              // Write protected sensor status.
-    u8 *data;                                               // Disk image sectors data.
-    size_t size;
+    s16 track = 0;                                          // Drive head track positioned on.
+    bool wprt = false;                                      // Write protected sensor status.
+    Disk disk;
 };
 
+#pragma pack(1)
+struct FDC_State {                                          // Command in progress, the "Write track" stream follows.
+    u8 status, track, sector, data, command, system;
+    u8 hld;
+    s16 step_dir;
+    s16 step_cnt;
+    s32 cmd_time;
+    s32 data_idx;
+    s32 time;
+    s32 last_clk;
+    u8 drive;
+    s16 fdd_track[4];
+    u8 fdd_hlt[4];
+    s16 sector_cyl, sector_side, sector_idx;                // -1 index without a sector.
+    u32 stream_size;
+};
+#pragma pack()
+
 class FDC : public Device {
 public:
     FDC();
@@ -62,19 +80,33 @@ public:
 
     void load_trd(int drive, const char *file_path, bool write_protect = false);
     void load_scl(int drive, const char *file_path, bool write_protect = false);
+    void load_udi(int drive, const char *file_path, bool write_protect = false);
+    void load_fdi(int drive, const char *file_path, bool write_protect = false);
+    void load_td0(int drive, const char *file_path, bool write_protect = false);
     void save_trd(int drive, const char *file_path);
 
     void read(u16 port, u8 *byte, s32 clk);
     void write(u16 port, u8 byte, s32 clk);
 
+    Disk& get_disk(int drive) { return fdd[drive & 0x03].disk; };
+    bool is_busy() { return (reg_status & ST_BUSY) || hld; };
+    void get_state(FDC_State &state, std::vector<u8> &stream);
+    void set_state(const FDC_State &state, const u8 *stream);
+    void set_fast(bool state) { fast = state; };
+    void set_locked(bool state) { locked = state; };
     void update(int clk);
     void frame(int clk);
     void reset();
 
 private:
+    bool wait(s32 period);
+    bool locate();
+    void sector_end();
+    int side() { return reg_system & SS_HEAD ? 0 : 1; };
+
     FDD fdd[4];
     FDD *drive = &fdd[0];
-    u8 reg_status;
+    u8 reg_status = 0x00;
     u8 reg_track;
     u8 reg_sector;
     u8 reg_data;
@@ -83,20 +115,13 @@ private:
     bool hld;
     s16 step_dir;
     s16 step_cnt;
-    s32 cmd_time;
-    s32 data_idx;
-    s32 last_clk;
-    s32 time;
+    s32 cmd_time = 0;
+    s32 data_idx = 0;
+    Sector *sector = NULL;                                  // Sector of the current command.
+    std::vector<u8> track_data;                             // "Write track" stream.
+    s32 last_clk = 0;
+    s32 time = 0;
+    bool fast = false;                                      // No head move, head load and data rate delays.
+    bool locked = false;                                    // Write commands fail as on a write protected disk.
     s32 step_rate[4] = { Msec(3)/70, Msec(6), Msec(10), Msec(15) };
 };
-
-#pragma pack(1)
-struct SCL_Entry {
-    char file_name[8];
-    char file_type;
-};
-struct SCL_Header {
-    char signature[8];
-    unsigned char files;
-};
-#pragma pack()
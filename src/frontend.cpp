@@ -0,0 +1,486 @@
+#include <cstddef>
+#include <limits.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <deque>
+#include <string>
+#include <GL/glew.h>
+#include <SDL.h>
+#include "types.h"
+#include "utils.h"
+#include "config.h"
+#include "device.h"
+#include "memory.h"
+#include "ula.h"
+#include "z80.h"
+#include "filemap.h"
+#include "disk.h"
+#include "floppy.h"
+#include "divmmc.h"
+#include "keyboard.h"
+#include "joystick.h"
+#include "tape.h"
+#include "recorder.h"
+#include "sound.h"
+#include "snapshot.h"
+#include "movie.h"
+#include "netplay.h"
+#include "gdb.h"
+#include "mouse.h"
+#include "rewind.h"
+#include "board.h"
+#include "video.h"
+#include "ui.h"
+#include "frontend.h"
+
+//#define TIME
+//#define FRAME_LIMIT 50000
+
+namespace Frontend {
+    SDL_Window *window = NULL;
+    int viewport_width = SCREEN_WIDTH;
+    int viewport_height = SCREEN_HEIGHT;
+    int vsync = -1;                                         // Swap interval, -1 - not set yet.
+    SDL_GameController *controller = NULL;
+    SDL_AudioDeviceID audio_device = 0;
+    SDL_AudioSpec audio_spec;
+}
+
+static void keyboard_event(Keyboard &keyboard, SDL_Event &event){
+    if (event.type != SDL_KEYDOWN && event.type != SDL_KEYUP)
+        return;
+    switch (event.key.keysym.sym){
+        case SDLK_UP:
+            keyboard.button(0xFEFE, 0x01, event.type == SDL_KEYDOWN);
+            keyboard.button(0xEFFE, 0x08, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_DOWN:
+            keyboard.button(0xFEFE, 0x01, event.type == SDL_KEYDOWN);
+            keyboard.button(0xEFFE, 0x10, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_LEFT:
+            keyboard.button(0xFEFE, 0x01, event.type == SDL_KEYDOWN);
+            keyboard.button(0xF7FE, 0x10, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_RIGHT:
+            keyboard.button(0xFEFE, 0x01, event.type == SDL_KEYDOWN);
+            keyboard.button(0xEFFE, 0x04, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_BACKSPACE:
+            keyboard.button(0xFEFE, 0x01, event.type == SDL_KEYDOWN);
+            keyboard.button(0xEFFE, 0x01, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_KP_PLUS:
+            keyboard.button(0x7FFE, 0x02, event.type == SDL_KEYDOWN);
+            keyboard.button(0xBFFE, 0x04, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_MINUS:
+        case SDLK_KP_MINUS:
+            keyboard.button(0x7FFE, 0x02, event.type == SDL_KEYDOWN);
+            keyboard.button(0xBFFE, 0x08, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_KP_MULTIPLY:
+            keyboard.button(0x7FFE, 0x02, event.type == SDL_KEYDOWN);
+            keyboard.button(0x7FFE, 0x10, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_KP_DIVIDE:
+            keyboard.button(0x7FFE, 0x02, event.type == SDL_KEYDOWN);
+            keyboard.button(0xFEFE, 0x10, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_EQUALS:
+        case SDLK_KP_EQUALS:
+            keyboard.button(0x7FFE, 0x02, event.type == SDL_KEYDOWN);
+            keyboard.button(0xBFFE, 0x02, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_COMMA:
+        case SDLK_KP_COMMA:
+            keyboard.button(0x7FFE, 0x02, event.type == SDL_KEYDOWN);
+            keyboard.button(0x7FFE, 0x08, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_PERIOD:
+        case SDLK_KP_PERIOD:
+            keyboard.button(0x7FFE, 0x02, event.type == SDL_KEYDOWN);
+            keyboard.button(0x7FFE, 0x04, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_SPACE:
+            keyboard.button(0x7FFE, 0x01, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_LCTRL:
+        case SDLK_RCTRL:
+            keyboard.button(0x7FFE, 0x02, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_m:
+            keyboard.button(0x7FFE, 0x04, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_n:
+            keyboard.button(0x7FFE, 0x08, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_b:
+            keyboard.button(0x7FFE, 0x10, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_RETURN:
+        case SDLK_KP_ENTER:
+            keyboard.button(0xBFFE, 0x01, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_l:
+            keyboard.button(0xBFFE, 0x02, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_k:
+            keyboard.button(0xBFFE, 0x04, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_j:
+            keyboard.button(0xBFFE, 0x08, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_h:
+            keyboard.button(0xBFFE, 0x10, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_p:
+            keyboard.button(0xDFFE, 0x01, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_o:
+            keyboard.button(0xDFFE, 0x02, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_i:
+            keyboard.button(0xDFFE, 0x04, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_u:
+            keyboard.button(0xDFFE, 0x08, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_y:
+            keyboard.button(0xDFFE, 0x10, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_0:
+            keyboard.button(0xEFFE, 0x01, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_9:
+            keyboard.button(0xEFFE, 0x02, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_8:
+            keyboard.button(0xEFFE, 0x04, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_7:
+            keyboard.button(0xEFFE, 0x08, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_6:
+            keyboard.button(0xEFFE, 0x10, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_1:
+            keyboard.button(0xF7FE, 0x01, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_2:
+            keyboard.button(0xF7FE, 0x02, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_3:
+            keyboard.button(0xF7FE, 0x04, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_4:
+            keyboard.button(0xF7FE, 0x08, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_5:
+            keyboard.button(0xF7FE, 0x10, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_q:
+            keyboard.button(0xFBFE, 0x01, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_w:
+            keyboard.button(0xFBFE, 0x02, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_e:
+            keyboard.button(0xFBFE, 0x04, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_r:
+            keyboard.button(0xFBFE, 0x08, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_t:
+            keyboard.button(0xFBFE, 0x10, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_a:
+            keyboard.button(0xFDFE, 0x01, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_s:
+            keyboard.button(0xFDFE, 0x02, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_d:
+            keyboard.button(0xFDFE, 0x04, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_f:
+            keyboard.button(0xFDFE, 0x08, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_g:
+            keyboard.button(0xFDFE, 0x10, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_LSHIFT:
+        case SDLK_RSHIFT:
+            keyboard.button(0xFEFE, 0x01, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_z:
+            keyboard.button(0xFEFE, 0x02, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_x:
+            keyboard.button(0xFEFE, 0x04, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_c:
+            keyboard.button(0xFEFE, 0x08, event.type == SDL_KEYDOWN);
+            break;
+        case SDLK_v:
+            keyboard.button(0xFEFE, 0x10, event.type == SDL_KEYDOWN);
+            break;
+    }
+}
+
+static void joystick_event(Joystick &joystick, SDL_Event &event){
+    if (event.type == SDL_CONTROLLERBUTTONDOWN || event.type == SDL_CONTROLLERBUTTONUP){
+        switch (event.cbutton.button){
+            case SDL_CONTROLLER_BUTTON_DPAD_LEFT:
+                joystick.button(JB_Left, event.cbutton.state);
+                break;
+            case SDL_CONTROLLER_BUTTON_DPAD_RIGHT:
+                joystick.button(JB_Right, event.cbutton.state);
+                break;
+            case SDL_CONTROLLER_BUTTON_DPAD_DOWN:
+                joystick.button(JB_Down, event.cbutton.state);
+                break;
+            case SDL_CONTROLLER_BUTTON_DPAD_UP:
+                joystick.button(JB_Up, event.cbutton.state);
+                break;
+            case SDL_CONTROLLER_BUTTON_A:
+                joystick.button(JB_A, event.cbutton.state);
+                break;
+            case SDL_CONTROLLER_BUTTON_B:
+                joystick.button(JB_B, event.cbutton.state);
+                break;
+        }
+    }
+}
+
+static void mouse_event(Mouse &mouse, SDL_Event &event){
+    switch (event.type){
+        case SDL_MOUSEMOTION:
+            mouse.motion(event.motion.xrel, event.motion.yrel);
+            break;
+        case SDL_MOUSEBUTTONDOWN:
+            mouse.button((event.button.button & SDL_BUTTON_LEFT ? 0x01 : 0x00) | (event.button.button & SDL_BUTTON_RIGHT ? 0x02 : 0x00), true);
+            break;
+        case SDL_MOUSEBUTTONUP:
+            mouse.button((event.button.button & SDL_BUTTON_LEFT ? 0x01 : 0x00) | (event.button.button & SDL_BUTTON_RIGHT ? 0x02 : 0x00), false);
+            break;
+        case SDL_MOUSEWHEEL:
+            mouse.wheel(event.wheel.y);
+            break;
+    }
+}
+
+void Frontend::setup(){
+    window = SDL_GL_GetCurrentWindow();
+    if (SDL_IsGameController(0) == SDL_TRUE){
+       controller = SDL_GameControllerOpen(0);
+       SDL_GameControllerEventState(SDL_ENABLE);
+    }
+}
+
+void Frontend::free(){
+    if (controller){
+        SDL_GameControllerClose(controller);
+        controller = NULL;
+    }
+    if (audio_device){
+        SDL_CloseAudioDevice(audio_device);
+        audio_device = 0;
+    }
+}
+
+void Frontend::set_window_size(Cfg &cfg, int width, int height){
+    viewport_width = cfg.video.screen_width = width;
+    viewport_height = cfg.video.screen_height = height;
+    SDL_SetWindowSize(window, width, height);
+    Video::viewport_setup(width, height);
+}
+
+void Frontend::set_texture_filter(Filter filter){
+    Video::set_filter(filter);
+}
+
+void Frontend::set_full_screen(Cfg &cfg, bool state){
+    if (state){
+        SDL_SetWindowSize(window, SCREEN_WIDTH, SCREEN_HEIGHT);
+        SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN);
+    }else{
+        SDL_ShowCursor(SDL_DISABLE);
+        SDL_SetWindowFullscreen(window, 0);
+        SDL_SetWindowSize(window, cfg.video.screen_width, cfg.video.screen_height);
+    }
+    SDL_GetWindowSize(window, &cfg.video.screen_width, &cfg.video.screen_height);
+    Video::viewport_setup(cfg.video.screen_width, cfg.video.screen_height);
+    viewport_width = cfg.video.screen_width;
+    viewport_height = cfg.video.screen_height;
+    // Fix window position for imgui.
+    SDL_SetWindowPosition(window, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED);
+}
+
+void Frontend::set_vsync(bool state){
+    if (state == vsync)
+        return;
+    vsync = state;
+    SDL_GL_SetSwapInterval(state ? 1 : 0);
+}
+
+// The device holds two output frames, it's opened again as the sample rate or the frame length changes.
+void Frontend::queue_audio(Sound &sound){
+    u32 frame_samples = sound.get_samples();
+    if (!audio_device || audio_spec.freq != sound.get_sample_rate() || audio_spec.samples != frame_samples*2){
+        if (audio_device)
+            SDL_CloseAudioDevice(audio_device);
+        SDL_zero(audio_spec);
+        audio_spec.freq = sound.get_sample_rate();
+        audio_spec.format = AUDIO_S16;
+        audio_spec.channels = 2;
+        audio_spec.samples = frame_samples*2;
+        audio_spec.callback = NULL;
+        audio_device = SDL_OpenAudioDevice(NULL, 0, &audio_spec, NULL, 0);
+        if (!audio_device)
+            throw std::runtime_error("Open audio device");
+        std::vector<s16> silence(frame_samples*2);
+        SDL_QueueAudio(audio_device, silence.data(), frame_samples*4);
+        SDL_PauseAudioDevice(audio_device, 0);
+    }
+    if (SDL_GetAudioDeviceStatus(audio_device) == SDL_AUDIO_PLAYING){
+        while (SDL_GetQueuedAudioSize(audio_device) > (audio_spec.samples - frame_samples) * 4)
+            SDL_Delay(1);
+        SDL_QueueAudio(audio_device, sound.get_buffer(), frame_samples * 4);
+    }
+}
+
+void Frontend::run(Cfg &cfg, Board *board){
+    viewport_width = cfg.video.screen_width;
+    viewport_height = cfg.video.screen_height;
+#ifdef TIME
+    int frame_count = 0;
+    set_vsync(false);
+    cfg.main.full_speed = true;
+    Uint32 time_start = SDL_GetTicks();
+#endif
+    while (true){
+        SDL_Event event;
+        while (SDL_PollEvent(&event)){
+            switch (event.type){
+                case SDL_WINDOWEVENT:
+                    switch (event.window.event){
+                        case SDL_WINDOWEVENT_CLOSE:
+                            return;
+                        case SDL_WINDOWEVENT_RESIZED:
+                            viewport_width = event.window.data1;
+                            viewport_height = event.window.data2;
+                            break;
+                        case SDL_WINDOWEVENT_EXPOSED:
+                            Video::viewport_setup(viewport_width, viewport_height);
+                            break;
+                    }
+                    break;
+                case SDL_KEYDOWN:
+                    if (event.key.repeat)
+                        break;
+                    if (event.key.keysym.sym == SDLK_RETURN && event.key.keysym.mod & KMOD_CTRL){
+                        set_full_screen(cfg, cfg.video.full_screen ^= true);
+                        continue;
+                    }
+                    break;
+            }
+            if (UI::event(event)){
+                board->keyboard.clear();
+                continue;
+            }
+            switch (event.type){
+                case SDL_KEYDOWN:
+                    if (event.key.keysym.mod & KMOD_ALT && event.key.keysym.sym >= SDLK_0 && event.key.keysym.sym <= SDLK_9){
+                        if (event.key.keysym.mod & KMOD_SHIFT)
+                            board->quick_save(event.key.keysym.sym - SDLK_0);
+                        else
+                            board->quick_load(event.key.keysym.sym - SDLK_0);
+                        board->keyboard.clear();
+                        continue;
+                    }
+                    if (event.key.keysym.mod & KMOD_ALT && event.key.keysym.sym == SDLK_BACKSPACE){
+                        board->set_rewinding(true);
+                        board->keyboard.clear();
+                        continue;
+                    }
+                    switch (event.key.keysym.sym){
+                        case SDLK_F5:
+                            if (board->tape.is_play())
+                                board->tape.stop();
+                            else
+                                board->tape.play();
+                            continue;
+                        case SDLK_F6:
+                            board->tape.rewind_begin();
+                            board->update_traps();
+                            continue;
+                        case SDLK_F7:
+                            board->set_fast_forward((cfg.main.fast_forward + 1) % (FAST_FORWARD_MAX + 1));
+                            continue;
+                        case SDLK_F8:
+                            board->movie.stop();
+                            board->sound.record_stop();
+                            board->tape.record_stop();
+                            board->update_traps();
+                            continue;
+                        case SDLK_F9:
+                            cfg.main.full_speed ^= true;
+                            continue;
+                        case SDLK_F11:
+                            board->ula.set_main_rom(cfg.main.model != HW_Sinclair_48 ? ROM_128 : ROM_48);
+                            board->reset();
+                            continue;
+                        case SDLK_F12:
+                            board->ula.set_main_rom(ROM_Trdos);
+                            board->reset();
+                            break;
+                        case SDLK_RETURN:
+                            if (event.key.keysym.mod & KMOD_CTRL){
+                                set_full_screen(cfg, cfg.video.full_screen ^= true);
+                                continue;
+                            }
+                            break;
+                    }
+                case SDL_KEYUP:
+                    if (board->is_rewinding() && event.type == SDL_KEYUP && event.key.keysym.sym == SDLK_BACKSPACE){
+                        board->set_rewinding(false);
+                        continue;
+                    }
+                    if (event.key.keysym.mod & (KMOD_NUM | KMOD_CAPS))
+                        SDL_SetModState(KMOD_NONE);
+                    keyboard_event(board->keyboard, event);
+                    break;
+                default:
+                    joystick_event(board->joystick, event);
+                    mouse_event(board->mouse, event);
+                    break;
+            }
+        }
+        u16 *frame_buffer = Video::update();
+        if (!UI::is_modal()){
+            if (board->run_frame(frame_buffer) && !cfg.main.full_speed && !board->is_turbo())
+                queue_audio(board->sound);
+        }else
+            SDL_Delay(100);
+        set_vsync(!board->is_turbo() && cfg.video.vsync && !cfg.main.full_speed);
+        Video::frame();
+
+        if (UI::frame(cfg, board))
+            break;
+        SDL_GL_SwapWindow(window);
+#ifdef TIME
+        if (++frame_count > FRAME_LIMIT)
+            break;
+#endif
+    }
+#ifdef TIME
+    printf("Frames: %d, Time: %d\n", frame_count, (SDL_GetTicks() - time_start));
+    cfg.video.vsync = true;
+#endif
+}
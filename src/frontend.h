@@ -0,0 +1,13 @@
+// SDL frontend over the machine: the window, input events, hotkeys and the audio device.
+// The emulation itself is in Board, it doesn't depend on SDL, GL or ImGui.
+
+namespace Frontend {
+    void setup();
+    void run(Cfg &cfg, Board *board);
+    void free();
+    void set_window_size(Cfg &cfg, int width, int height);
+    void set_texture_filter(Filter filter);
+    void set_full_screen(Cfg &cfg, bool state);
+    void set_vsync(bool state);
+    void queue_audio(Sound &sound);
+}
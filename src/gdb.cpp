@@ -0,0 +1,399 @@
+#include <cstddef>
+#include <limits.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <deque>
+#include <string>
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+#else
+    #include <unistd.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <sys/socket.h>
+#endif
+#include "types.h"
+#include "utils.h"
+#include "config.h"
+#include "device.h"
+#include "memory.h"
+#include "ula.h"
+#include "z80.h"
+#include "filemap.h"
+#include "disk.h"
+#include "floppy.h"
+#include "divmmc.h"
+#include "keyboard.h"
+#include "joystick.h"
+#include "tape.h"
+#include "recorder.h"
+#include "sound.h"
+#include "snapshot.h"
+#include "movie.h"
+#include "netplay.h"
+#include "gdb.h"
+#include "mouse.h"
+#include "rewind.h"
+#include "board.h"
+
+static const char hex[] = "0123456789abcdef";
+
+static void put_hex(std::string &out, u8 byte){
+    out += hex[byte >> 4];
+    out += hex[byte & 0x0F];
+}
+
+static int get_hex(char c){
+    return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+}
+
+static u8 get_byte(const char *src){
+    return (get_hex(src[0]) << 4) | get_hex(src[1]);
+}
+
+static u16* get_register(Z80_State &cpu, int idx){
+    u16 *regs[GDB_REGISTERS] = { &cpu.af, &cpu.bc, &cpu.de, &cpu.hl, &cpu.sp, &cpu.pc, &cpu.ix, &cpu.iy,
+                                 &cpu.alt.af, &cpu.alt.bc, &cpu.alt.de, &cpu.alt.hl, &cpu.ir };
+    return idx >= 0 && idx < GDB_REGISTERS ? regs[idx] : NULL;
+}
+
+// R bit 7 is kept apart from the counter.
+static u16 read_register(Z80_State &cpu, int idx){
+    u16 value = *get_register(cpu, idx);
+    return idx == GDB_REGISTERS - 1 ? (value & 0xFF7F) | (cpu.r8bit & 0x80) : value;
+}
+
+static void write_register(Z80_State &cpu, int idx, u16 value){
+    *get_register(cpu, idx) = value;
+    if (idx == GDB_REGISTERS - 1)
+        cpu.r8bit = value & 0x80;
+}
+
+GDB_Stub::~GDB_Stub(){
+    close();
+}
+
+// Only the local connections are taken, one at a time.
+bool GDB_Stub::open(int port){
+    close();
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa)){
+        printf("WARN: GDB socket startup.\n");
+        return false;
+    }
+#endif
+    server = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (server == -1){
+        printf("WARN: GDB socket.\n");
+        return false;
+    }
+    int reuse = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(server, (sockaddr*)&addr, sizeof(addr)) || listen(server, 1)){
+        printf("WARN: GDB port %d.\n", port);
+        close();
+        return false;
+    }
+    detached = interrupt = false;
+    thread = std::thread(&GDB_Stub::worker, this);
+    printf("GDB listens on localhost:%d.\n", port);
+    return true;
+}
+
+void GDB_Stub::close(){
+    if (server == -1)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (client != -1)
+            shutdown(client, 2);
+        shutdown(server, 2);
+#ifdef _WIN32
+        closesocket(server);
+#else
+        ::close(server);
+#endif
+    }
+    if (thread.joinable())
+        thread.join();
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    server = -1;
+    packets.clear();
+    stepping = running = false;
+    breakpoint_count = 0;
+    memset(breakpoints, 0, sizeof(breakpoints));
+}
+
+// The packets are acknowledged as they come, Ctrl-C goes out of band.
+void GDB_Stub::worker(){
+    while (true){
+        intptr_t sock = accept(server, NULL, NULL);
+        if (sock == -1)
+            break;
+        int no_delay = 1;                                   // The replies are small, they go without waiting for the ack of the previous one.
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&no_delay, sizeof(no_delay));
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            client = sock;
+            interrupt = true;
+        }
+        std::string packet;
+        bool in_packet = false;
+        int sum_chars = 0;
+        u8 sum = 0;
+        char sum_text[2];
+        char buf[1024];
+        int size;
+        while ((size = recv(sock, buf, sizeof(buf), 0)) > 0){
+            for (int i = 0; i < size; i++){
+                char c = buf[i];
+                if (sum_chars){
+                    sum_text[2 - sum_chars--] = c;
+                    if (sum_chars)
+                        continue;
+                    bool ok = get_hex(sum_text[0]) >= 0 && get_hex(sum_text[1]) >= 0 && get_byte(sum_text) == sum;
+                    send_raw(ok ? "+" : "-", 1);
+                    if (ok){
+                        std::lock_guard<std::mutex> lock(mutex);
+                        packets.push_back(packet);
+                    }
+                    ready.notify_one();
+                }else if (in_packet){
+                    if (c == '#'){
+                        in_packet = false;
+                        sum_chars = 2;
+                    }else{
+                        packet += c;
+                        sum += c;
+                    }
+                }else if (c == '$'){
+                    in_packet = true;
+                    packet.clear();
+                    sum = 0;
+                }else if (c == 0x03){
+                    std::lock_guard<std::mutex> lock(mutex);
+                    interrupt = true;
+                }
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+#ifdef _WIN32
+            closesocket(sock);
+#else
+            ::close(sock);
+#endif
+            client = -1;
+            detached = true;
+            packets.clear();
+        }
+        ready.notify_one();
+    }
+}
+
+void GDB_Stub::send_raw(const char *data, size_t size){
+    std::lock_guard<std::mutex> lock(mutex);
+    if (client != -1)
+        send(client, data, size, 0);
+}
+
+void GDB_Stub::reply(const std::string &data){
+    std::string packet = "$" + data + "#";
+    u8 sum = 0;
+    for (char c : data)
+        sum += c;
+    put_hex(packet, sum);
+    send_raw(packet.data(), packet.size());
+}
+
+// At the frame start: the packets which came while running, then the stop if asked.
+void GDB_Stub::update(Board *board){
+    std::unique_lock<std::mutex> lock(mutex);
+    if (detached){
+        detached = false;
+        stepping = running = false;
+        breakpoint_count = 0;
+        memset(breakpoints, 0, sizeof(breakpoints));
+    }
+    if (interrupt){
+        lock.unlock();
+        wait(board, GDB_SIGINT);
+        return;
+    }
+    while (!packets.empty()){
+        std::string packet = packets.front();
+        packets.pop_front();
+        lock.unlock();
+        execute(board, packet);
+        lock.lock();
+    }
+}
+
+// Before each instruction while tracing.
+void GDB_Stub::check(Board *board){
+    if (skip){
+        skip = false;
+        return;
+    }
+    if (stepping || breakpoints[board->cpu_state().pc])
+        wait(board, GDB_SIGTRAP);
+}
+
+// The emulation thread is held here until GDB resumes the machine or goes away.
+void GDB_Stub::wait(Board *board, int signal){
+    this->signal = signal;
+    stepping = false;
+    if (running){
+        running = false;
+        char stop[4];
+        snprintf(stop, sizeof(stop), "S%02x", signal);
+        reply(stop);
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    interrupt = false;
+    while (client != -1){
+        ready.wait(lock, [this]{ return !packets.empty() || client == -1; });
+        if (packets.empty())
+            break;
+        std::string packet = packets.front();
+        packets.pop_front();
+        lock.unlock();
+        bool resume = execute(board, packet);
+        lock.lock();
+        if (resume)
+            break;
+    }
+}
+
+// True if the machine resumes.
+bool GDB_Stub::execute(Board *board, const std::string &packet){
+    Z80_State &cpu = board->cpu_state();
+    const char *arg = packet.c_str() + 1;
+    std::string out;
+    switch (packet.empty() ? 0 : packet[0]){
+        case '?':
+            put_hex(out = "S", signal);
+            break;
+        case 'g':
+            for (int i = 0; i < GDB_REGISTERS; i++){
+                u16 value = read_register(cpu, i);
+                put_hex(out, value & 0xFF);
+                put_hex(out, value >> 8);
+            }
+            break;
+        case 'G':
+            if (strlen(arg) < GDB_REGISTERS * 4){
+                out = "E01";
+                break;
+            }
+            for (int i = 0; i < GDB_REGISTERS; i++)
+                write_register(cpu, i, get_byte(arg + i * 4) | get_byte(arg + i * 4 + 2) << 8);
+            out = "OK";
+            break;
+        case 'p':{
+            int idx = strtol(arg, NULL, 16);
+            if (!get_register(cpu, idx)){
+                out = "E01";
+                break;
+            }
+            u16 value = read_register(cpu, idx);
+            put_hex(out, value & 0xFF);
+            put_hex(out, value >> 8);
+            break;
+        }
+        case 'P':{
+            char *end;
+            int idx = strtol(arg, &end, 16);
+            if (!get_register(cpu, idx) || *end != '=' || strlen(end + 1) < 4){
+                out = "E01";
+                break;
+            }
+            write_register(cpu, idx, get_byte(end + 1) | get_byte(end + 3) << 8);
+            out = "OK";
+            break;
+        }
+        case 'm':{
+            char *end;
+            u32 addr = strtoul(arg, &end, 16);
+            u32 len = *end == ',' ? strtoul(end + 1, NULL, 16) : 0;
+            for (u32 i = 0; i < MIN(len, 0x10000u); i++)
+                put_hex(out, board->ula.read_byte(addr + i));
+            if (out.empty())
+                out = "E01";
+            break;
+        }
+        case 'M':{
+            // Written as the CPU does, ROM is kept.
+            char *end;
+            u32 addr = strtoul(arg, &end, 16);
+            u32 len = *end == ',' ? strtoul(end + 1, &end, 16) : 0;
+            if (*end != ':' || strlen(end + 1) < len * 2){
+                out = "E01";
+                break;
+            }
+            for (u32 i = 0; i < len; i++)
+                board->ula.write_byte(addr + i, get_byte(end + 1 + i * 2), cpu.clk);
+            out = "OK";
+            break;
+        }
+        case 'Z':
+        case 'z':{
+            // Software and hardware breakpoints are the same, a byte per address.
+            if ((arg[0] != '0' && arg[0] != '1') || arg[1] != ',')
+                break;
+            u16 addr = strtoul(arg + 2, NULL, 16);
+            bool state = packet[0] == 'Z';
+            breakpoint_count += state - breakpoints[addr];
+            breakpoints[addr] = state;
+            out = "OK";
+            break;
+        }
+        case 'c':
+        case 's':
+            if (*arg)
+                cpu.pc = strtoul(arg, NULL, 16);
+            stepping = packet[0] == 's';
+            running = skip = true;
+            return true;
+        case 'D':
+        case 'k':
+            breakpoint_count = 0;
+            memset(breakpoints, 0, sizeof(breakpoints));
+            stepping = running = false;
+            if (packet[0] == 'D')
+                reply("OK");
+            return true;
+        case 'H':
+        case 'T':
+            out = "OK";
+            break;
+        case 'q':
+            if (!strncmp(arg, "Supported", 9))
+                out = "PacketSize=1000";
+            else if (!strcmp(arg, "Attached"))
+                out = "1";
+            else if (!strcmp(arg, "C"))
+                out = "QC1";
+            else if (!strcmp(arg, "fThreadInfo"))
+                out = "m1";
+            else if (!strcmp(arg, "sThreadInfo"))
+                out = "l";
+            break;
+    }
+    reply(out);
+    return false;
+}
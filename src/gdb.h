@@ -0,0 +1,43 @@
+// GDB remote serial protocol on a localhost TCP port. The packets are read by the own thread and queued,
+// the emulation thread runs them at the frame start, or at the instruction the machine is stopped on.
+// Registers go in the GDB Z80 order: AF BC DE HL SP PC IX IY AF' BC' DE' HL' IR.
+// The machine runs instruction by instruction only while breakpoints are set or it steps.
+
+#define GDB_REGISTERS               13
+#define GDB_SIGINT                  2
+#define GDB_SIGTRAP                 5
+
+class Board;
+
+class GDB_Stub {
+    public:
+        ~GDB_Stub();
+        bool open(int port);
+        void close();
+        bool is_on() { return server != -1; };
+        bool is_tracing() { return stepping || breakpoint_count; };
+        void update(Board *board);
+        void check(Board *board);
+    private:
+        void worker();
+        void wait(Board *board, int signal);
+        bool execute(Board *board, const std::string &packet);
+        void reply(const std::string &data);
+        void send_raw(const char *data, size_t size);
+
+        intptr_t server = -1;
+        intptr_t client = -1;
+        std::thread thread;
+        std::mutex mutex;                                   // The packet queue and the client.
+        std::condition_variable ready;
+        std::deque<std::string> packets;
+        bool interrupt = false;                             // Ctrl-C or a new client, the machine stops at the frame start.
+        bool detached = false;
+        // Emulation thread
+        bool running = false;                               // GDB waits for the stop reply.
+        bool stepping = false;
+        bool skip = false;                                  // The instruction the machine resumes on runs without a check.
+        int signal = GDB_SIGTRAP;
+        int breakpoint_count = 0;
+        u8 breakpoints[0x10000] = {};
+};
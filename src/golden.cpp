@@ -0,0 +1,220 @@
+#include <cstddef>
+#include <limits.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <map>
+#include <string>
+#include "types.h"
+#include "utils.h"
+#include "config.h"
+#include "filemap.h"
+#include "batch.h"
+#include "golden.h"
+
+struct Golden_Entry {
+    u32 frames;
+    std::vector<u32> frame_hashes;
+    std::vector<u32> audio_hashes;
+};
+
+static std::string pack(const std::vector<u32> &hashes){
+    std::string text;
+    char token[32];
+    for (size_t i = 0; i < hashes.size();){
+        size_t count = 1;
+        while (i + count < hashes.size() && hashes[i + count] == hashes[i])
+            count++;
+        if (count > 1)
+            snprintf(token, sizeof(token), "%s%08x*%zu", text.empty() ? "" : " ", hashes[i], count);
+        else
+            snprintf(token, sizeof(token), "%s%08x", text.empty() ? "" : " ", hashes[i]);
+        text += token;
+        i += count;
+    }
+    return text;
+}
+
+static void unpack(const std::string &text, std::vector<u32> &hashes){
+    const char *src = text.c_str();
+    char *end;
+    while (*src){
+        u32 hash = strtoul(src, &end, 16);
+        if (end == src)
+            break;
+        u32 count = *end == '*' ? strtoul(end + 1, &end, 10) : 1;
+        hashes.insert(hashes.end(), count, hash);
+        src = end + strspn(end, " ");
+    }
+}
+
+static std::vector<std::string> read_lines(const std::string &path){
+    std::vector<std::string> lines;
+    File_Map file;
+    if (!file.open(path.c_str()))
+        return lines;
+    std::string text((const char*)file.data(), file.size());
+    for (size_t pos = 0; pos < text.size();){
+        size_t end = MIN(text.find('\n', pos), text.size());
+        std::string line = text.substr(pos, end - pos);
+        pos = end + 1;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (!line.empty() && line[0] != '#')
+            lines.push_back(line);
+    }
+    return lines;
+}
+
+// path, frames, frame hashes, audio hashes; tab separated.
+static std::map<std::string, Golden_Entry> load_hashes(const std::string &path){
+    std::map<std::string, Golden_Entry> entries;
+    for (const std::string &line : read_lines(path)){
+        size_t tabs[3];
+        tabs[0] = line.find('\t');
+        tabs[1] = tabs[0] == std::string::npos ? std::string::npos : line.find('\t', tabs[0] + 1);
+        tabs[2] = tabs[1] == std::string::npos ? std::string::npos : line.find('\t', tabs[1] + 1);
+        if (tabs[2] == std::string::npos){
+            printf("WARN: Golden hashes line %s.\n", line.substr(0, 64).c_str());
+            continue;
+        }
+        Golden_Entry &entry = entries[line.substr(0, tabs[0])];
+        entry.frames = strtoul(line.c_str() + tabs[0] + 1, NULL, 10);
+        unpack(line.substr(tabs[1] + 1, tabs[2] - tabs[1] - 1), entry.frame_hashes);
+        unpack(line.substr(tabs[2] + 1), entry.audio_hashes);
+    }
+    return entries;
+}
+
+static std::map<std::string, double> load_baseline(const std::string &path){
+    std::map<std::string, double> baseline;
+    for (const std::string &line : read_lines(path)){
+        size_t tab = line.find('\t');
+        if (tab != std::string::npos)
+            baseline[line.substr(0, tab)] = atof(line.c_str() + tab + 1);
+    }
+    return baseline;
+}
+
+static bool run(const char *dir, std::vector<Batch_Job> &jobs, std::vector<Batch_Result> &results, int threads){
+    if (!Batch::load_manifest((std::string(dir) + "/" + GOLDEN_MANIFEST).c_str(), jobs))
+        return false;
+    for (Batch_Job &job : jobs)
+        job.trace = true;
+    Batch::run_jobs(Config::get_defaults(), jobs, results, threads, NULL);
+    return true;
+}
+
+// The frame number is counted from 0 as in the scripts, the frames past the shorter run differ.
+static u32 first_divergence(const std::vector<u32> &hashes, const std::vector<u32> &golden){
+    u32 frame = 0;
+    while (frame < hashes.size() && frame < golden.size() && hashes[frame] == golden[frame])
+        frame++;
+    return frame;
+}
+
+// The titles run one at a time if the throughput is checked, they don't share the cores then.
+// A title without a baseline entry passes on its hashes, its throughput is added to the baseline.
+int Golden::check(const char *dir, int max_drop){
+    std::map<std::string, Golden_Entry> golden = load_hashes(std::string(dir) + "/" + GOLDEN_HASHES);
+    std::map<std::string, double> baseline;
+    if (max_drop > 0)
+        baseline = load_baseline(std::string(dir) + "/" + GOLDEN_BASELINE);
+    std::vector<Batch_Job> jobs;
+    std::vector<Batch_Result> results;
+    if (!run(dir, jobs, results, max_drop > 0 ? 1 : MAX(1, (int)std::thread::hardware_concurrency())))
+        return 1;
+    int failed = 0;
+    std::string taken;
+    char line[4096];
+    for (size_t i = 0; i < jobs.size(); i++){
+        const Batch_Job &job = jobs[i];
+        const Batch_Result &result = results[i];
+        auto entry = golden.find(job.path);
+        bool ok = false;
+        if (!result.error.empty())
+            printf("FAIL %s: %s.\n", job.path.c_str(), result.error.c_str());
+        else if (entry == golden.end())
+            printf("FAIL %s: no golden hashes.\n", job.path.c_str());
+        else{
+            u32 video = first_divergence(result.frame_hashes, entry->second.frame_hashes);
+            u32 audio = first_divergence(result.audio_hashes, entry->second.audio_hashes);
+            ok = video == entry->second.frames && audio == entry->second.frames && result.frames == entry->second.frames;
+            if (!ok){
+                printf("FAIL %s:", job.path.c_str());
+                if (video < entry->second.frames || result.frames != entry->second.frames)
+                    printf(" frame buffer differs from frame %u,", video);
+                if (audio < entry->second.frames || result.frames != entry->second.frames)
+                    printf(" audio differs from frame %u,", audio);
+                printf(" %u frames run of %u.\n", result.frames, entry->second.frames);
+            }
+        }
+        if (ok && max_drop > 0){
+            auto base = baseline.find(job.path);
+            if (base == baseline.end()){
+                snprintf(line, sizeof(line), "%s\t%.1f\n", job.path.c_str(), result.mhz);
+                taken += line;
+                printf("BASE %s: %.1f MHz.\n", job.path.c_str(), result.mhz);
+                continue;
+            }
+            if (result.mhz < base->second * (100 - max_drop) / 100){
+                printf("SLOW %s: %.1f MHz, baseline %.1f MHz, %.1f%% down.\n", job.path.c_str(), result.mhz, base->second,
+                       100 - result.mhz * 100 / base->second);
+                ok = false;
+            }
+        }
+        if (ok)
+            printf("OK   %s: %.1f MHz.\n", job.path.c_str(), result.mhz);
+        failed += !ok;
+    }
+    if (!taken.empty()){
+        std::string baseline_path = std::string(dir) + "/" + GOLDEN_BASELINE;
+        FILE *fp = fopen(baseline_path.c_str(), "a");
+        if (!fp || fwrite(taken.data(), 1, taken.size(), fp) != taken.size())
+            printf("WARN: Write %s.\n", baseline_path.c_str());
+        if (fp)
+            fclose(fp);
+    }
+    printf("Golden: %zu titles, %d failed.\n", jobs.size(), failed);
+    return failed ? 1 : 0;
+}
+
+// The hashes and the baseline are written anew, a title that doesn't load is left out.
+int Golden::update(const char *dir){
+    std::vector<Batch_Job> jobs;
+    std::vector<Batch_Result> results;
+    if (!run(dir, jobs, results, 1))
+        return 1;
+    std::string hashes_path = std::string(dir) + "/" + GOLDEN_HASHES;
+    std::string baseline_path = std::string(dir) + "/" + GOLDEN_BASELINE;
+    FILE *hashes = fopen(hashes_path.c_str(), "w");
+    FILE *baseline = fopen(baseline_path.c_str(), "w");
+    if (!hashes || !baseline){
+        printf("WARN: Write %s.\n", !hashes ? hashes_path.c_str() : baseline_path.c_str());
+        if (hashes)
+            fclose(hashes);
+        if (baseline)
+            fclose(baseline);
+        return 1;
+    }
+    fprintf(hashes, "# path\tframes\tframe buffer hashes\taudio hashes\n");
+    int failed = 0;
+    for (size_t i = 0; i < jobs.size(); i++){
+        if (!results[i].error.empty()){
+            printf("FAIL %s: %s.\n", jobs[i].path.c_str(), results[i].error.c_str());
+            failed++;
+            continue;
+        }
+        fprintf(hashes, "%s\t%u\t%s\t%s\n", jobs[i].path.c_str(), results[i].frames,
+                pack(results[i].frame_hashes).c_str(), pack(results[i].audio_hashes).c_str());
+        fprintf(baseline, "%s\t%.1f\n", jobs[i].path.c_str(), results[i].mhz);
+        printf("%-4s %s: %u frames, %.1f MHz.\n", results[i].status, jobs[i].path.c_str(), results[i].frames, results[i].mhz);
+    }
+    fclose(hashes);
+    fclose(baseline);
+    printf("Golden: %zu titles written, %d failed.\n", jobs.size() - failed, failed);
+    return failed ? 1 : 0;
+}
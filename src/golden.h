@@ -0,0 +1,14 @@
+// Regression check over the bundled media: the jobs of the golden manifest run traced with the default configuration,
+// the frame buffer and audio hashes of every frame are compared with the checked-in ones, the first frame that differs is reported.
+// The hashes are kept run-length packed, "hash*frames" for a repeated one. The throughput baseline is taken on the machine
+// the check runs on and it's not checked in, a title fails if its emulated MHz drop by more than the percent given.
+// The check takes the baseline of a title that has none yet.
+
+#define GOLDEN_MANIFEST             "manifest.txt"
+#define GOLDEN_HASHES               "hashes.txt"
+#define GOLDEN_BASELINE             "mhz.txt"
+
+namespace Golden {
+    int check(const char *dir, int max_drop);
+    int update(const char *dir);
+}
@@ -9,12 +9,10 @@ enum JoyButton {
 
 class Joystick : public Device {
     public:
-        Joystick();
-        ~Joystick();
         void button(char mask, bool state);
+        u8 get_state() { return port_r1F; };
+        void set_state(u8 state) { port_r1F = state; };
         void read(u16, u8 *byte, s32 clk);
-        void event(SDL_Event &event);
     private:
-        SDL_GameController *controller;        
         u8 port_r1F = 0b11000000;
 };
@@ -17,8 +17,9 @@ class Keyboard : public Device {
 
         void button(unsigned short port, char mask, bool state);
         void clear(){ memset(kbd, 0xFF, sizeof(kbd)); };
+        void get_state(u8 *state){ memcpy(state, kbd, sizeof(kbd)); };
+        void set_state(const u8 *state){ memcpy(kbd, state, sizeof(kbd)); };
         void read(u16 port, u8 *byte, s32 clk);
-        void event(SDL_Event &event);
     private:
         unsigned char kbd[8];
 };
@@ -2,7 +2,14 @@
 #include <limits.h>
 #include <stdexcept>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <deque>
+#include <string>
 #include <GL/glew.h>
 #include <SDL.h>
 #include <SDL_image.h>
@@ -13,15 +20,28 @@
 #include "memory.h"
 #include "ula.h"
 #include "z80.h"
-#include "snapshot.h"
+#include "filemap.h"
+#include "disk.h"
 #include "floppy.h"
+#include "divmmc.h"
 #include "keyboard.h"
 #include "joystick.h"
 #include "tape.h"
+#include "recorder.h"
 #include "sound.h"
+#include "snapshot.h"
+#include "movie.h"
+#include "netplay.h"
+#include "gdb.h"
 #include "mouse.h"
+#include "rewind.h"
 #include "board.h"
+#include "batch.h"
+#include "golden.h"
+#include "z80test.h"
+#include "video.h"
 #include "ui.h"
+#include "frontend.h"
 
 #define CONFIG_PATH         "zx.dat"
 #define TITLE               "ZX-Spectrum emulator v1.2"
@@ -34,6 +54,9 @@ Board *board = NULL;
 int fatal_error(const char *msg = SDL_GetError());
 
 void release_all(){
+    Frontend::free();
+    if (board)
+        Video::free();
     DELETE(board);
     SDL_GL_DeleteContext(gl_context);
     SDL_DestroyWindow(window);
@@ -48,6 +71,27 @@ int fatal_error(const char *msg){
 
 int main(int argc, char **argv){
     Cfg &cfg = Config::load(CONFIG_PATH);
+    bool netplay = argc > 4 && !strcmp(argv[1], "--netplay"); // --netplay local_port host:port player [media...]
+    bool gdb = argc > 2 && !strcmp(argv[1], "--gdb"); // --gdb port [media...]
+    if (argc > 3 && !strcmp(argv[1], "--batch")) // Headless: --batch manifest results.jsonl [threads]
+        return Batch::run(cfg, argv[2], argv[3], argc > 4 ? atoi(argv[4]) : 0);
+    if (argc > 2 && !strcmp(argv[1], "--golden")) // Headless: --golden data/golden [max MHz drop, %]
+        return Golden::check(argv[2], argc > 3 ? atoi(argv[3]) : 0);
+    if (argc > 2 && !strcmp(argv[1], "--golden-update"))
+        return Golden::update(argv[2]);
+    if (argc > 2 && !strcmp(argv[1], "--cpm")) // Headless Z80 check: --cpm zexdoc.com
+        return Z80_Test::run_cpm(argv[2]);
+    if (argc > 3 && !strcmp(argv[1], "--fuse")) // Headless Z80 check: --fuse tests.in tests.expected
+        return Z80_Test::run_fuse(argv[2], argv[3]);
+    if (argc > 2 && !strcmp(argv[1], "--replay")){ // Headless movie check: --replay [media...] movie.zxm
+        board = new Board(cfg);
+        for (int i = 2; i < argc; i++)
+            board->load_file(argv[i]);
+        bool synced = board->replay();
+        printf("Movie %s at frame %u.\n", synced ? "played" : "desync", board->movie.get_frame());
+        DELETE(board);
+        return synced ? 0 : 1;
+    }
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER) != 0)
         return fatal_error();
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, 0);
@@ -65,11 +109,18 @@ int main(int argc, char **argv){
     if (glewInit() != GLEW_OK)
         return fatal_error("GLEW initialization");
     SDL_SetWindowIcon(window, IMG_Load("data/icon.png"));
+    Video::setup();
+    Video::set_filter((Filter)cfg.video.filter);
     board = new Board(cfg);
-    for (int i = 1; i < argc; i++)
+    Frontend::setup();
+    for (int i = netplay ? 5 : gdb ? 3 : 1; i < argc; i++)
         board->load_file(argv[i]);
+    if (netplay && !board->netplay_start(atoi(argv[2]), argv[3], atoi(argv[4]) != 0))
+        return fatal_error("Netplay start");
+    if (gdb && !board->gdb.open(atoi(argv[2])))
+        return fatal_error("GDB start");
     UI::setup(cfg, window, gl_context, glsl_version);
-    board->run(cfg);
+    Frontend::run(cfg, board);
     Config::save(CONFIG_PATH);
     release_all();
     return 0;
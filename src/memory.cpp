@@ -5,31 +5,71 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <vector>
+#include <mutex>
 #include "types.h"
 #include "utils.h"
 #include "config.h"
 #include "device.h"
+#include "filemap.h"
 #include "memory.h"
 
+static std::mutex arena_lock;
+static std::vector<Page*> arena_free;
+
+static Page* page_alloc(){
+    std::lock_guard<std::mutex> lock(arena_lock);
+    if (arena_free.empty()){
+        Page *chunk = new Page[ARENA_CHUNK];
+        for (int i = ARENA_CHUNK - 1; i >= 0; i--)
+            arena_free.push_back(&chunk[i]);
+    }
+    Page *page = arena_free.back();
+    arena_free.pop_back();
+    page->refs = 1;
+    return page;
+}
+
+static void page_release(Page *page){
+    if (__atomic_sub_fetch(&page->refs, 1, __ATOMIC_ACQ_REL))
+        return;
+    std::lock_guard<std::mutex> lock(arena_lock);
+    arena_free.push_back(page);
+}
+
+static Page* page_share(Page *page){
+    __atomic_add_fetch(&page->refs, 1, __ATOMIC_RELAXED);
+    return page;
+}
+
 Memory::Memory(){
     for (unsigned int i = 0; i < sizeof(ROM_Bank); i++){
-        rom[i] = new u8[PAGE_SIZE]();
-        trap[i] = new u8[PAGE_SIZE]();
+        rom_page[i] = page_alloc();
+        trap_page[i] = page_alloc();
+        rom[i] = (u8*)memset(rom_page[i]->data, 0, PAGE_SIZE);
+        trap[i] = (u8*)memset(trap_page[i]->data, 0, PAGE_SIZE);
+    }
+    for (int i = 0; i < RAM_PAGES; i++){
+        ram_page[i] = page_alloc();
+        ram[i] = (u8*)memset(ram_page[i]->data, 0, PAGE_SIZE);
     }
-    for (int i = 0; i < RAM_PAGES; i++)
-        ram[i] = new u8[PAGE_SIZE]();
     page_wr_null = new u8[PAGE_SIZE]();
+    dirty = new u8[(RAM_PAGES + 1) * DIRTY_BLOCKS]();
+    page_dirty[0] = dirty + RAM_PAGES * DIRTY_BLOCKS;
+    page_dirty[1] = dirty + 5 * DIRTY_BLOCKS - DIRTY_BLOCKS*1;
+    page_dirty[2] = dirty + 2 * DIRTY_BLOCKS - DIRTY_BLOCKS*2;
     reset();
 }
 
 Memory::~Memory(){
     for (unsigned int i = 0; i < sizeof(ROM_Bank); i++){
-        DELETE_ARRAY(rom[i]);
-        DELETE_ARRAY(trap[i]);
+        page_release(rom_page[i]);
+        page_release(trap_page[i]);
     }
     for (int i = 0; i < RAM_PAGES; i++)
-        DELETE_ARRAY(ram[i]);
+        page_release(ram_page[i]);
     DELETE_ARRAY(page_wr_null);
+    DELETE_ARRAY(dirty);
 }
 
 void Memory::set_main_rom(ROM_Bank bank){
@@ -38,10 +78,13 @@ void Memory::set_main_rom(ROM_Bank bank){
 
 void Memory::reset(){
     port_7FFD = 0x00;
+    overlay = NULL;
     page_wr[0] = page_wr_null;
     page_rd[1] = page_wr[1] = page_ex[1] = ram[5] - PAGE_SIZE*1;                        // RAM5 0x4000 - 0x7FFF
     page_rd[2] = page_wr[2] = page_ex[2] = ram[2] - PAGE_SIZE*2;                        // RAM2 0x8000 - 0xBFFF
     page_rd[3] = page_wr[3] = page_ex[3] = ram[port_7FFD & PAGE_MASK] - PAGE_SIZE*3;    // USER 0xC000 - 0xFFFF
+    page_dirty[3] = dirty + (port_7FFD & PAGE_MASK) * DIRTY_BLOCKS - DIRTY_BLOCKS*3;
+    update_cow();
     if (main_rom != ROM_Trdos){
         page_rd[0] = rom[main_rom];
         page_ex[0] = trap[main_rom];
@@ -57,50 +100,156 @@ void Memory::write(u16 port, u8 byte, s32 clk){
     if (!(port & 0x8002)){ // 7FFD decoded if A2 and A15 is zero.
         //if (port_7FFD & PORT_LOCKED)
         //    return;
-        if (byte & BANK0_ROM48){
-            page_rd[0] = rom[ROM_48];
-            page_ex[0] = trap[ROM_48];
+        ROM_Bank bank = byte & BANK0_ROM48 ? ROM_48 : ROM_128;
+        if (overlay){
+            rom_rd = rom[bank];
+            rom_ex = trap[bank];
         }else{
-            page_rd[0] = rom[ROM_128];
-            page_ex[0] = trap[ROM_128];
+            page_rd[0] = rom[bank];
+            page_ex[0] = trap[bank];
+            page_wr[0] = page_wr_null;
         }
-        page_wr[0] = page_wr_null;
         page_rd[1] = page_wr[1] = page_ex[1] = ram[5] - PAGE_SIZE*1;                    // RAM5 0x4000 - 0x7FFF
         page_rd[2] = page_wr[2] = page_ex[2] = ram[2] - PAGE_SIZE*2;                    // RAM2 0x8000 - 0xBFFF
         page_rd[3] = page_wr[3] = page_ex[3] = ram[byte & PAGE_MASK] - PAGE_SIZE*3;     // USER 0xC000 - 0xFFFF
+        page_dirty[3] = dirty + (byte & PAGE_MASK) * DIRTY_BLOCKS - DIRTY_BLOCKS*3;
         port_7FFD = byte;
+        update_cow();
+    }
+}
+
+// The machine takes the memory of the parent, the paging stays as it is. The parent is stopped while it's forked.
+void Memory::fork(Memory &parent){
+    for (unsigned int i = 0; i < sizeof(ROM_Bank); i++){
+        replace(rom[i], parent.rom[i]);
+        replace(trap[i], parent.trap[i]);
+        page_release(rom_page[i]);
+        page_release(trap_page[i]);
+        rom_page[i] = page_share(parent.rom_page[i]);
+        trap_page[i] = page_share(parent.trap_page[i]);
+    }
+    for (int i = 0; i < RAM_PAGES; i++){
+        replace(ram[i], parent.ram[i]);
+        page_release(ram_page[i]);
+        ram_page[i] = page_share(parent.ram_page[i]);
+    }
+    shared = parent.shared = 0xFF;
+    update_cow();
+    parent.update_cow();
+}
+
+void Memory::update_cow(){
+    cow = (shared >> 5 & 0x01) << 1 | (shared >> 2 & 0x01) << 2 | (shared >> (port_7FFD & PAGE_MASK) & 0x01) << 3;
+}
+
+void Memory::unshare_slot(int slot){
+    unshare_ram(slot == 1 ? 5 : slot == 2 ? 2 : port_7FFD & PAGE_MASK);
+}
+
+void Memory::unshare_ram(int page_num){
+    unshare(ram_page[page_num]);
+    shared &= ~(1 << page_num);
+    update_cow();
+}
+
+// The last machine holding the page keeps it, the others write to a copy.
+void Memory::unshare(Page *&page){
+    if (__atomic_load_n(&page->refs, __ATOMIC_ACQUIRE) == 1)
+        return;
+    Page *copy = page_alloc();
+    memcpy(copy->data, page->data, PAGE_SIZE);
+    replace(page->data, copy->data);
+    page_release(page);
+    page = copy;
+}
+
+// Moves the pointers to a page, the slot pointers are biased by the slot address.
+void Memory::replace(u8 *from, u8 *to){
+    for (unsigned int i = 0; i < sizeof(ROM_Bank); i++){
+        if (rom[i] == from)
+            rom[i] = to;
+        if (trap[i] == from)
+            trap[i] = to;
+    }
+    for (int i = 0; i < RAM_PAGES; i++)
+        if (ram[i] == from)
+            ram[i] = to;
+    for (int i = 0; i < 4; i++){
+        if (page_rd[i] == from - PAGE_SIZE*i)
+            page_rd[i] = to - PAGE_SIZE*i;
+        if (page_wr[i] == from - PAGE_SIZE*i)
+            page_wr[i] = to - PAGE_SIZE*i;
+        if (page_ex[i] == from - PAGE_SIZE*i)
+            page_ex[i] = to - PAGE_SIZE*i;
+    }
+    if (overlay){
+        if (rom_rd == from)
+            rom_rd = to;
+        if (rom_ex == from)
+            rom_ex = to;
     }
 }
 
 bool Memory::trap_trdos(u16 pc){
     if (page_rd[0] == rom[ROM_48] && pc >> 8 == 0x3D){
-        page_rd[0] = page_ex[0] = rom[ROM_Trdos];
-        page_ex[1] = trap[ROM_Trdos] - PAGE_SIZE*1;
-        page_ex[2] = trap[ROM_Trdos] - PAGE_SIZE*2;
-        page_ex[3] = trap[ROM_Trdos] - PAGE_SIZE*3;
+        page_rom(ROM_Trdos);
         return true;
     }else
         if (page_rd[0] == rom[ROM_Trdos] && pc >= 0x4000){
-            page_rd[0] = rom[ROM_48];
-            page_ex[0] = trap[ROM_48];
-            page_ex[1] = ram[5] - PAGE_SIZE*1;
-            page_ex[2] = ram[2] - PAGE_SIZE*2;
-            page_ex[3] = ram[port_7FFD & PAGE_MASK] - PAGE_SIZE*3;
+            page_rom(ROM_48);
             return true;
         }
     return false;
 }
 
+// TR-DOS traps the execution out of its ROM, other ROMs trap the marked locations.
+void Memory::page_rom(ROM_Bank bank){
+    page_rd[0] = rom[bank];
+    page_ex[0] = bank == ROM_Trdos ? rom[bank] : trap[bank];
+    page_ex[1] = bank == ROM_Trdos ? trap[bank] - PAGE_SIZE*1 : ram[5] - PAGE_SIZE*1;
+    page_ex[2] = bank == ROM_Trdos ? trap[bank] - PAGE_SIZE*2 : ram[2] - PAGE_SIZE*2;
+    page_ex[3] = bank == ROM_Trdos ? trap[bank] - PAGE_SIZE*3 : ram[port_7FFD & PAGE_MASK] - PAGE_SIZE*3;
+}
+
+void Memory::set_trap(ROM_Bank bank, u16 ptr, bool state){
+    u8 byte = state ? TRAP_BYTE : rom[bank][ptr & (PAGE_SIZE - 1)];
+    if (trap[bank][ptr & (PAGE_SIZE - 1)] == byte)
+        return;
+    unshare(trap_page[bank]);
+    trap[bank][ptr & (PAGE_SIZE - 1)] = byte;
+}
+
+// The ROM paging goes on under the overlay and it's restored as the overlay is out.
+void Memory::map_overlay(u8 *page, bool writable){
+    if (!overlay){
+        rom_rd = page_rd[0];
+        rom_ex = page_ex[0];
+    }
+    overlay = page;
+    page_rd[0] = page_ex[0] = page;
+    page_wr[0] = writable ? page : page_wr_null;
+}
+
+void Memory::unmap_overlay(){
+    if (!overlay)
+        return;
+    overlay = NULL;
+    page_rd[0] = rom_rd;
+    page_ex[0] = rom_ex;
+    page_wr[0] = page_wr_null;
+}
+
 void Memory::load_rom(ROM_Bank bank, const char *path){
-    FILE *fp = fopen(path, "r");
-    if (!fp)
-        throw("Load ROM file");
-    fread(rom[bank], 1, PAGE_SIZE, fp);
-    fclose(fp);
+    File_Map file;
+    if (!file.open(path))
+        throw std::runtime_error("Load ROM file");
+    unshare(rom_page[bank]);
+    unshare(trap_page[bank]);
+    memcpy(rom[bank], file.data(), MIN(file.size(), (size_t)PAGE_SIZE));
     if (bank != ROM_Trdos){
         memcpy(trap[bank], rom[bank], PAGE_SIZE);
         if (bank == ROM_48)
-            memset(trap[bank] + 0x3D00, TRAP_TRDOS_BYTE, 0x100);
+            memset(trap[bank] + 0x3D00, TRAP_BYTE, 0x100);
     }else
-        memset(trap[bank], TRAP_TRDOS_BYTE, PAGE_SIZE);
+        memset(trap[bank], TRAP_BYTE, PAGE_SIZE);
 }
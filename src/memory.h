@@ -1,12 +1,22 @@
 #define PAGE_SIZE           0x4000
 #define RAM_PAGES           8
-#define TRAP_TRDOS_BYTE     0x5B
+#define TRAP_BYTE           0x5B                        // "LD E, E" opcode marks the trapped ROM locations.
+#define DIRTY_SHIFT         8                           // Writes are tracked in 256 byte blocks of RAM.
+#define DIRTY_BLOCKS        (PAGE_SIZE >> DIRTY_SHIFT)
+#define ARENA_CHUNK         64                          // Pages the arena allocates at once.
 // Port 7FFD bits
 #define PAGE_MASK           0b00000111
 #define ULA_PAGE5           0b00001000
 #define BANK0_ROM48         0b00010000
 #define PORT_LOCKED         0b00100000
 
+// A page of the arena, all machines take ROM and RAM pages from it.
+// Forked machines share the pages, the one writing a shared page takes a copy of it first.
+struct Page {
+    int refs;
+    u8 data[PAGE_SIZE];
+};
+
 class Memory : public Device {
     public:
         Memory();
@@ -19,27 +29,55 @@ class Memory : public Device {
             return page_ex[ptr >> 0x0E][ptr];
         };
         inline void write_byte(u16 ptr, u8 byte, s32 clk){
+            if (cow >> (ptr >> 0x0E) & 0x01)
+                unshare_slot(ptr >> 0x0E);
             page_wr[ptr >> 0x0E][ptr] = byte;
+            page_dirty[ptr >> 0x0E][ptr >> DIRTY_SHIFT] = 1;
         };
 
         void load_rom(ROM_Bank bank, const char *path);
         void set_main_rom(ROM_Bank bank);
         bool trap_trdos(u16 pc);
+        void set_trap(ROM_Bank bank, u16 ptr, bool state);
+        void map_overlay(u8 *page, bool writable);
+        void unmap_overlay();
         bool is_trdos_active(){ return page_ex[0] == rom[ROM_Trdos]; };
-        u8* page(int page_num) { return ram[page_num]; };
+        void fork(Memory &parent);
+        u8* page(int page_num) { if (shared >> page_num & 0x01) unshare_ram(page_num); return ram[page_num]; };
+        const u8* read_page(int page_num) { return ram[page_num]; };
+        const u8* read_rom(ROM_Bank bank) { return rom[bank]; };
         u8 read_7FFD(){ return port_7FFD; };
+        u8* dirty_blocks(int page_num) { return dirty + page_num * DIRTY_BLOCKS; };
+        void clear_dirty() { memset(dirty, 0, RAM_PAGES * DIRTY_BLOCKS); };
 
         void write(u16 port, u8 byte, s32 clk);
         void reset();
 
     protected:
+        void page_rom(ROM_Bank bank);
+        void unshare_slot(int slot);
+        void unshare_ram(int page_num);
+        void unshare(Page *&page);
+        void replace(u8 *from, u8 *to);
+        void update_cow();
+
         ROM_Bank main_rom = ROM_Trdos;
         u8 *page_wr_null;
         u8 *rom[sizeof(ROM_Bank)];
         u8 *trap[sizeof(ROM_Bank)];
         u8 *ram[RAM_PAGES];
+        Page *rom_page[sizeof(ROM_Bank)];
+        Page *trap_page[sizeof(ROM_Bank)];
+        Page *ram_page[RAM_PAGES];
+        u8 shared = 0x00;                               // RAM pages which may be shared with the other machines.
+        u8 cow = 0x00;                                  // Slots of the shared pages, copied on the write.
         u8 *page_rd[4];
         u8 *page_wr[4];
         u8 *page_ex[4];
+        u8 *dirty;                                      // Block flags of RAM pages, ROM writes go to the extra page.
+        u8 *page_dirty[4];
         u8 port_7FFD;
+        u8 *overlay = NULL;                             // External memory paged in at 0x0000-0x3FFF.
+        u8 *rom_rd;                                     // ROM under the overlay.
+        u8 *rom_ex;
 };
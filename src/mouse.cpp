@@ -6,7 +6,6 @@
 #include "types.h"
 #include "utils.h"
 #include "device.h"
-#include <SDL.h>
 #include "mouse.h"
 
 void Mouse::motion(char x, char y){
@@ -26,6 +25,18 @@ void Mouse::wheel(char pos){
     wheel_button |= (pos & 0xF) << 4;
 }
 
+void Mouse::get_state(u8 *state){
+    state[0] = x_coord;
+    state[1] = y_coord;
+    state[2] = wheel_button;
+}
+
+void Mouse::set_state(const u8 *state){
+    x_coord = state[0];
+    y_coord = state[1];
+    wheel_button = state[2];
+}
+
 void  Mouse::read(u16 port, u8 *byte, s32 clk){
     if (!(port & 0b100000)){ // A0, A5, A7, A8, A1
         if ((port & 0b10111111111) == 0b00011011111) // 0xFADF
@@ -36,21 +47,3 @@ void  Mouse::read(u16 port, u8 *byte, s32 clk){
             *byte &= y_coord;
     }
 }
-
-void Mouse::event(SDL_Event &event){
-    switch (event.type){
-        case SDL_MOUSEMOTION:
-            motion(event.motion.xrel, event.motion.yrel);
-            break;
-        case SDL_MOUSEBUTTONDOWN:
-            button((event.button.button & SDL_BUTTON_LEFT ? 0x01 : 0x00) | (event.button.button & SDL_BUTTON_RIGHT ? 0x02 : 0x00), true);
-            break;
-        case SDL_MOUSEBUTTONUP:
-            button((event.button.button & SDL_BUTTON_LEFT ? 0x01 : 0x00) | (event.button.button & SDL_BUTTON_RIGHT ? 0x02 : 0x00), false);
-            break;
-        case SDL_MOUSEWHEEL:
-            wheel(event.wheel.y);
-            break;
-    }
-}
-
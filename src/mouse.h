@@ -4,8 +4,9 @@ class Mouse : public Device {
         void motion(char x, char y);
         void button(char button, bool status);
         void wheel(char pos);
+        void get_state(u8 *state);
+        void set_state(const u8 *state);
         void read(u16 port, u8 *byte, s32 clk);
-        void event(SDL_Event &event);
     private:
         char wheel_button = 0;
         char x_coord = 0;
@@ -0,0 +1,122 @@
+#include <cstddef>
+#include <limits.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "types.h"
+#include "utils.h"
+#include "config.h"
+#include "device.h"
+#include "memory.h"
+#include "ula.h"
+#include "z80.h"
+#include "filemap.h"
+#include "disk.h"
+#include "floppy.h"
+#include "tape.h"
+#include "recorder.h"
+#include "sound.h"
+#include "snapshot.h"
+#include "movie.h"
+
+// The snapshot is written to the path already, the chunk is appended to it as the recording stops.
+void Movie::record(const char *path){
+    stop();
+    strncpy(this->path, path, sizeof(this->path) - 1);
+    this->path[sizeof(this->path) - 1] = 0x00;
+    changes.clear();
+    hashes.clear();
+    frame = 0;
+    desync = false;
+    mode = Record;
+}
+
+bool Movie::play(const char *path){
+    stop();
+    File_Map file;
+    if (!file.open(path)){
+        printf("WARN: Open movie file.\n");
+        return false;
+    }
+    const u8 *data = file.data();
+    size_t size = file.size();
+    size_t idx = sizeof(SZX_Header);
+    while (idx + sizeof(SZX_Block) <= size){
+        const SZX_Block *block = (const SZX_Block*)(data + idx);
+        const u8 *body = data + idx + sizeof(SZX_Block);
+        idx += sizeof(SZX_Block);
+        if (block->size > size - idx)
+            break;
+        idx += block->size;
+        if (memcmp(block->id, "MOVI", 4) || block->size < sizeof(Movie_Header))
+            continue;
+        const Movie_Header *header = (const Movie_Header*)body;
+        if (header->version != MOVIE_VERSION || block->size != sizeof(Movie_Header) + (u64)header->changes * sizeof(Movie_Change) + (u64)header->frames * sizeof(u32)){
+            printf("WARN: Movie version %d or size is wrong.\n", header->version);
+            return false;
+        }
+        const Movie_Change *change = (const Movie_Change*)(body + sizeof(Movie_Header));
+        const u32 *hash = (const u32*)(change + header->changes);
+        changes.assign(change, change + header->changes);
+        hashes.assign(hash, hash + header->frames);
+        change_idx = 0;
+        frame = 0;
+        desync = false;
+        mode = hashes.empty() ? Off : Play;
+        return true;
+    }
+    printf("WARN: No movie chunk in the file.\n");
+    return false;
+}
+
+void Movie::stop(){
+    if (mode == Record){
+        Movie_Header header { .version = MOVIE_VERSION, .frames = (u32)hashes.size(), .changes = (u32)changes.size() };
+        SZX_Block block;
+        memcpy(block.id, "MOVI", sizeof(block.id));
+        block.size = sizeof(Movie_Header) + changes.size() * sizeof(Movie_Change) + hashes.size() * sizeof(u32);
+        FILE *fp = fopen(path, "ab");
+        if (!fp || fwrite(&block, sizeof(SZX_Block), 1, fp) != 1 || fwrite(&header, sizeof(Movie_Header), 1, fp) != 1
+            || fwrite(changes.data(), sizeof(Movie_Change), changes.size(), fp) != changes.size()
+            || fwrite(hashes.data(), sizeof(u32), hashes.size(), fp) != hashes.size())
+            printf("WARN: Write movie file.\n");
+        if (fp)
+            fclose(fp);
+    }
+    mode = Off;
+}
+
+// Recording keeps the input which differs from the previous frame, the playback replaces it.
+void Movie::input(Movie_Input &input){
+    if (mode == Record){
+        if (changes.empty() || memcmp(&input, &last, sizeof(Movie_Input)))
+            changes.push_back({ frame, input });
+        last = input;
+    }else if (mode == Play){
+        while (change_idx < changes.size() && changes[change_idx].frame <= frame)
+            last = changes[change_idx++].input;
+        input = last;
+    }
+}
+
+void Movie::check(u32 hash){
+    if (mode == Record){
+        hashes.push_back(hash);
+        frame++;
+    }else if (mode == Play){
+        if (hash != hashes[frame]){
+            printf("WARN: Movie desync at frame %u.\n", frame);
+            desync = true;
+            mode = Off;
+            return;
+        }
+        if (++frame >= hashes.size()){
+            printf("Movie is over, %u frames.\n", frame);
+            mode = Off;
+        }
+    }
+}
@@ -0,0 +1,45 @@
+// Input movie: a SZX snapshot of the start and the "MOVI" chunk after it, the input changes and a state hash per frame.
+// The input is applied at the frame start as the events are, the hash is taken at the frame end.
+// A hash that differs from the recorded one stops the playback at the frame.
+
+#define MOVIE_VERSION               1
+
+#pragma pack(1)
+struct Movie_Input {
+    u8 keyboard[8];                                         // Half-row bits, 0 - pressed.
+    u8 joystick;                                            // Kempston port.
+    u8 mouse[3];                                            // X, Y, wheel and buttons.
+};
+struct Movie_Header {                                       // The changes and the hashes follow.
+    u16 version;
+    u32 frames;
+    u32 changes;
+};
+struct Movie_Change {
+    u32 frame;
+    Movie_Input input;
+};
+#pragma pack()
+
+class Movie {
+    enum Mode { Off, Record, Play };
+    public:
+        void record(const char *path);
+        bool play(const char *path);
+        void stop();
+        bool is_on() { return mode != Off; };
+        bool is_playing() { return mode == Play; };
+        bool is_desync() { return desync; };
+        u32 get_frame() { return frame; };
+        void input(Movie_Input &input);
+        void check(u32 hash);
+    private:
+        Mode mode = Off;
+        char path[4096];
+        u32 frame;
+        bool desync = false;
+        Movie_Input last;
+        std::vector<Movie_Change> changes;
+        size_t change_idx;
+        std::vector<u32> hashes;
+};
@@ -0,0 +1,166 @@
+#include <cstddef>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#ifdef _WIN32
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <netdb.h>
+    #include <netinet/in.h>
+    #include <sys/socket.h>
+#endif
+#include "types.h"
+#include "utils.h"
+#include "movie.h"
+#include "netplay.h"
+
+Netplay::~Netplay(){
+    close();
+}
+
+// The peer is "host:port", the machines take the same player numbers on both sides, 0 and 1.
+bool Netplay::open(int port, const char *peer, int player, u32 start){
+    close();
+    char host[256];
+    const char *colon = strrchr(peer, ':');
+    if (!colon || colon == peer || (size_t)(colon - peer) >= sizeof(host)){
+        printf("WARN: Netplay peer is not host:port.\n");
+        return false;
+    }
+    memcpy(host, peer, colon - peer);
+    host[colon - peer] = 0x00;
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa)){
+        printf("WARN: Netplay socket startup.\n");
+        return false;
+    }
+#endif
+    addrinfo hints = {}, *info = NULL;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host, colon + 1, &hints, &info) || !info){
+        printf("WARN: Netplay peer %s is not found.\n", peer);
+        return false;
+    }
+    peer_addr = ((sockaddr_in*)info->ai_addr)->sin_addr.s_addr;
+    peer_port = ((sockaddr_in*)info->ai_addr)->sin_port;
+    freeaddrinfo(info);
+    sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == -1){
+        printf("WARN: Netplay socket.\n");
+        return false;
+    }
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(port);
+#ifdef _WIN32
+    u_long non_block = 1;
+    bool ok = !bind(sock, (sockaddr*)&local, sizeof(local)) && !ioctlsocket(sock, FIONBIO, &non_block);
+#else
+    bool ok = !bind(sock, (sockaddr*)&local, sizeof(local)) && fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK) != -1;
+#endif
+    if (!ok){
+        printf("WARN: Netplay port %d.\n", port);
+        close();
+        return false;
+    }
+    this->player = player;
+    this->start = start;
+    sent = acked = received = 0;
+    return true;
+}
+
+void Netplay::close(){
+    if (sock == -1)
+        return;
+#ifdef _WIN32
+    closesocket(sock);
+    WSACleanup();
+#else
+    ::close(sock);
+#endif
+    sock = -1;
+}
+
+void Netplay::send(u32 frame, const Movie_Input &input){
+    if (frame == sent){
+        local[sent % NETPLAY_FRAMES] = input;
+        sent++;
+    }
+    flush();
+}
+
+// All the input the peer has not acknowledged goes in every packet, a lost one is covered by the next.
+void Netplay::flush(){
+    Netplay_Packet packet;
+    packet.magic = NETPLAY_MAGIC;
+    packet.start = start;
+    packet.ack = received;
+    packet.frame = MAX(acked, sent > NETPLAY_REDUNDANCY ? sent - NETPLAY_REDUNDANCY : 0);
+    packet.count = sent - packet.frame;
+    for (int i = 0; i < packet.count; i++)
+        packet.input[i] = local[(packet.frame + i) % NETPLAY_FRAMES];
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = peer_addr;
+    addr.sin_port = peer_port;
+    sendto(sock, (const char*)&packet, offsetof(Netplay_Packet, input) + packet.count * sizeof(Movie_Input), 0, (sockaddr*)&addr, sizeof(addr));
+}
+
+// The input is taken in frame order only, the redundant one fills a gap later.
+// Returns the first frame before the given one that ran with a wrong prediction, the given one if there is none.
+u32 Netplay::receive(u32 frame){
+    u32 wrong = frame;
+    Netplay_Packet packet;
+    while (sock != -1){
+        int size = recv(sock, (char*)&packet, sizeof(packet), 0);
+        if (size < (int)offsetof(Netplay_Packet, input))
+            break;
+        if (packet.magic != NETPLAY_MAGIC || packet.count > NETPLAY_REDUNDANCY || size != (int)(offsetof(Netplay_Packet, input) + packet.count * sizeof(Movie_Input)))
+            continue;
+        if (packet.start != start){
+            printf("WARN: Netplay peer starts from another state.\n");
+            close();
+            break;
+        }
+        acked = MIN(MAX(acked, packet.ack), sent);
+        for (u32 i = 0; i < packet.count; i++){
+            u32 f = packet.frame + i;
+            if (f != received)
+                continue;
+            remote[f % NETPLAY_FRAMES] = packet.input[i];
+            if (f < frame && guessed[f % NETPLAY_FRAMES] && memcmp(&predicted[f % NETPLAY_FRAMES], &packet.input[i], sizeof(Movie_Input)))
+                wrong = MIN(wrong, f);
+            received++;
+        }
+    }
+    return wrong;
+}
+
+// The remote input not received yet is predicted as the last one. The keys pressed on both sides are merged,
+// Kempston bits too, the mouse is the player 0 one.
+void Netplay::input(u32 frame, Movie_Input &input){
+    Movie_Input &mine = local[frame % NETPLAY_FRAMES];
+    Movie_Input other;
+    if (frame < received)
+        other = remote[frame % NETPLAY_FRAMES];
+    else if (received)
+        other = remote[(received - 1) % NETPLAY_FRAMES];
+    else{
+        memset(other.keyboard, 0xFF, sizeof(other.keyboard));
+        other.joystick = 0x00;
+        memcpy(other.mouse, mine.mouse, sizeof(other.mouse));
+    }
+    guessed[frame % NETPLAY_FRAMES] = frame >= received;
+    predicted[frame % NETPLAY_FRAMES] = other;
+    for (int i = 0; i < 8; i++)
+        input.keyboard[i] = mine.keyboard[i] & other.keyboard[i];
+    input.joystick = mine.joystick | other.joystick;
+    memcpy(input.mouse, player ? other.mouse : mine.mouse, sizeof(input.mouse));
+}
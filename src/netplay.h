@@ -0,0 +1,46 @@
+// Rollback netplay: two machines run the same frames, each one sends its input over UDP and predicts the other's as the last received.
+// A frame predicted wrong is found as the real input comes, the machine goes back to the state saved before it
+// and runs the frames again up to the current one, not displayed and silent.
+
+#define NETPLAY_ROLLBACK_MAX        8                       // Frames run ahead of the remote input, the machine waits beyond.
+#define NETPLAY_FRAMES              64                      // Input ring.
+#define NETPLAY_REDUNDANCY          32                      // Inputs not acknowledged are sent again, up to the count.
+#define NETPLAY_MAGIC               0x504E585A              // "ZXNP"
+
+#pragma pack(1)
+struct Netplay_Packet {
+    u32 magic;
+    u32 start;                                              // State hash at frame 0, the machines have to start the same.
+    u32 ack;                                                // Remote frames received in a row.
+    u32 frame;                                              // The first input frame.
+    u8 count;
+    Movie_Input input[NETPLAY_REDUNDANCY];
+};
+#pragma pack()
+
+class Netplay {
+    public:
+        ~Netplay();
+        bool open(int port, const char *peer, int player, u32 start);
+        void close();
+        bool is_on() { return sock != -1; };
+        bool can_run(u32 frame) { return frame < received + NETPLAY_ROLLBACK_MAX; };
+        u32 get_received() { return received; };
+        void send(u32 frame, const Movie_Input &input);
+        void flush();
+        u32 receive(u32 frame);
+        void input(u32 frame, Movie_Input &input);
+    private:
+        intptr_t sock = -1;
+        u32 peer_addr;                                      // IPv4, network order.
+        u16 peer_port;
+        int player;
+        u32 start;
+        Movie_Input local[NETPLAY_FRAMES];
+        Movie_Input remote[NETPLAY_FRAMES];
+        Movie_Input predicted[NETPLAY_FRAMES];              // Remote input the frame ran with.
+        bool guessed[NETPLAY_FRAMES];
+        u32 sent = 0;                                       // Local frames.
+        u32 acked = 0;                                      // Local frames the peer has.
+        u32 received = 0;                                   // Remote frames.
+};
@@ -0,0 +1,103 @@
+#include <cstddef>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "types.h"
+#include "utils.h"
+#include "recorder.h"
+
+Recorder::Recorder(){
+    ring = new u8[RECORDER_RING_SIZE];
+    head = tail = 0;
+}
+
+Recorder::~Recorder(){
+    close();
+    DELETE_ARRAY(ring);
+}
+
+void Recorder::open(const char *path, Format fmt, int rate){
+    close();
+    if (!(fp = fopen(path, "wb")))
+        throw std::runtime_error("Open record file");
+    format = fmt;
+    sample_rate = rate;
+    data_size = dropped = 0;
+    head = tail = 0;
+    stop = false;
+    write_header();
+    thread = std::thread(&Recorder::worker, this);
+}
+
+void Recorder::close(){
+    if (!fp)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    ready.notify_one();
+    thread.join();
+    write_header(); // Update sizes.
+    fclose(fp);
+    fp = NULL;
+    if (dropped)
+        printf("WARN: Recorder dropped %u bytes.\n", dropped);
+}
+
+// Called from the emulation thread, never blocks on disk I/O. The data is dropped if the writer is behind.
+void Recorder::push(const void *data, u32 size){
+    if (!fp)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (RECORDER_RING_SIZE - (head - tail) < size){
+            dropped += size;
+            return;
+        }
+        u32 offset = head % RECORDER_RING_SIZE;
+        u32 part = MIN(size, RECORDER_RING_SIZE - offset);
+        memcpy(ring + offset, data, part);
+        memcpy(ring, (const u8*)data + part, size - part);
+        head += size;
+    }
+    ready.notify_one();
+}
+
+void Recorder::worker(){
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true){
+        ready.wait(lock, [this]{ return stop || head != tail; });
+        if (head == tail && stop)
+            break;
+        u32 offset = tail % RECORDER_RING_SIZE;
+        u32 size = MIN(head - tail, RECORDER_RING_SIZE - offset);
+        lock.unlock();
+        if (fwrite(ring + offset, 1, size, fp) != size)
+            printf("WARN: Write record file.\n");
+        data_size += size;
+        lock.lock();
+        tail += size;
+    }
+}
+
+void Recorder::write_header(){
+    fseek(fp, 0, SEEK_SET);
+    if (format == WAV){
+        WAV_Header header = {
+            { 'R', 'I', 'F', 'F' }, (u32)(sizeof(WAV_Header) - 8 + data_size),
+            { 'W', 'A', 'V', 'E' },
+            { 'f', 'm', 't', ' ' }, 16,
+            1, 2, (u32)sample_rate, (u32)sample_rate * 4, 4, 16,
+            { 'd', 'a', 't', 'a' }, data_size
+        };
+        fwrite(&header, sizeof(header), 1, fp);
+    }else{
+        PSG_Header header = { { 'P', 'S', 'G', 0x1A }, 0x10, 0, { 0 } };
+        fwrite(&header, sizeof(header), 1, fp);
+    }
+    fseek(fp, 0, SEEK_END);
+}
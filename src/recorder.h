@@ -0,0 +1,58 @@
+// Audio capture to WAV (mixed output) and PSG (AY register stream).
+// Data is copied into a bounded ring and written to disk by a background thread,
+// so the emulation loop never waits for the file system.
+
+#define RECORDER_RING_SIZE          0x100000                // 1Mb, ~6 seconds of 44100Hz stereo.
+#define PSG_END_OF_FRAME            0xFF
+
+#pragma pack(1)
+struct WAV_Header {
+    char riff[4];
+    u32 riff_size;
+    char wave[4];
+    char fmt[4];
+    u32 fmt_size;
+    u16 format;
+    u16 channels;
+    u32 sample_rate;
+    u32 byte_rate;
+    u16 block_align;
+    u16 bits_per_sample;
+    char data[4];
+    u32 data_size;
+};
+struct PSG_Header {
+    char signature[4];                                      // "PSG\x1A"
+    u8 version;
+    u8 frequency;                                           // Player frequency, 50Hz if zero.
+    u8 reserved[10];
+};
+#pragma pack()
+
+class Recorder {
+    public:
+        enum Format { WAV, PSG };
+        Recorder();
+        ~Recorder();
+        void open(const char *path, Format format, int sample_rate = 0);
+        void close();
+        bool is_open() { return fp != NULL; };
+        void push(const void *data, u32 size);
+        void push(u8 byte) { push(&byte, 1); };
+    private:
+        void worker();
+        void write_header();
+
+        FILE *fp = NULL;
+        Format format;
+        s32 sample_rate;
+        u32 data_size;
+        u32 dropped;
+        u8 *ring;
+        u32 head;                                           // Written by the emulation thread.
+        u32 tail;                                           // Written by the worker thread.
+        bool stop;
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable ready;
+};
@@ -0,0 +1,144 @@
+#include <cstddef>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+#include "types.h"
+#include "utils.h"
+#include "config.h"
+#include "device.h"
+#include "memory.h"
+#include "ula.h"
+#include "rewind.h"
+
+Rewind::~Rewind(){
+    DELETE_ARRAY(ring);
+    DELETE_ARRAY(base);
+}
+
+void Rewind::setup(size_t bytes){
+    DELETE_ARRAY(ring);
+    DELETE_ARRAY(base);
+    entries.clear();
+    size = bytes;
+    if (!size)
+        return;
+    ring = new u8[size];
+    base = new u8[RAM_PAGES * PAGE_SIZE];
+}
+
+void Rewind::clear(){
+    entries.clear();
+}
+
+// The record goes after the newest one, or to the ring start if it doesn't fit up to the end. Frames in its way are dropped.
+u8* Rewind::alloc(u32 len){
+    if (len > size){
+        entries.clear();
+        return NULL;
+    }
+    size_t offset = entries.empty() ? 0 : entries.back().offset + entries.back().size;
+    if (offset + len > size){
+        while (!entries.empty() && entries.front().offset >= offset)
+            entries.pop_front();
+        offset = 0;
+    }
+    while (!entries.empty() && entries.front().offset < offset + len && entries.front().offset + entries.front().size > offset)
+        entries.pop_front();
+    entries.push_back({ offset, len });
+    return ring + offset;
+}
+
+// Record: state size, state, then the blocks as index, packed size and pairs of zero count and XOR-ed bytes count.
+void Rewind::push(ULA *ula, const u8 *state, u32 state_size){
+    record.resize(sizeof(u32) + state_size);
+    memcpy(record.data(), &state_size, sizeof(u32));
+    memcpy(record.data() + sizeof(u32), state, state_size);
+    if (entries.empty()){ // No frame to go back to, the RAM is taken as it is.
+        for (int page = 0; page < RAM_PAGES; page++)
+            memcpy(base + page * PAGE_SIZE, ula->read_page(page), PAGE_SIZE);
+    }else{
+        for (int page = 0; page < RAM_PAGES; page++){
+            u8 *dirty = ula->dirty_blocks(page);
+            for (int block = 0; block < DIRTY_BLOCKS; block++){
+                if (!dirty[block])
+                    continue;
+                u8 *old = base + page * PAGE_SIZE + (block << DIRTY_SHIFT);
+                const u8 *now = ula->read_page(page) + (block << DIRTY_SHIFT);
+                size_t header = record.size();
+                u16 id = page * DIRTY_BLOCKS + block;
+                record.resize(header + sizeof(u16) * 2);
+                memcpy(&record[header], &id, sizeof(u16));
+                int i = 0;
+                while (i < (1 << DIRTY_SHIFT)){
+                    int zero = 0, diff = 0;
+                    while (i < (1 << DIRTY_SHIFT) && zero < 0xFF && now[i] == old[i]){
+                        zero++;
+                        i++;
+                    }
+                    int start = i;
+                    while (i < (1 << DIRTY_SHIFT) && diff < 0xFF && now[i] != old[i]){
+                        diff++;
+                        i++;
+                    }
+                    if (!diff && i == (1 << DIRTY_SHIFT))
+                        break;
+                    record.push_back(zero);
+                    record.push_back(diff);
+                    for (int j = start; j < start + diff; j++)
+                        record.push_back(now[j] ^ old[j]);
+                }
+                u16 len = record.size() - header - sizeof(u16) * 2;
+                if (!len){ // Written with the same bytes.
+                    record.resize(header);
+                    continue;
+                }
+                memcpy(&record[header + sizeof(u16)], &len, sizeof(u16));
+                memcpy(old, now, 1 << DIRTY_SHIFT);
+            }
+        }
+    }
+    u16 end = REWIND_END;
+    record.insert(record.end(), (u8*)&end, (u8*)&end + sizeof(u16));
+    ula->clear_dirty();
+    u8 *dst = alloc(record.size());
+    if (dst)
+        memcpy(dst, record.data(), record.size());
+}
+
+// The newest frame is dropped and its XOR takes the RAM to the one before. The oldest frame stays.
+bool Rewind::pop(ULA *ula, std::vector<u8> &state){
+    if (entries.empty())
+        return false;
+    u32 state_size;
+    if (entries.size() > 1){
+        const u8 *src = ring + entries.back().offset;
+        memcpy(&state_size, src, sizeof(u32));
+        src += sizeof(u32) + state_size;
+        while (true){
+            u16 id, len;
+            memcpy(&id, src, sizeof(u16));
+            if (id == REWIND_END)
+                break;
+            memcpy(&len, src + sizeof(u16), sizeof(u16));
+            src += sizeof(u16) * 2;
+            u8 *dst = base + id * (1 << DIRTY_SHIFT);
+            const u8 *end = src + len;
+            while (src < end){
+                dst += src[0];
+                for (int i = 0; i < src[1]; i++)
+                    *dst++ ^= src[2 + i];
+                src += 2 + src[1];
+            }
+        }
+        entries.pop_back();
+    }
+    for (int page = 0; page < RAM_PAGES; page++)
+        memcpy(ula->page(page), base + page * PAGE_SIZE, PAGE_SIZE);
+    ula->clear_dirty();
+    const u8 *src = ring + entries.back().offset;
+    memcpy(&state_size, src, sizeof(u32));
+    state.assign(src + sizeof(u32), src + sizeof(u32) + state_size);
+    return true;
+}
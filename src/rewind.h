@@ -0,0 +1,30 @@
+// Rewind buffer: a ring of frames, the oldest ones are dropped as it's full.
+// A frame keeps the device state and the RAM blocks written since the previous one, XOR-ed with them and RLE packed.
+// The newest RAM is kept in full, the XOR of a frame takes it one frame back.
+
+#define REWIND_SIZE_MAX             256                     // MB.
+#define REWIND_STEP                 2                       // Frames back per displayed one, while the rewind is held.
+#define REWIND_END                  0xFFFF                  // Block list end.
+
+class Rewind {
+    struct Entry {
+        size_t offset;
+        u32 size;
+    };
+    public:
+        ~Rewind();
+        void setup(size_t size);
+        void clear();
+        bool is_on() { return size; };
+        size_t frames() { return entries.size(); };
+        void push(ULA *ula, const u8 *state, u32 state_size);
+        bool pop(ULA *ula, std::vector<u8> &state);
+    private:
+        u8* alloc(u32 len);
+
+        u8 *ring = NULL;
+        size_t size = 0;
+        std::deque<Entry> entries;
+        u8 *base = NULL;                                    // RAM of the newest frame.
+        std::vector<u8> record;
+};
@@ -3,6 +3,10 @@
 #include <stdexcept>
 #include <stdio.h>
 #include <string.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "types.h"
 #include "utils.h"
 #include "config.h"
@@ -10,38 +14,78 @@
 #include "memory.h"
 #include "ula.h"
 #include "z80.h"
+#include "filemap.h"
+#include "disk.h"
+#include "floppy.h"
+#include "tape.h"
+#include "recorder.h"
+#include "sound.h"
 #include "snapshot.h"
 
 namespace Snapshot {
-    unsigned int rle_decode(unsigned char **pages, int *offset, unsigned char *src, unsigned int src_size){
-        unsigned int idx = 0;
-        while (idx < src_size){
-            if (idx + 4 < src_size && src[idx] == 0xED && src[idx+1] == 0xED){
-                for (int cnt = 0; cnt < src[idx+2]; cnt++){
-                    (*pages)[(*offset)++] = src[idx+3];
-                    if (*offset >= PAGE_SIZE){
-                        *offset = 0;
+    // Pages are a NULL terminated list, the stream runs on to the next one as a page is full. Returns the bytes taken.
+    // Literal bytes up to the next ED are copied at once, memchr scans for it with the library vector code.
+    size_t rle_decode(u8 **pages, const u8 *src, size_t size){
+        size_t idx = 0;
+        u32 offset = 0;
+        while (idx < size && *pages){
+            if (src[idx] == 0xED && idx + 3 < size && src[idx + 1] == 0xED){
+                u32 count = src[idx + 2];
+                while (count && *pages){
+                    u32 len = MIN(count, PAGE_SIZE - offset);
+                    memset(*pages + offset, src[idx + 3], len);
+                    count -= len;
+                    offset += len;
+                    if (offset == PAGE_SIZE){
+                        offset = 0;
                         pages++;
-                        if (!*pages)
-                            return idx;
                     }
                 }
                 idx += 4;
-            }else{
-                (*pages)[(*offset)++] = src[idx++];
-                if (*offset >= PAGE_SIZE){
-                    *offset = 0;
-                    pages++;
-                    if (!*pages)
-                        return idx;
-                }
+                continue;
+            }
+            const u8 *marker = (const u8*)memchr(src + idx + 1, 0xED, size - idx - 1);
+            u32 len = MIN((size_t)((marker ? marker - src : size) - idx), (size_t)(PAGE_SIZE - offset));
+            memcpy(*pages + offset, src + idx, len);
+            idx += len;
+            offset += len;
+            if (offset == PAGE_SIZE){
+                offset = 0;
+                pages++;
             }
         }
         return idx;
     }
 
-    void save_z80(const char *path, Z80_State &cpu, ULA *ula, IO *io){
+    // ED ED count byte for 5 and more equal bytes, or for 2 EDs. The byte after a single ED is never a run.
+    size_t rle_encode(u8 *dst, const u8 *src, size_t size){
+        size_t out = 0;
+        size_t idx = 0;
+        while (idx < size){
+            u8 byte = src[idx];
+            size_t run = 1;
+            while (idx + run < size && run < 0xFF && src[idx + run] == byte)
+                run++;
+            if (run >= 5 || (byte == 0xED && run >= 2)){
+                dst[out++] = 0xED;
+                dst[out++] = 0xED;
+                dst[out++] = run;
+                dst[out++] = byte;
+                idx += run;
+                continue;
+            }
+            dst[out++] = src[idx++];
+            if (byte == 0xED && idx < size)
+                dst[out++] = src[idx++];
+        }
+        return out;
+    }
+
+    // Version 3, the pages the model has are written RLE compressed, or raw if it doesn't pay.
+    void save_z80(const char *path, Hardware hw, Z80_State &cpu, ULA *ula, Sound *sound){
         FILE *fp = fopen(path, "wb");
+        if (!fp)
+            throw std::runtime_error("Create z80 snapshot");
         struct Z80_Header header {
             .a = cpu.a, .f = cpu.f,
             .bc = cpu.bc, .hl = cpu.hl, .pc = 0, .sp = cpu.sp,
@@ -59,51 +103,56 @@ namespace Snapshot {
             .pfffd = 0x0F
         };
         header.flags = ((cpu.r8bit >> 7) & 0x01);
-        header.mode = 4;
+        header.mode = hw == HW_Sinclair_48 ? 0 : hw == HW_Pentagon_128 ? 9 : 4;
         header.p7ffd = ula->read_7FFD();
         header.clk_lo = cpu.clk & 0xFFFF;
         header.clk_hi = cpu.clk >> 16;
-        struct Z80_Data data { .length = 0xFFFF };
-        for (int i = 0; i < 0x10; i++){
-            io->write(0xFFFD, i);
-            io->read(0xBFFD, &header.ay_regs[i]);
-        }
+        AY_State ay;
+        sound->get_state(ay);
+        memcpy(header.ay_regs, ay.registers, sizeof(header.ay_regs));
         header.flags |= (((ula->get_border_color() & 0x07) << 1) & 0x0E);
         if (fwrite(&header, sizeof(Z80_Header), 1, fp) != 1)
             throw std::runtime_error("Write z80 snapshot header");
-        for (unsigned char page = 0; page <= 7 ; page++){
-            data.page = page + 3;
+        static const struct { u8 page; u8 ram; } pages_48[] = { { 4, 2 }, { 5, 0 }, { 8, 5 } };
+        u8 *packed = new u8[PAGE_SIZE * 2];
+        for (int i = 0; i < (hw == HW_Sinclair_48 ? 3 : RAM_PAGES); i++){
+            const u8 *page = ula->read_page(hw == HW_Sinclair_48 ? pages_48[i].ram : i);
+            size_t size = rle_encode(packed, page, PAGE_SIZE);
+            struct Z80_Data data {
+                .length = (unsigned short)(size < PAGE_SIZE ? size : 0xFFFF),
+                .page = (unsigned char)(hw == HW_Sinclair_48 ? pages_48[i].page : i + 3)
+            };
             if (fwrite(&data, sizeof(Z80_Data), 1, fp) != 1)
                 throw std::runtime_error("Write data header");
-            if (fwrite(ula->page(page), 0x4000, 1, fp) != 1)
+            if (fwrite(size < PAGE_SIZE ? packed : page, size < PAGE_SIZE ? size : PAGE_SIZE, 1, fp) != 1)
                 throw std::runtime_error("Write page data");
         }
+        delete[] packed;
         fclose(fp);
     }
 
+    // The file is mapped and decoded right from the mapping.
     Hardware load_z80(const char *path, Z80_State &cpu, ULA *ula, IO *io){
         Hardware hw = HW_Sinclair_128;
         //Hardware hw = HW_Pentagon_128;
-        Z80_Header *header;
         int page_mode = 1;
         int page_map[2][12] = { { -1, -1, -1, -1, 2, 0, -1, -1, 5, -1, -1, -1 }, { -1, -1, -1, 0, 1, 2, 3, 4, 5, 6, 7, -1 } };
-        unsigned int idx, block_size, page;
-        unsigned char *pages[4];
-        int page_offset;
-        size_t size;
-        FILE *fp = fopen(path, "rb");
-        fseek(fp, 0, SEEK_END);
-        size = ftell(fp);
-        fseek(fp, 0, SEEK_SET);
-        unsigned char *data = new unsigned char[size];
-        if (fread(data, 1, size, fp) != size)
+        size_t idx, block_size;
+        unsigned int page;
+        u8 *pages[4];
+        File_Map file;
+        if (!file.open(path))
             throw std::runtime_error("Read Z80 snapshot");
-        fclose(fp);
+        const u8 *data = file.data();
+        size_t size = file.size();
+        if (size < header_v145_length)
+            throw std::runtime_error("Wrong Z80 snapshot size");
         idx = header_v145_length;
-        header = (Z80_Header*)data;
-        if (header->flags == 0xFF)
-            header->flags = 1;
+        const Z80_Header *header = (const Z80_Header*)data;
+        u8 flags = header->flags == 0xFF ? 1 : header->flags;
         if (!header->pc){
+            if (size < header_v145_length + 2 || idx + header->ext_length + 2 > size)
+                throw std::runtime_error("Wrong Z80 snapshot size");
             idx += header->ext_length + 2;
             if (header->ext_length == header_v201_length){
                 if (header->mode < 3)
@@ -115,24 +164,30 @@ namespace Snapshot {
             if (header->mode == 9)
                 hw = HW_Pentagon_128;
             page_mode = (hw == HW_Sinclair_128 || hw == HW_Pentagon_128) ? 1 : 0;
-            while (idx + 4 < size){
-                block_size = data[idx] | (data[idx + 1] << 8);
-                page = data[idx + 2];
-                idx += 3;
+            while (idx + sizeof(Z80_Data) < size){
+                const Z80_Data *block = (const Z80_Data*)(data + idx);
+                block_size = block->length;
+                page = block->page;
+                idx += sizeof(Z80_Data);
                 if (page >= 12)
                     throw std::runtime_error("RAM-page index overflow");
-                if (block_size == 0xFFFF){ // Not encoded.
+                bool raw = block_size == 0xFFFF; // Not encoded.
+                if (raw)
                     block_size = 0x4000;
-                    if (idx + block_size > size)
-                        throw std::runtime_error("Wrong block size");
-                    memcpy(ula->page(page_map[page_mode][page]), &data[idx], block_size);
+                if (idx + block_size > size)
+                    throw std::runtime_error("Wrong block size");
+                if (page_map[page_mode][page] < 0){ // ROM or a page the model has not.
                     idx += block_size;
-                }else{
+                    continue;
+                }
+                if (raw)
+                    memcpy(ula->page(page_map[page_mode][page]), &data[idx], block_size);
+                else{
                     pages[0] = ula->page(page_map[page_mode][page]);
                     pages[1] = NULL;
-                    page_offset = 0;
-                    idx += rle_decode(pages, &page_offset, &data[idx], block_size);
+                    rle_decode(pages, &data[idx], block_size);
                 }
+                idx += block_size;
             }
             io->write(0x7FFD, page_mode == 1 ? header->p7ffd : 0x10);
             for (int i = 0; i < 0x10; i++){
@@ -141,14 +196,15 @@ namespace Snapshot {
             }
             cpu.pc = header->ext_pc;
         }else{
-            if (header->flags & 0b100000){ // RLE
+            if (flags & 0b100000){ // RLE
                 pages[0] = ula->page(5);
                 pages[1] = ula->page(2);
                 pages[2] = ula->page(0);
                 pages[3] = NULL;
-                page_offset = 0;
-                rle_decode(pages, &page_offset, &data[idx], size - idx);
+                rle_decode(pages, &data[idx], size - idx);
             }else{
+                if (idx + 0xC000 > size)
+                    throw std::runtime_error("Wrong Z80 snapshot size");
                 memcpy(ula->page(5), &data[idx], 0x4000);
                 memcpy(ula->page(2), &data[idx + 0x4000], 0x4000);
                 memcpy(ula->page(0), &data[idx + 0x8000], 0x4000);
@@ -163,7 +219,7 @@ namespace Snapshot {
         cpu.sp = header->sp;
         cpu.irh = header->i;
         cpu.irl = header->r & 0x7F;
-        cpu.r8bit = (header->flags & 0x01) << 7;
+        cpu.r8bit = (flags & 0x01) << 7;
         cpu.de = header->de;
         cpu.alt.bc = header->alt_bc;
         cpu.alt.de = header->alt_de;
@@ -175,8 +231,271 @@ namespace Snapshot {
         cpu.iff1 = header->iff1;
         cpu.iff2 = header->iff2;
         cpu.im = header->im & 0x03;
-        io->write(0xFE, (header->flags >> 1) & 0x07);
-        delete[] data;
+        io->write(0xFE, (flags >> 1) & 0x07);
+        return hw;
+    }
+
+    void save_sna(const char *path, Hardware hw, Z80_State &cpu, ULA *ula, IO *io){
+        std::vector<u8> ram(0xC000);
+        memcpy(&ram[0x0000], ula->read_page(5), PAGE_SIZE);
+        memcpy(&ram[0x4000], ula->read_page(2), PAGE_SIZE);
+        memcpy(&ram[0x8000], ula->read_page(ula->read_7FFD() & PAGE_MASK), PAGE_SIZE);
+        SNA_Header header {
+            .i = cpu.irh,
+            .alt_hl = cpu.alt.hl, .alt_de = cpu.alt.de, .alt_bc = cpu.alt.bc, .alt_af = cpu.alt.af,
+            .hl = cpu.hl, .de = cpu.de, .bc = cpu.bc, .iy = cpu.iy, .ix = cpu.ix,
+            .iff2 = (u8)(cpu.iff2 ? 0x04 : 0x00),
+            .r = (u8)((cpu.irl & 0x7F) | (cpu.r8bit & 0x80)),
+            .af = cpu.af, .sp = cpu.sp,
+            .im = cpu.im,
+            .border = ula->get_border_color()
+        };
+        if (hw == HW_Sinclair_48){ // PC is pushed to the stack, the snapshot is run by RETN.
+            header.sp -= 2;
+            for (int i = 0; i < 2; i++)
+                if ((u16)(header.sp + i) >= 0x4000)
+                    ram[(u16)(header.sp + i) - 0x4000] = i ? cpu.pch : cpu.pcl;
+        }
+        FILE *fp = fopen(path, "wb");
+        if (!fp)
+            throw std::runtime_error("Create SNA snapshot");
+        if (fwrite(&header, sizeof(SNA_Header), 1, fp) != 1 || fwrite(ram.data(), ram.size(), 1, fp) != 1)
+            throw std::runtime_error("Write SNA snapshot");
+        if (hw != HW_Sinclair_48){
+            SNA_128_Header ext { .pc = cpu.pc, .p7ffd = ula->read_7FFD(), .trdos = ula->is_trdos_active() };
+            if (fwrite(&ext, sizeof(SNA_128_Header), 1, fp) != 1)
+                throw std::runtime_error("Write SNA snapshot");
+            for (int page = 0; page < RAM_PAGES; page++){
+                if (page == 2 || page == 5 || page == (ext.p7ffd & PAGE_MASK))
+                    continue;
+                if (fwrite(ula->read_page(page), PAGE_SIZE, 1, fp) != 1)
+                    throw std::runtime_error("Write SNA snapshot");
+            }
+        }
+        fclose(fp);
+    }
+
+    // 48K snapshot is 49179 bytes. 128K one has 5 more pages, or 6 if the paged one is 2 or 5.
+    Hardware load_sna(const char *path, Z80_State &cpu, ULA *ula, IO *io){
+        File_Map file;
+        if (!file.open(path))
+            throw std::runtime_error("Open SNA snapshot");
+        const u8 *data = file.data();
+        size_t size = file.size();
+        if (size < SNA_48K_SIZE)
+            throw std::runtime_error("Wrong SNA snapshot size");
+        const SNA_Header *header = (const SNA_Header*)data;
+        const u8 *ram = data + sizeof(SNA_Header);
+        Hardware hw = size > SNA_48K_SIZE ? HW_Sinclair_128 : HW_Sinclair_48;
+        if (hw == HW_Sinclair_128){
+            if (size < SNA_48K_SIZE + sizeof(SNA_128_Header) + PAGE_SIZE * 5)
+                throw std::runtime_error("Wrong SNA snapshot size");
+            const SNA_128_Header *ext = (const SNA_128_Header*)(data + SNA_48K_SIZE);
+            int paged = ext->p7ffd & PAGE_MASK;
+            size_t idx = SNA_48K_SIZE + sizeof(SNA_128_Header);
+            for (int page = 0; page < RAM_PAGES; page++){
+                if (page == 2 || page == 5 || page == paged)
+                    continue;
+                if (idx + PAGE_SIZE > size)
+                    throw std::runtime_error("Wrong SNA snapshot size");
+                memcpy(ula->page(page), data + idx, PAGE_SIZE);
+                idx += PAGE_SIZE;
+            }
+            memcpy(ula->page(paged), ram + 0x8000, PAGE_SIZE);
+            io->write(0x7FFD, ext->p7ffd);
+            if (ext->trdos)
+                ula->trap_trdos(0x3D00); // Pages TR-DOS in as the 48K ROM is there.
+            cpu.pc = ext->pc;
+        }else{
+            memcpy(ula->page(0), ram + 0x8000, PAGE_SIZE);
+            io->write(0x7FFD, 0x10);
+        }
+        memcpy(ula->page(5), ram, PAGE_SIZE);
+        memcpy(ula->page(2), ram + 0x4000, PAGE_SIZE);
+        cpu.irh = header->i;
+        cpu.alt.hl = header->alt_hl;
+        cpu.alt.de = header->alt_de;
+        cpu.alt.bc = header->alt_bc;
+        cpu.alt.af = header->alt_af;
+        cpu.hl = header->hl;
+        cpu.de = header->de;
+        cpu.bc = header->bc;
+        cpu.iy = header->iy;
+        cpu.ix = header->ix;
+        cpu.iff1 = cpu.iff2 = (header->iff2 >> 2) & 0x01;
+        cpu.irl = header->r & 0x7F;
+        cpu.r8bit = header->r & 0x80;
+        cpu.af = header->af;
+        cpu.sp = header->sp;
+        cpu.im = header->im & 0x03;
+        if (hw == HW_Sinclair_48){
+            cpu.pcl = ula->read_byte(cpu.sp++);
+            cpu.pch = ula->read_byte(cpu.sp++);
+        }
+        io->write(0xFE, header->border & 0x07);
+        return hw;
+    }
+
+    static void write_block(FILE *fp, const char *id, const void *data, u32 size, const void *tail = NULL, u32 tail_size = 0){
+        SZX_Block block;
+        memcpy(block.id, id, sizeof(block.id));
+        block.size = size + tail_size;
+        if (fwrite(&block, sizeof(SZX_Block), 1, fp) != 1 || fwrite(data, size, 1, fp) != 1 || (tail_size && fwrite(tail, tail_size, 1, fp) != 1))
+            throw std::runtime_error("Write SZX chunk");
+    }
+
+    // The state is taken between frames, the clocks of the devices are relative to the frame start.
+    void save_szx(const char *path, Hardware hw, Z80_State &cpu, ULA *ula, Sound *sound, Tape *tape, FDC *fdc){
+        AY_State ay;
+        ULA_State ula_state;
+        Tape_State tape_state;
+        FDC_State fdc_state;
+        std::vector<u8> stream;
+        sound->get_state(ay);
+        ula->get_state(ula_state);
+        tape->get_state(tape_state);
+        fdc->get_state(fdc_state, stream);
+        static const u8 machine[sizeof(Hardware)] = { SZX_MACHINE_PENTAGON, SZX_MACHINE_128K, SZX_MACHINE_48K };
+        SZX_Header header { .signature = { 'Z', 'X', 'S', 'T' }, .major = 1, .minor = 4, .machine = machine[hw], .flags = 0 };
+        SZX_Z80R z80r {
+            .af = cpu.af, .bc = cpu.bc, .de = cpu.de, .hl = cpu.hl,
+            .alt_af = cpu.alt.af, .alt_bc = cpu.alt.bc, .alt_de = cpu.alt.de, .alt_hl = cpu.alt.hl,
+            .ix = cpu.ix, .iy = cpu.iy, .sp = cpu.sp, .pc = cpu.pc,
+            .i = cpu.irh, .r = (u8)((cpu.irl & 0x7F) | (cpu.r8bit & 0x80)),
+            .iff1 = cpu.iff1, .iff2 = cpu.iff2,
+            .im = cpu.im,
+            .clk = (u32)cpu.clk,
+            .int_hold = 0, .flags = 0,
+            .memptr = cpu.memptr
+        };
+        SZX_SPCR spcr { .border = ula->get_border_color(), .p7ffd = ula->read_7FFD(), .p1ffd = 0, .pFE = ay.wFE };
+        SZX_AY ay_regs { .flags = 0, .selected = ay.selected };
+        memcpy(ay_regs.registers, ay.registers, sizeof(ay.registers));
+        SZX_B128 beta {
+            .flags = (u32)(SZX_BETA_CONNECTED | (ula->is_trdos_active() ? SZX_BETA_PAGED : 0) | (fdc_state.step_dir < 0 ? SZX_BETA_SEEKLOWER : 0)),
+            .drives = 4,
+            .system = fdc_state.system, .track = fdc_state.track, .sector = fdc_state.sector, .data = fdc_state.data, .status = fdc_state.status
+        };
+        FILE *fp = fopen(path, "wb");
+        if (!fp)
+            throw std::runtime_error("Create SZX snapshot");
+        if (fwrite(&header, sizeof(SZX_Header), 1, fp) != 1)
+            throw std::runtime_error("Write SZX header");
+        write_block(fp, "Z80R", &z80r, sizeof(z80r));
+        write_block(fp, "SPCR", &spcr, sizeof(spcr));
+        write_block(fp, "AY\0\0", &ay_regs, sizeof(ay_regs));
+        for (u8 page = 0; page < RAM_PAGES; page++){
+            if (hw == HW_Sinclair_48 && page != 0 && page != 2 && page != 5)
+                continue;
+            SZX_RAMP ramp { .flags = 0, .page = page };
+            write_block(fp, "RAMP", &ramp, sizeof(ramp), ula->read_page(page), PAGE_SIZE);
+        }
+        write_block(fp, "B128", &beta, sizeof(beta));
+        write_block(fp, "AYST", &ay, sizeof(ay));
+        write_block(fp, "ULAS", &ula_state, sizeof(ula_state));
+        write_block(fp, "TAPS", &tape_state, sizeof(tape_state));
+        write_block(fp, "FDCS", &fdc_state, sizeof(fdc_state), stream.data(), stream.size());
+        fclose(fp);
+    }
+
+    // Unknown chunks are skipped. The custom ones overwrite the standard ones read before.
+    Hardware load_szx(const char *path, Z80_State &cpu, ULA *ula, IO *io, Sound *sound, Tape *tape, FDC *fdc){
+        File_Map file;
+        if (!file.open(path))
+            throw std::runtime_error("Open SZX snapshot");
+        const u8 *data = file.data();
+        size_t size = file.size();
+        const SZX_Header *header = (const SZX_Header*)data;
+        if (size < sizeof(SZX_Header) || memcmp(header->signature, "ZXST", 4))
+            throw std::runtime_error("Not a SZX snapshot");
+        Hardware hw = HW_Sinclair_128;
+        switch (header->machine){
+            case 0: // 16K
+            case SZX_MACHINE_48K:
+                hw = HW_Sinclair_48;
+                break;
+            case SZX_MACHINE_PENTAGON:
+                hw = HW_Pentagon_128;
+                break;
+            case SZX_MACHINE_128K:
+                break;
+            default:
+                printf("WARN: SZX machine %d is loaded as 128K.\n", header->machine);
+                break;
+        }
+        size_t idx = sizeof(SZX_Header);
+        while (idx + sizeof(SZX_Block) <= size){
+            const SZX_Block *block = (const SZX_Block*)(data + idx);
+            const u8 *body = data + idx + sizeof(SZX_Block);
+            idx += sizeof(SZX_Block);
+            if (block->size > size - idx)
+                throw std::runtime_error("Truncated SZX chunk");
+            idx += block->size;
+            if (!memcmp(block->id, "Z80R", 4) && block->size >= sizeof(SZX_Z80R)){
+                const SZX_Z80R *z80r = (const SZX_Z80R*)body;
+                cpu.af = z80r->af;
+                cpu.bc = z80r->bc;
+                cpu.de = z80r->de;
+                cpu.hl = z80r->hl;
+                cpu.alt.af = z80r->alt_af;
+                cpu.alt.bc = z80r->alt_bc;
+                cpu.alt.de = z80r->alt_de;
+                cpu.alt.hl = z80r->alt_hl;
+                cpu.ix = z80r->ix;
+                cpu.iy = z80r->iy;
+                cpu.sp = z80r->sp;
+                cpu.pc = z80r->pc;
+                cpu.irh = z80r->i;
+                cpu.irl = z80r->r & 0x7F;
+                cpu.r8bit = z80r->r & 0x80;
+                cpu.iff1 = z80r->iff1 & 0x01;
+                cpu.iff2 = z80r->iff2 & 0x01;
+                cpu.im = z80r->im & 0x03;
+                cpu.clk = z80r->clk;
+                cpu.memptr = z80r->memptr;
+            }else if (!memcmp(block->id, "SPCR", 4) && block->size >= sizeof(SZX_SPCR)){
+                const SZX_SPCR *spcr = (const SZX_SPCR*)body;
+                io->write(0x7FFD, hw == HW_Sinclair_48 ? 0x10 : spcr->p7ffd);
+                io->write(0xFE, (spcr->pFE & ~0x07) | (spcr->border & 0x07));
+            }else if (!memcmp(block->id, "RAMP", 4) && block->size >= sizeof(SZX_RAMP)){
+                const SZX_RAMP *ramp = (const SZX_RAMP*)body;
+                if (ramp->flags & SZX_RAM_COMPRESSED)
+                    throw std::runtime_error("Compressed SZX pages are not supported");
+                if (ramp->page < RAM_PAGES && block->size >= sizeof(SZX_RAMP) + PAGE_SIZE)
+                    memcpy(ula->page(ramp->page), body + sizeof(SZX_RAMP), PAGE_SIZE);
+            }else if (!memcmp(block->id, "AY\0\0", 4) && block->size >= sizeof(SZX_AY)){
+                const SZX_AY *ay = (const SZX_AY*)body;
+                for (int i = 0; i < 0x10; i++){
+                    io->write(0xFFFD, i);
+                    io->write(0xBFFD, ay->registers[i]);
+                }
+                io->write(0xFFFD, ay->selected);
+            }else if (!memcmp(block->id, "B128", 4) && block->size >= sizeof(SZX_B128)){
+                const SZX_B128 *beta = (const SZX_B128*)body;
+                FDC_State state;
+                std::vector<u8> stream;
+                fdc->get_state(state, stream);
+                state.system = beta->system;
+                state.track = beta->track;
+                state.sector = beta->sector;
+                state.data = beta->data;
+                state.status = beta->status;
+                state.step_dir = beta->flags & SZX_BETA_SEEKLOWER ? -1 : 1;
+                fdc->set_state(state, stream.data());
+                if (beta->flags & SZX_BETA_PAGED)
+                    ula->trap_trdos(0x3D00); // Pages TR-DOS in as the 48K ROM is there.
+            }else if (!memcmp(block->id, "AYST", 4) && block->size >= sizeof(AY_State)){
+                sound->set_state(*(const AY_State*)body);
+            }else if (!memcmp(block->id, "ULAS", 4) && block->size >= sizeof(ULA_State)){
+                ula->set_state(*(const ULA_State*)body);
+            }else if (!memcmp(block->id, "TAPS", 4) && block->size >= sizeof(Tape_State)){
+                tape->set_state(*(const Tape_State*)body);
+            }else if (!memcmp(block->id, "FDCS", 4) && block->size >= sizeof(FDC_State)){
+                const FDC_State *state = (const FDC_State*)body;
+                if (block->size >= sizeof(FDC_State) + state->stream_size)
+                    fdc->set_state(*state, body + sizeof(FDC_State));
+            }
+        }
         return hw;
     }
 }
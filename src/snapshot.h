@@ -1,6 +1,16 @@
 #define header_v145_length 30
 #define header_v201_length 23
 #define header_v300_length 54
+#define SNA_48K_SIZE        (sizeof(SNA_Header) + 0xC000)
+// SZX: a header and chunks of 4 char ID and size. Standard chunks are read from other emulators' files,
+// the emulator's own state follows them in custom chunks, which other readers skip.
+#define SZX_MACHINE_48K     1
+#define SZX_MACHINE_128K    2
+#define SZX_MACHINE_PENTAGON 7
+#define SZX_RAM_COMPRESSED  0x0001
+#define SZX_BETA_CONNECTED  0x00000001
+#define SZX_BETA_PAGED      0x00000004
+#define SZX_BETA_SEEKLOWER  0x00000010
 
 #pragma pack(1)
 struct Z80_Header {
@@ -42,9 +52,72 @@ struct Z80_Data {
     unsigned short length;
     unsigned char page;
 };
+struct SNA_Header {
+    u8 i;
+    u16 alt_hl, alt_de, alt_bc, alt_af;
+    u16 hl, de, bc, iy, ix;
+    u8 iff2;                                                // Bit 2.
+    u8 r;
+    u16 af, sp;
+    u8 im;
+    u8 border;
+};
+struct SNA_128_Header {                                     // After the pages 5, 2 and the paged one.
+    u16 pc;
+    u8 p7ffd;
+    u8 trdos;                                               // TR-DOS ROM paged.
+};
+struct SZX_Header {
+    char signature[4];                                      // "ZXST"
+    u8 major;
+    u8 minor;
+    u8 machine;
+    u8 flags;
+};
+struct SZX_Block {
+    char id[4];
+    u32 size;
+};
+struct SZX_Z80R {
+    u16 af, bc, de, hl;
+    u16 alt_af, alt_bc, alt_de, alt_hl;
+    u16 ix, iy, sp, pc;
+    u8 i, r;
+    u8 iff1, iff2;
+    u8 im;
+    u32 clk;                                                // Since the frame interrupt.
+    u8 int_hold;
+    u8 flags;
+    u16 memptr;
+};
+struct SZX_SPCR {
+    u8 border;
+    u8 p7ffd;
+    u8 p1ffd;
+    u8 pFE;
+    u8 reserved[4];
+};
+struct SZX_RAMP {                                           // The page data follows.
+    u16 flags;
+    u8 page;
+};
+struct SZX_AY {
+    u8 flags;
+    u8 selected;
+    u8 registers[0x10];
+};
+struct SZX_B128 {
+    u32 flags;
+    u8 drives;
+    u8 system, track, sector, data, status;
+};
 #pragma pack()
 
 namespace Snapshot {
-    void save_z80(const char *path, Z80_State &cpu, ULA *ula, IO *io);
+    void save_z80(const char *path, Hardware hw, Z80_State &cpu, ULA *ula, Sound *sound);
     Hardware load_z80(const char *path, Z80_State &cpu, ULA *ula, IO *io);
+    void save_sna(const char *path, Hardware hw, Z80_State &cpu, ULA *ula, IO *io);
+    Hardware load_sna(const char *path, Z80_State &cpu, ULA *ula, IO *io);
+    void save_szx(const char *path, Hardware hw, Z80_State &cpu, ULA *ula, Sound *sound, Tape *tape, FDC *fdc);
+    Hardware load_szx(const char *path, Z80_State &cpu, ULA *ula, IO *io, Sound *sound, Tape *tape, FDC *fdc);
 }
@@ -2,7 +2,9 @@
 #include <stdexcept>
 #include <stdio.h>
 #include <string.h>
-#include <SDL.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "types.h"
 #include "utils.h"
 #include "config.h"
@@ -10,6 +12,7 @@
 #include "memory.h"
 #include "ula.h"
 #include "z80.h"
+#include "recorder.h"
 #include "sound.h"
 #include <math.h>
 
@@ -17,28 +20,90 @@ Sound::Sound(){
     reset();
 }
 
-void Sound::setup(int rate, int cutoff_rate, int frame_clk){
-    reset();
+// The generators keep running, only the output buffer is set up again.
+void Sound::setup(int rate, int cutoff_rate, int clk){
+    speed_frame = 0;
+    pos = 0;
     sample_rate = rate;
-    ay_increment = AY_RATE / sample_rate;
+    frame_clk = clk;
+    ay_increment = AY_RATE * speed / sample_rate;
     set_lpf(cutoff_rate);
-    if (device_id)
-        SDL_CloseAudioDevice(device_id);
     frame_samples = frame_clk * (sample_rate / Z80_FREQ);
-    SDL_zero(audio_spec);
-    audio_spec.freq = sample_rate;
-    audio_spec.format = AUDIO_S16;
-    audio_spec.channels = 2;
-    audio_spec.samples = frame_samples*2;//pow(2, ceil(log(71680 * 4 * (sample_rate / Z80_FREQ))/log(2)));
-    audio_spec.callback = NULL;
-    device_id = SDL_OpenAudioDevice(NULL, 0, &audio_spec, NULL, 0);
-    if (!device_id)
-        throw std::runtime_error("Open audio device");
-    if (!buffer)
-        buffer = new s16[frame_samples*2];
-    memset(buffer, 0x00, audio_spec.samples/2*4);
-    SDL_QueueAudio(device_id, buffer, audio_spec.samples/2*4);
-    SDL_PauseAudioDevice(device_id, 0);
+    DELETE_ARRAY(buffer);
+    buffer = new s16[frame_samples*2];
+    memset(buffer, 0x00, frame_samples*4);
+}
+
+// Fast-forward: "speed" emulated frames are decimated into one frame of output samples.
+// The AY generators step "speed" times faster per sample, so the audio keeps real-time length.
+void Sound::set_speed(int multiplier){
+    speed = MAX(multiplier, 1);
+    speed_frame = 0;
+    pos = 0;
+    ay_increment = AY_RATE * speed / sample_rate;
+}
+
+void Sound::record_wav(const char *path){
+    wav.open(path, Recorder::WAV, sample_rate);
+}
+
+void Sound::record_psg(const char *path){
+    psg.open(path, Recorder::PSG);
+    for (u8 reg = ToneALow; reg <= EnvShape; reg++){
+        u8 data[2] = { reg, registers[reg] };
+        psg.push(data, sizeof(data));
+    }
+}
+
+void Sound::record_stop(){
+    wav.close();
+    psg.close();
+}
+
+void Sound::get_state(AY_State &state){
+    memcpy(state.registers, registers, sizeof(registers));
+    state.selected = wFFFD;
+    state.wFE = wFE;
+    state.rFE = rFE;
+    state.tone_a_counter = tone_a_counter;
+    state.tone_b_counter = tone_b_counter;
+    state.tone_c_counter = tone_c_counter;
+    state.noise_counter = noise_counter;
+    state.envelope_counter = envelope_counter;
+    state.tone_a = tone_a;
+    state.tone_b = tone_b;
+    state.tone_c = tone_c;
+    state.noise = noise;
+    state.envelope = envelope;
+    state.envelope_pos = envelope_pos;
+    state.noise_seed = noise_seed;
+    state.left = left;
+    state.right = right;
+}
+
+// Registers go through the port to set the limits, the counters are set after as the envelope shape resets them.
+void Sound::set_state(const AY_State &state){
+    for (u8 reg = ToneALow; reg <= PortB; reg++){
+        write(0xFFFD, reg, 0);
+        write(0xBFFD, state.registers[reg], 0);
+    }
+    wFFFD = state.selected & 0x0F;
+    wFE = state.wFE;
+    rFE = state.rFE;
+    tone_a_counter = state.tone_a_counter;
+    tone_b_counter = state.tone_b_counter;
+    tone_c_counter = state.tone_c_counter;
+    noise_counter = state.noise_counter;
+    envelope_counter = state.envelope_counter;
+    tone_a = state.tone_a;
+    tone_b = state.tone_b;
+    tone_c = state.tone_c;
+    noise = state.noise;
+    envelope = state.envelope;
+    envelope_pos = state.envelope_pos;
+    noise_seed = state.noise_seed;
+    left = state.left;
+    right = state.right;
 }
 
 void Sound::set_lpf(int cutoff_rate){
@@ -82,21 +147,18 @@ void Sound::set_ay_volume(float volume, AY_Mixer channel_mode, float side_level,
 
 Sound::~Sound(){
     DELETE_ARRAY(buffer);
-    if (device_id){
-        SDL_CloseAudioDevice(device_id);
-        device_id = 0;
-    }
 }
 
 void Sound::update(int clk){
-    if (!buffer)
+    if (!buffer || silent)
         return;
     u16 square = (
         ((rFE & TapeIn) ? MAX_AMP * tape_volume : 0) +
         ((wFE & TapeOut) ? MAX_AMP * tape_volume : 0) +
         ((wFE & Speaker) ? MAX_AMP * speaker_volume : 0));
 
-    for (int now = clk * (sample_rate / Z80_FREQ); pos < now; pos++){
+    s32 now = MIN((s32)((speed_frame * frame_clk + clk) * (sample_rate / Z80_FREQ) / speed), (s32)frame_samples);
+    for (; pos < now; pos++){
         u16 mix_left, mix_right;
         tone_a_counter += ay_increment;
         if (tone_a_counter >= tone_a_limit){
@@ -159,6 +221,10 @@ void Sound::write(u16 port, u8 byte, s32 clk){
         }else{
             if ((port & 0xC002) == 0x8000){
                 update(clk);
+                if (psg.is_open() && !silent){
+                    u8 data[2] = { wFFFD, byte };
+                    psg.push(data, sizeof(data));
+                }
                 registers[wFFFD] = byte;
                 switch(wFFFD){
                     case ToneAHigh:
@@ -232,19 +298,19 @@ void Sound::reset(){
     wFE = 0x00;
     wFFFD = 0x0F;
     left = right = 0;
+    speed_frame = 0;
     pos = 0;
 }
 
 void Sound::frame(int frame_clk){
+    if (silent)
+        return;
     update(frame_clk);
-    pos = 0;
-}
-
-void Sound::queue(){
-    //u32 frame_samples = frame_clk * (sample_rate / Z80_FREQ);
-    if (SDL_GetAudioDeviceStatus(device_id) == SDL_AUDIO_PLAYING){
-        while (SDL_GetQueuedAudioSize(device_id) > (audio_spec.samples - frame_samples) * 4)
-            SDL_Delay(1);
-        SDL_QueueAudio(device_id, buffer, frame_samples * 4);
+    psg.push(PSG_END_OF_FRAME);
+    if (++speed_frame >= speed){
+        if (wav.is_open())
+            wav.push(buffer, frame_samples * 4);
+        speed_frame = 0;
+        pos = 0;
     }
 }
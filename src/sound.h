@@ -20,6 +20,20 @@ enum FE_ReadWrite {
     TapeIn      = 0b01000000  // 1 on
 };
 
+#pragma pack(1)
+struct AY_State {                                           // Generators and ports as they are between frames.
+    u8 registers[0x10];
+    u8 selected;                                            // The register latched by FFFD.
+    u8 wFE, rFE;
+    float tone_a_counter, tone_b_counter, tone_c_counter, noise_counter, envelope_counter;
+    u8 tone_a, tone_b, tone_c, noise;
+    u8 envelope;
+    s32 envelope_pos;
+    u32 noise_seed;
+    u32 left, right;                                        // Low pass filter.
+};
+#pragma pack()
+
 class Sound : public Device {
     public:
         Sound();
@@ -29,8 +43,18 @@ class Sound : public Device {
         void set_ay_volume(float volume, AY_Mixer channel_mode, float side_level, float center_level, float penetr_level);
         void set_speaker_volume(float volume) { speaker_volume = volume; };
         void set_tape_volume(float volume) { tape_volume = volume; };
+        void set_speed(int speed);
+        void record_wav(const char *path);
+        void record_psg(const char *path);
+        void record_stop();
+        bool is_recording() { return wav.is_open() || psg.is_open(); };
+        void set_silent(bool state) { silent = state; };
+        void get_state(AY_State &state);
+        void set_state(const AY_State &state);
         void update(s32 clk);
-        void queue();
+        const s16* get_buffer() { return buffer; };         // Stereo samples of the output frame.
+        u32 get_samples() { return frame_samples; };
+        s32 get_sample_rate() { return sample_rate; };
 
         void read(u16 port, u8* byte, s32 clk);
         void write(u16 port, u8 byte, s32 clk);
@@ -40,10 +64,12 @@ class Sound : public Device {
 
     protected:
         s16 *buffer = NULL;
-        SDL_AudioDeviceID device_id = 0;
-        SDL_AudioSpec audio_spec;
         s32 sample_rate;
+        s32 frame_clk;
         u32 frame_samples;
+        s32 speed = 1;                  // Emulated frames squeezed into one output frame.
+        s32 speed_frame = 0;
+        bool silent = false;            // Frames run without the output, the generators stop.
         float ay_increment;
         float tone_a_counter, tone_b_counter, tone_c_counter, noise_counter, envelope_counter;
         float tone_a_limit, tone_b_limit, tone_c_limit, noise_limit, envelope_limit;
@@ -128,4 +154,5 @@ class Sound : public Device {
         u32 left, right;
         u32 lpf_fract;
         s32 pos;
+        Recorder wav, psg;
 };
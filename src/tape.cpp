@@ -3,6 +3,8 @@
 #include <stdexcept>
 #include <stdio.h>
 #include <string.h>
+#include <vector>
+#include <algorithm>
 #include "types.h"
 #include "utils.h"
 #include "config.h"
@@ -10,121 +12,682 @@
 #include "memory.h"
 #include "ula.h"
 #include "z80.h"
+#include "filemap.h"
 #include "tape.h"
 
+#define LE16(p) ((u32)((p)[0] | (p)[1] << 8))
+#define LE24(p) (LE16(p) | (u32)(p)[2] << 16)
+#define LE32(p) (LE24(p) | (u32)(p)[3] << 24)
+
 Tape::Tape(){
-    p_data = NULL;
-    data_size = 0;
-    block_end = 0;
     last_clk = 0;
-    time = 0;
-    idx = 0;
-    pFE = ~EAR_IN;
-    stop();
+    record_clk = last_edge = 0;
+    decoder = DEC_PILOT;
+    pilot_count = pilot_sum = 0;
+    wFE = 0x00;
+    clear();
 }
 
 Tape::~Tape(){
-    DELETE_ARRAY(p_data);
-}
-
-bool Tape::load_tap(const char *p_path){
-    try {
-        p_file = fopen(p_path, "rb");
-        fseek(p_file, 0, SEEK_END);
-        data_size = ftell(p_file);
-        fseek(p_file, 0, SEEK_SET);
-        DELETE_ARRAY(p_data);
-        p_data = new unsigned char[data_size];
-        fread(p_data, 1, data_size, p_file);
-        fclose(p_file);
-        return true;
-    }catch(std::exception &e){
-        if (p_file)
-            fclose(p_file);
+    record_stop();
+}
+
+void Tape::clear(){
+    file.close();
+    spans.clear();
+    blocks.clear();
+    stops.clear();
+    level = false;
+    play_state = false;
+    seek(0);
+}
+
+bool Tape::load_tap(const char *path){
+    clear();
+    if (!file.open(path))
+        return false;
+    const u8 *data = file.data();
+    size_t size = file.size();
+    size_t idx = 0;
+    while (idx + 2 <= size){
+        u32 len = LE16(data + idx);
+        idx += 2;
+        if (idx + len > size){ // A damaged file or not a TAP one, the block lengths are all it has.
+            printf("WARN: Truncated TAP block.\n");
+            clear();
+            return false;
+        }
+        if (len){
+            add_standard(data + idx, len);
+            add_pause(1000);
+        }
+        idx += len;
+    }
+    seek(0);
+    return true;
+}
+
+bool Tape::load_tzx(const char *path){
+    clear();
+    if (!file.open(path))
+        return false;
+    if (file.size() < 10 || memcmp(file.data(), "ZXTape!\x1A", 8)){
+        printf("WARN: Not a TZX file.\n");
+        clear();
         return false;
     }
+    parse_tzx(file.data() + 10, file.size() - 10);
+    seek(0);
+    return true;
 }
 
-void Tape::play(){
-    if (idx >= data_size)
+bool Tape::load_csw(const char *path){
+    clear();
+    if (!file.open(path))
+        return false;
+    const u8 *data = file.data();
+    size_t size = file.size();
+    const CSW_Header *header = (const CSW_Header*)data;
+    // The v1 header is 0x20 bytes, the v2 one 0x34 and its extension.
+    if (size < 0x20 || memcmp(header->signature, "Compressed Square Wave", 22) || header->terminator != 0x1A ||
+        (header->major != 1 && size < 0x34)){
+        printf("WARN: Not a CSW file.\n");
+        clear();
+        return false;
+    }
+    u32 rate, offset;
+    u8 compression, flags;
+    if (header->major == 1){
+        rate = LE16(data + 0x19);
+        compression = data[0x1B];
+        flags = data[0x1C];
+        offset = 0x20;
+    }else{
+        rate = LE32(data + 0x19);
+        compression = data[0x21];
+        flags = data[0x22];
+        offset = 0x34 + data[0x23];
+    }
+    if (compression != 1 || !rate || offset > size){ // Z-RLE needs zlib.
+        printf("WARN: CSW compression %d is not supported.\n", compression);
+        clear();
+        return false;
+    }
+    level = !(flags & 0x01); // The first pulse has the initial polarity.
+    add_csw(data + offset, size - offset, rate);
+    seek(0);
+    return true;
+}
+
+// TZX blocks are compiled into spans. Jumps, calls and selections are not followed, the tape plays in file order.
+void Tape::parse_tzx(const u8 *data, size_t size){
+    size_t idx = 0;
+    size_t loop_start = 0;
+    u32 loop_count = 0;
+    while (idx < size){
+        u8 id = data[idx++];
+        const u8 *p = data + idx;
+        size_t left = size - idx;
+        size_t len = 0; // Without ID.
+#define NEED(n) if (left < (size_t)(n)){ printf("WARN: Truncated TZX block 0x%02X.\n", id); return; }
+        switch (id){
+            case 0x10: // Standard speed data.
+                NEED(4);
+                len = 4 + LE16(p + 2);
+                NEED(len);
+                if (len > 4)
+                    add_standard(p + 4, len - 4);
+                add_pause(LE16(p));
+                break;
+            case 0x11: // Turbo speed data.
+                NEED(0x12);
+                len = 0x12 + LE24(p + 0x0F);
+                NEED(len);
+                add_tone(LE16(p), LE16(p + 0x0A));
+                add_pulse(LE16(p + 0x02));
+                add_pulse(LE16(p + 0x04));
+                add_data(p + 0x12, len - 0x12, LE16(p + 0x06), LE16(p + 0x08), p[0x0C]);
+                add_block(p + 0x12, len - 0x12, false);
+                add_pause(LE16(p + 0x0D));
+                break;
+            case 0x12: // Pure tone.
+                NEED(4);
+                len = 4;
+                add_tone(LE16(p), LE16(p + 2));
+                break;
+            case 0x13: // Pulse sequence.
+                NEED(1);
+                len = 1 + p[0] * 2;
+                NEED(len);
+                for (int i = 0; i < p[0]; i++)
+                    add_pulse(LE16(p + 1 + i * 2));
+                break;
+            case 0x14: // Pure data.
+                NEED(0x0A);
+                len = 0x0A + LE24(p + 0x07);
+                NEED(len);
+                add_data(p + 0x0A, len - 0x0A, LE16(p), LE16(p + 0x02), p[0x04]);
+                add_block(p + 0x0A, len - 0x0A, false);
+                add_pause(LE16(p + 0x05));
+                break;
+            case 0x15: // Direct recording, a bit per sample.
+                NEED(8);
+                len = 8 + LE24(p + 0x05);
+                NEED(len);
+                for (size_t i = 8; i < len; i++){
+                    int bits = (i + 1 < len || !p[0x04]) ? 8 : p[0x04];
+                    for (int bit = 0; bit < bits; bit++){
+                        level = p[i] & (0x80 >> bit);
+                        add_span(LE16(p), level);
+                    }
+                }
+                add_block(NULL, 0, false);
+                add_pause(LE16(p + 0x02));
+                break;
+            case 0x18: // CSW recording.
+                NEED(0x0E);
+                len = 4 + LE32(p);
+                NEED(len);
+                if (p[0x09] == 1 && LE24(p + 0x06) && len >= 0x0E)
+                    add_csw(p + 0x0E, len - 0x0E, LE24(p + 0x06));
+                else
+                    printf("WARN: TZX CSW compression %d is not supported.\n", p[0x09]);
+                add_block(NULL, 0, false);
+                add_pause(LE16(p + 0x04));
+                break;
+            case 0x19:{ // Generalized data.
+                NEED(0x12);
+                len = 4 + LE32(p);
+                NEED(len);
+                u32 totp = LE32(p + 0x06);
+                u32 totd = LE32(p + 0x0C);
+                int npp = p[0x0A], asp = p[0x0B] ? p[0x0B] : 256;
+                int npd = p[0x10], asd = p[0x11] ? p[0x11] : 256;
+                int nb = 0;
+                while ((1 << nb) < asd)
+                    nb++;
+                const u8 *pilot = p + 0x12;
+                const u8 *prle = pilot + (totp ? asp * (1 + 2 * npp) : 0);
+                const u8 *symbols = prle + (u64)totp * 3;
+                const u8 *stream = symbols + (totd ? asd * (1 + 2 * npd) : 0);
+                NEED((size_t)(stream - p) + ((u64)totd * nb + 7) / 8);
+                for (u32 i = 0; i < totp; i++)
+                    if (prle[i * 3] < asp)
+                        for (u32 repeat = LE16(prle + i * 3 + 1); repeat; repeat--)
+                            add_symbol(pilot + prle[i * 3] * (1 + 2 * npp), npp);
+                for (u64 i = 0, bit = 0; i < totd; i++){
+                    u32 symbol = 0;
+                    for (int j = 0; j < nb; j++, bit++)
+                        symbol = symbol << 1 | ((stream[bit >> 3] >> (7 - (bit & 0x07))) & 0x01);
+                    if (symbol < (u32)asd)
+                        add_symbol(symbols + symbol * (1 + 2 * npd), npd);
+                }
+                add_block(NULL, 0, false);
+                add_pause(LE16(p + 0x04));
+                break;
+            }
+            case 0x20: // Pause, zero is "stop the tape".
+                NEED(2);
+                len = 2;
+                if (LE16(p))
+                    add_pause(LE16(p));
+                else if (stops.empty() || stops.back() != spans.size())
+                    stops.push_back(spans.size());
+                break;
+            case 0x21: // Group start.
+                NEED(1);
+                len = 1 + p[0];
+                break;
+            case 0x22: // Group end.
+            case 0x27: // Return from sequence.
+                break;
+            case 0x23: // Jump.
+                len = 2;
+                break;
+            case 0x24: // Loop start.
+                NEED(2);
+                len = 2;
+                loop_start = idx + len;
+                loop_count = LE16(p);
+                break;
+            case 0x25: // Loop end.
+                if (loop_count > 1){
+                    loop_count--;
+                    idx = loop_start;
+                    continue;
+                }
+                break;
+            case 0x26: // Call sequence.
+                NEED(2);
+                len = 2 + LE16(p) * 2;
+                break;
+            case 0x28: // Select block.
+            case 0x32: // Archive info.
+                NEED(2);
+                len = 2 + LE16(p);
+                break;
+            case 0x2A: // Stop the tape if in 48K mode.
+                NEED(4);
+                len = 4 + LE32(p);
+                break;
+            case 0x2B: // Set signal level.
+                NEED(5);
+                len = 4 + LE32(p);
+                level = p[4] & 0x01;
+                break;
+            case 0x30: // Text description.
+                NEED(1);
+                len = 1 + p[0];
+                break;
+            case 0x31: // Message.
+                NEED(2);
+                len = 2 + p[1];
+                break;
+            case 0x33: // Hardware type.
+                NEED(1);
+                len = 1 + p[0] * 3;
+                break;
+            case 0x35: // Custom info.
+                NEED(0x14);
+                len = 0x14 + LE32(p + 0x10);
+                break;
+            case 0x5A: // Glue, concatenated files.
+                len = 9;
+                break;
+            default: // Unknown blocks start with their length.
+                printf("WARN: Unknown TZX block 0x%02X.\n", id);
+                NEED(4);
+                len = 4 + LE32(p);
+                break;
+        }
+        NEED(len);
+#undef NEED
+        idx += len;
+    }
+}
+
+void Tape::add_span(u32 length, bool state){
+    while (length){
+        u32 part = MIN(length, (u32)SPAN_LENGTH);
+        if (!spans.empty() && !(spans.back() & SPAN_LEVEL) == !state && (spans.back() & SPAN_LENGTH) <= SPAN_LENGTH - part)
+            spans.back() += part;
+        else
+            spans.push_back(part | (state ? SPAN_LEVEL : 0));
+        length -= part;
+    }
+}
+
+// A pulse begins with an edge.
+void Tape::add_pulse(u32 length){
+    level = !level;
+    add_span(length, level);
+}
+
+void Tape::add_tone(u32 length, u32 pulses){
+    while (pulses--)
+        add_pulse(length);
+}
+
+// The last edge is kept for 1ms, then the level is low.
+void Tape::add_pause(u32 msec){
+    if (!msec)
         return;
+    add_pulse(TAPE_MSEC);
+    level = false;
+    add_span((u32)(TAPE_MSEC * (msec - 1)), level);
+}
+
+void Tape::add_data(const u8 *data, u32 size, u32 zero, u32 one, int last_bits){
+    for (u32 i = 0; i < size; i++){
+        int bits = (i + 1 < size || !last_bits) ? 8 : last_bits;
+        for (int bit = 0; bit < bits; bit++){
+            u32 length = data[i] & (0x80 >> bit) ? one : zero;
+            add_pulse(length);
+            add_pulse(length);
+        }
+    }
+}
+
+// ROM SA-BYTES output.
+void Tape::add_standard(const u8 *data, u32 size){
+    add_tone(TONE_PERIOD, data[0] < 0x80 ? HEADER_PULSES : DATA_PULSES);
+    add_pulse(SYNC_1_PERIOD);
+    add_pulse(SYNC_2_PERIOD);
+    add_data(data, size, ZERO_PERIOD, ONE_PERIOD, 8);
+    add_block(data, size, true);
+}
+
+// TZX generalized data symbol: polarity flags, then pulse lengths, zero length ends the symbol.
+void Tape::add_symbol(const u8 *symbol, int pulses){
+    for (int i = 0; i < pulses; i++){
+        u32 length = LE16(symbol + 1 + i * 2);
+        if (!length)
+            break;
+        if (i)
+            level = !level;
+        else{
+            switch (symbol[0] & 0x03){
+                case 0x00:
+                    level = !level;
+                    break;
+                case 0x02:
+                    level = false;
+                    break;
+                case 0x03:
+                    level = true;
+                    break;
+            }
+        }
+        add_span(length, level);
+    }
+}
+
+// CSW RLE: pulse lengths in samples, zero is followed by a 32 bit length.
+void Tape::add_csw(const u8 *data, size_t size, u32 rate){
+    u64 samples = 0, clk = 0;
+    size_t idx = 0;
+    while (idx < size){
+        u32 count = data[idx++];
+        if (!count){
+            if (idx + 4 > size)
+                break;
+            count = LE32(data + idx);
+            idx += 4;
+        }
+        samples += count;
+        u64 end = (u64)(samples * Z80_FREQ / rate);
+        add_pulse((u32)(end - clk));
+        clk = end;
+    }
+}
+
+// The data block ends at the current span.
+void Tape::add_block(const u8 *data, u32 size, bool rom){
+    Block block = { (u32)spans.size(), data, size, rom };
+    blocks.push_back(block);
+}
+
+void Tape::seek(u32 span){
+    pos = MIN(span, (u32)spans.size());
     time = 0;
-    last_clk = 0;
-    bit = 0;
-    pulse = 0;
-    state = SILENCE;
+    stop_idx = std::upper_bound(stops.begin(), stops.end(), pos) - stops.begin();
+    if (pos >= spans.size())
+        play_state = false;
+    pFE = (pos < spans.size() && (spans[pos] & SPAN_LEVEL)) ? 0xFF : ~EAR_IN;
+}
+
+void Tape::play(){
+    if (pos < spans.size())
+        play_state = true;
 }
 
 bool Tape::is_play(){
-    return state != STOP;
+    return play_state;
+}
+
+void Tape::get_state(Tape_State &state){
+    state.pos = pos;
+    state.time = time;
+    state.last_clk = last_clk;
+    state.play = play_state;
+}
+
+void Tape::set_state(const Tape_State &state){
+    seek(state.pos);
+    if (pos < spans.size()){
+        time = state.time;
+        play_state = state.play;
+    }
+    last_clk = state.last_clk;
 }
 
 void Tape::rewind_begin(){
-    idx = 0;
+    seek(0);
 }
 
 void Tape::stop(){
-    state = STOP;
+    play_state = false;
 }
 
-void Tape::update(s32 clk){
-    clk -= last_clk;
-    last_clk += clk;
-    time += clk;
-    while (time > state_wait[state]){
-        time -= state_wait[state];
-        switch(state){
-            case STOP:
-                break;
-            case SILENCE:
-                state = TONE;
-                break;
-            case TONE:
-                pFE ^= EAR_IN;
-                if (++pulse < TONE_PULSES)
-                    break;
-                pulse = 0;
-                state = SYNC_1;
-                break;
-            case SYNC_1:
-                pFE ^= EAR_IN;
-                state = SYNC_2;
-                break;
-            case SYNC_2:
-                pFE ^= EAR_IN;
-                block_end = p_data[idx++];
-                block_end |= p_data[idx++] << 8;
-                block_end += idx;
-                state = DATA;
-                break;
-            case DATA:
-                if (bit >= 8){
-                    bit &= 0x07;
-                    if (++idx >= block_end){
-                        if (idx >= data_size)
-                            state = STOP;
-                        else
-                            state = SILENCE;
-                        break;
-                    }
-                }
-                state = p_data[idx] & (0x80 >> bit++) ? ONE : ZERO;
+// The block the tape is in or before, if it's a standard one.
+int Tape::rom_block(){
+    std::vector<Block>::iterator it = std::upper_bound(blocks.begin(), blocks.end(), pos,
+        [](u32 span, const Block &block){ return span < block.end; });
+    if (it == blocks.end() || !it->rom)
+        return -1;
+    return it - blocks.begin();
+}
+
+// A standard block is at the tape or further on, the LD-BYTES trap is kept for it through the turbo ones.
+bool Tape::is_block(){
+    std::vector<Block>::iterator it = std::upper_bound(blocks.begin(), blocks.end(), pos,
+        [](u32 span, const Block &block){ return span < block.end; });
+    return std::find_if(it, blocks.end(), [](const Block &block){ return block.rom; }) != blocks.end();
+}
+
+// LD-BYTES replacement, the next block goes to memory at once. Returns like ROM does, CF is set on success.
+bool Tape::load_block(Z80_State &cpu, ULA *ula){
+    int idx = rom_block();
+    if (idx < 0)
+        return false;
+    const u8 *block = blocks[idx].data;
+    u32 size = blocks[idx].size;
+    seek(blocks[idx].end);
+    if (block[0] != cpu.a){
+        cpu.f &= ~CF;
+        return true;
+    }
+    u8 parity = block[0];
+    u32 read = 1;
+    bool verify = !(cpu.f & CF);
+    while (cpu.de && read < size){
+        u8 byte = block[read++];
+        parity ^= byte;
+        if (verify){
+            if (ula->read_byte(cpu.ix) != byte){
+                parity = 0xFF;
                 break;
-            case ONE:
-            case ZERO:
-                pFE ^= EAR_IN;
-                if (!pulse++)
-                    break;
-                pulse = 0;
-                state = DATA;
+            }
+        }else
+            ula->write_byte(cpu.ix, byte, cpu.clk);
+        cpu.ix++;
+        cpu.de--;
+    }
+    if (read < size) // Checksum.
+        parity ^= block[read];
+    cpu.h = parity;
+    cpu.l = block[read - 1];
+    if (!cpu.de && read < size && !parity){
+        cpu.a = 0x00;
+        cpu.f = SF | HF | NF | CF; // CP 0x01
+    }else{
+        cpu.a = parity;
+        cpu.f &= ~CF;
+    }
+    return true;
+}
+
+// Saved blocks are appended to the TAP file, by SA-BYTES trap or decoded from the MIC output.
+bool Tape::record(const char *path){
+    record_stop();
+    if (!(fp = fopen(path, "ab"))){
+        printf("WARN: Open tape record file.\n");
+        return false;
+    }
+    decoder = DEC_PILOT;
+    pilot_count = pilot_sum = 0;
+    return true;
+}
+
+void Tape::record_stop(){
+    if (!fp)
+        return;
+    decoder_flush();
+    fclose(fp);
+    fp = NULL;
+}
+
+// SA-BYTES replacement, the block goes to the file at once.
+bool Tape::save_block(Z80_State &cpu, ULA *ula){
+    if (!fp || cpu.de > 0xFFFF - 2) // The TAP length with the flag and parity bytes doesn't fit, the ROM saves it.
+        return false;
+    u32 size = cpu.de + 2;
+    fputc(size & 0xFF, fp);
+    fputc((size >> 8) & 0xFF, fp);
+    fputc(cpu.a, fp);
+    u8 parity = cpu.a;
+    while (cpu.de){
+        u8 byte = ula->read_byte(cpu.ix++);
+        parity ^= byte;
+        fputc(byte, fp);
+        cpu.de--;
+    }
+    fputc(parity, fp);
+    fflush(fp);
+    return true;
+}
+
+// MIC edges to bytes: a pilot tone, two sync pulses shorter than the pilot ones, then bits of two pulses.
+// Thresholds are relative to the pilot pulse, so custom savers with proportional timings are decoded too.
+void Tape::decode(u64 edge){
+    u64 pulse = edge - last_edge;
+    last_edge = edge;
+    u32 pilot = pilot_count ? pilot_sum / pilot_count : 0;
+    switch (decoder){
+        case DEC_PILOT:
+            if (pulse >= DECODER_PILOT_MIN && pulse <= DECODER_PILOT_MAX){
+                if (pilot_count && ABS((s64)pulse - pilot) > pilot / 4)
+                    pilot_count = pilot_sum = 0;
+                pilot_count++;
+                pilot_sum += pulse;
+            }else if (pilot_count >= DECODER_PILOT_PULSES && pulse < pilot * 2 / 3)
+                decoder = DEC_SYNC;
+            else
+                pilot_count = pilot_sum = 0;
+            break;
+        case DEC_SYNC:
+            if (pulse < pilot){
+                decoder = DEC_DATA;
+                decoded.clear();
+                half = 0;
+                bits = 0;
+            }else{
+                decoder = DEC_PILOT;
+                pilot_count = pilot_sum = 0;
+            }
+            break;
+        case DEC_DATA:
+            if (pulse > pilot * 2){ // Pause.
+                decoder_flush();
+                break;
+            }
+            if (!half){
+                half = pulse;
                 break;
+            }
+            if (!(bits & 0x07))
+                decoded.push_back(0x00);
+            if (half + pulse > pilot * 118 / 100) // 3420 and 1710 pairs of the ROM saver, 2168 pilot.
+                decoded.back() |= 0x80 >> (bits & 0x07);
+            half = 0;
+            bits++;
+            break;
+    }
+}
+
+// The decoded block is written if it has at least the flag and the checksum, the last partial byte is dropped.
+void Tape::decoder_flush(){
+    if (decoder == DEC_DATA && bits >= 16){
+        u32 size = bits / 8;
+        fputc(size & 0xFF, fp);
+        fputc((size >> 8) & 0xFF, fp);
+        fwrite(decoded.data(), 1, size, fp);
+        fflush(fp);
+    }
+    decoder = DEC_PILOT;
+    pilot_count = pilot_sum = 0;
+}
+
+// The clk the EAR level changes at, exact since spans of the same level are merged.
+s32 Tape::next_edge(s32 clk){
+    update(clk);
+    if (!play_state)
+        return INT_MAX;
+    s64 edge = (s64)last_clk + (spans[pos] & SPAN_LENGTH) - time;
+    return edge < INT_MAX ? (s32)edge : INT_MAX;
+}
+
+// Edge sampling loops of the ROM loader and its clones, IN A, (FE) is placed at "in" offset.
+// Iterations sampling the same EAR level are skipped at once, the CPU state is set as if they were run.
+s32 Tape::edge_skip(Z80_State &cpu, ULA *ula, u8 byte, s32 clk, s32 frame_clk){
+    static const struct {
+        s16 code[13];                                       // -1 is any byte.
+        int size;
+        int in;
+        int clk;
+        int opcodes;
+        bool break_check;
+    } loop[] = {
+        // INC B; RET Z; LD A, N; IN A, (FE); RRA; RET NC; XOR C; AND 20; JR Z, loop
+        { { 0x04, 0xC8, 0x3E, -1, 0xDB, 0xFE, 0x1F, 0xD0, 0xA9, 0xE6, 0x20, 0x28, 0xF3 }, 13, 4, 59, 9, true },
+        // INC B; RET Z; LD A, N; IN A, (FE); RRA; XOR C; AND 20; JR Z, loop
+        { { 0x04, 0xC8, 0x3E, -1, 0xDB, 0xFE, 0x1F, 0xA9, 0xE6, 0x20, 0x28, 0xF4 }, 12, 4, 54, 8, false }
+    };
+    for (unsigned int i = 0; i < sizeof(loop) / sizeof(loop[0]); i++){
+        u16 ptr = cpu.pc - 2 - loop[i].in;
+        int j = 0;
+        while (j < loop[i].size && (loop[i].code[j] < 0 || ula->read_byte(ptr + j) == loop[i].code[j]))
+            j++;
+        if (j < loop[i].size)
+            continue;
+        if ((loop[i].break_check && !(byte & 0x01)) || (((byte >> 1) ^ cpu.c) & 0x20))
+            return 0; // The loop exits on this sample.
+        s32 edge = MIN(next_edge(clk), frame_clk);
+        s32 count = MIN((edge - 1 - clk) / loop[i].clk, 0xFF - cpu.b);
+        if (count <= 0)
+            return 0;
+        cpu.b += count;
+        cpu.irl += count * loop[i].opcodes;
+        // Flags of INC B, the carry was reset by AND of the previous iteration.
+        cpu.f = (cpu.b & (SF | F5 | F3)) | (cpu.b ? 0 : ZF) | ((cpu.b & 0x0F) ? 0 : HF) | (cpu.b == 0x80 ? PF : 0);
+        cpu.clk += count * loop[i].clk;
+        return count * loop[i].clk;
+    }
+    return 0;
+}
+
+// Moves the cursor along the spans, an edge costs a step.
+void Tape::update(s32 clk){
+    if (clk <= last_clk)
+        return;
+    u32 passed = clk - last_clk;
+    last_clk = clk;
+    if (!play_state)
+        return;
+    time += passed;
+    while (time >= (spans[pos] & SPAN_LENGTH)){
+        time -= spans[pos] & SPAN_LENGTH;
+        if (++pos >= spans.size()){
+            play_state = false;
+            time = 0;
+            break;
+        }
+        if (stop_idx < stops.size() && pos == stops[stop_idx]){
+            stop_idx++;
+            play_state = false;
+            time = 0;
+            break;
         }
     }
+    pFE = (pos < spans.size() && (spans[pos] & SPAN_LEVEL)) ? 0xFF : ~EAR_IN;
 }
 
 void Tape::frame(s32 clk){
     update(clk);
     last_clk -= clk;
+    record_clk += clk;
+    if (fp && decoder == DEC_DATA && record_clk - last_edge > pilot_sum / pilot_count * 4)
+        decoder_flush(); // The saver is done.
 }
 
 void Tape::read(u16 port, u8 *byte, s32 clk){
@@ -134,3 +697,10 @@ void Tape::read(u16 port, u8 *byte, s32 clk){
     }
 }
 
+void Tape::write(u16 port, u8 byte, s32 clk){
+    if (!(port & 0x01)){
+        if (fp && ((wFE ^ byte) & MIC_OUT))
+            decode(record_clk + clk);
+        wFE = byte;
+    }
+}
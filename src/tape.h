@@ -1,43 +1,115 @@
-#define SILENCE_TIME                (int)(Z80_FREQ * 1.0)
+// Standard ROM loader timings.
+#define PAUSE_TIME                  (int)(Z80_FREQ * 1.0)
 #define TONE_PERIOD                 2168
-#define TONE_PULSES                 (int)(3223 * 2.0)
+#define HEADER_PULSES               8063
+#define DATA_PULSES                 3223
+#define SYNC_1_PERIOD               667
+#define SYNC_2_PERIOD               735
 #define ONE_PERIOD                  1710
 #define ZERO_PERIOD                 855
 #define EAR_IN                      0b1000000
+#define MIC_OUT                     0b0001000
+#define TAPE_MSEC                   (Z80_FREQ / 1000)
+// 48K ROM tape routines replaced by traps.
+#define LD_BYTES                    0x0556                  // A - flag, IX - address, DE - length, CF - load/verify.
+#define SA_BYTES                    0x04C2                  // A - flag, IX - address, DE - length.
+#define BORDCR                      0x5C48                  // System variable, border color in bits 3-5.
+// Save decoder, MIC pulses of the ROM saver or a custom one with proportional timings.
+#define DECODER_PILOT_MIN           1000
+#define DECODER_PILOT_MAX           4000
+#define DECODER_PILOT_PULSES        256
+
+// The tape image is compiled at load time into spans of constant EAR level.
+#define SPAN_LEVEL                  0x80000000
+#define SPAN_LENGTH                 0x7FFFFFFF
+
+#pragma pack(1)
+struct CSW_Header {
+    char signature[22];                                     // "Compressed Square Wave"
+    u8 terminator;                                          // 0x1A
+    u8 major;
+    u8 minor;
+};
+#pragma pack()
+
+#pragma pack(1)
+struct Tape_State {                                         // Position in the compiled spans of the loaded image.
+    u32 pos;
+    u32 time;
+    s32 last_clk;
+    u8 play;
+};
+#pragma pack()
 
 class Tape : public Device {
+    struct Block {                                          // Data block, loadable by LD-BYTES trap if "rom" is set.
+        u32 end;                                            // The span after the data.
+        const u8 *data;
+        u32 size;
+        bool rom;
+    };
+    enum Decoder { DEC_PILOT, DEC_SYNC, DEC_DATA };
     public:
-        enum STATE { STOP, SILENCE, TONE, SYNC_1, SYNC_2, DATA, ONE, ZERO };
         Tape();
         ~Tape();
-        bool load_tap(const char *p_path);
+        bool load_tap(const char *path);
+        bool load_tzx(const char *path);
+        bool load_csw(const char *path);
         void rewind_begin();
+        void seek(u32 span);
         void play();
         void stop();
         bool is_play();
+        void get_state(Tape_State &state);
+        void set_state(const Tape_State &state);
+        bool is_block();
+        bool load_block(Z80_State &cpu, ULA *ula);
+        bool record(const char *path);
+        void record_stop();
+        bool is_record() { return fp != NULL; };
+        bool save_block(Z80_State &cpu, ULA *ula);
+        s32 next_edge(s32 clk);
+        s32 edge_skip(Z80_State &cpu, ULA *ula, u8 byte, s32 clk, s32 frame_clk);
         void update(s32 clk);
         void frame(s32 clk);
         void read(u16 port, u8 *byte, s32 clk);
+        void write(u16 port, u8 byte, s32 clk);
     private:
-        FILE *p_file;
-        STATE state;
-        int last_clk;
-        int time;
-        int idx;
-        int block_end;
-        int bit;
-        int pulse;
-        const int state_wait[8] = {
-            SILENCE_TIME,
-            SILENCE_TIME,
-            TONE_PERIOD,
-            667,
-            735,
-            0,
-            ONE_PERIOD,
-            ZERO_PERIOD
-        };
-        unsigned char *p_data;
-        int data_size;
-        unsigned char pFE;
+        void clear();
+        void add_span(u32 length, bool state);
+        void add_pulse(u32 length);
+        void add_tone(u32 length, u32 pulses);
+        void add_pause(u32 msec);
+        void add_data(const u8 *data, u32 size, u32 zero, u32 one, int last_bits);
+        void add_standard(const u8 *data, u32 size);
+        void add_symbol(const u8 *symbol, int pulses);
+        void add_csw(const u8 *data, size_t size, u32 rate);
+        void add_block(const u8 *data, u32 size, bool rom);
+        void parse_tzx(const u8 *data, size_t size);
+        int rom_block();
+        void decode(u64 edge);
+        void decoder_flush();
+
+        File_Map file;
+        std::vector<u32> spans;                             // Length in clk and level of EAR.
+        std::vector<Block> blocks;
+        std::vector<u32> stops;                             // Span to stop the tape at.
+        bool level;                                         // The level of the last pulse.
+        bool play_state;
+        u32 pos;                                            // Current span.
+        u32 stop_idx;                                       // The next stop.
+        u32 time;                                           // Time passed in the current span.
+        s32 last_clk;
+        u8 pFE;
+        // Save capture.
+        FILE *fp = NULL;
+        Decoder decoder;
+        std::vector<u8> decoded;
+        u64 record_clk;                                     // Frame start.
+        u64 last_edge;
+        u32 pilot_count;
+        u32 pilot_sum;
+        u32 half;                                           // The first pulse of a bit.
+        int bits;
+        u8 wFE;
 };
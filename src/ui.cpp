@@ -3,6 +3,12 @@
 #include <stdexcept>
 #include <stdio.h>
 #include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <deque>
+#include <string>
 #include <GL/glew.h>
 #include <SDL.h>
 #include <SDL_image.h>
@@ -20,15 +26,24 @@
 #include "memory.h"
 #include "ula.h"
 #include "z80.h"
-#include "snapshot.h"
+#include "filemap.h"
+#include "disk.h"
 #include "floppy.h"
+#include "divmmc.h"
 #include "keyboard.h"
 #include "joystick.h"
 #include "tape.h"
+#include "recorder.h"
 #include "sound.h"
+#include "snapshot.h"
+#include "movie.h"
+#include "netplay.h"
+#include "gdb.h"
 #include "mouse.h"
+#include "rewind.h"
 #include "board.h"
 #include "ui.h"
+#include "frontend.h"
 
 #define LABEL_WIDTH                       140
 #define KBD_IMAGE_PATH                    "data/kbd_layout.png"
@@ -107,6 +122,9 @@ namespace UI {
                     case SDLK_F4:
                         open(UI_Settings);
                         break;
+                    case SDLK_F10:
+                        open(UI_DiskCatalog);
+                        break;
 #ifdef DEBUGGER
                     case SDLK_F9:
                         open(UI_Debugger);
@@ -159,7 +177,7 @@ namespace UI {
             case UI_OpenFile:
                 SetNextWindowPos(ImVec2(io.DisplaySize.x*0.5f, io.DisplaySize.y*0.5f), ImGuiCond_Always, ImVec2(0.5f, 0.5f));
                 SetNextWindowSize(ImVec2(io.DisplaySize.x*(0.85f-(1.0f-SCREEN_WIDTH/io.DisplaySize.x)*0.5f), io.DisplaySize.y*(0.75f-(1.0f-SCREEN_HEIGHT/io.DisplaySize.y)*0.5f)), ImGuiCond_Always);
-                ImGuiFileDialog::Instance()->OpenDialog("##file_dlg", "Open file", ".z80;.tap;.trd;.scl {(([.]z80|Z80|trd|TRD|scl|SCL|tap|TAP))}", file_config);
+                ImGuiFileDialog::Instance()->OpenDialog("##file_dlg", "Open file", ".z80;.sna;.szx;.zxm;.tap;.tzx;.csw;.trd;.scl;.udi;.fdi;.td0;.img {(([.]z80|Z80|sna|SNA|szx|SZX|zxm|ZXM|trd|TRD|scl|SCL|udi|UDI|fdi|FDI|td0|TD0|img|IMG|tap|TAP|tzx|TZX|csw|CSW))}", file_config);
                 if (ImGuiFileDialog::Instance()->Display("##file_dlg", UI_WindowFlags)){
                     if (ImGuiFileDialog::Instance()->IsOk())
                         board->load_file(ImGuiFileDialog::Instance()->GetFilePathName().c_str());
@@ -170,7 +188,7 @@ namespace UI {
             case UI_SaveFile:
                 SetNextWindowPos(ImVec2(io.DisplaySize.x*0.5f, io.DisplaySize.y*0.5f), ImGuiCond_Always, ImVec2(0.5f, 0.5f));
                 SetNextWindowSize(ImVec2(io.DisplaySize.x*(0.85f-(1.0f-SCREEN_WIDTH/io.DisplaySize.x)*0.5f), io.DisplaySize.y*(0.75f-(1.0f-SCREEN_HEIGHT/io.DisplaySize.y)*0.5f)), ImGuiCond_Always);
-                ImGuiFileDialog::Instance()->OpenDialog("##file_dlg", "Save file", ".z80;.trd; {(([.]z80|Z80|trd|TRD))}", file_config);
+                ImGuiFileDialog::Instance()->OpenDialog("##file_dlg", "Save file", ".z80;.sna;.szx;.zxm;.trd;.tap;.wav;.psg {(([.]z80|Z80|sna|SNA|szx|SZX|zxm|ZXM|trd|TRD|tap|TAP|wav|WAV|psg|PSG))}", file_config);
                 if (ImGuiFileDialog::Instance()->Display("##file_dlg", UI_WindowFlags)){
                     if (ImGuiFileDialog::Instance()->IsOk())
                         board->save_file(ImGuiFileDialog::Instance()->GetFilePathName().c_str());
@@ -178,6 +196,30 @@ namespace UI {
                     hide();
                 }
                 break;
+            case UI_DiskCatalog:
+                static std::vector<TRD_File> files;
+                static char disk_label[9];
+                SetNextWindowPos(ImVec2(io.DisplaySize.x*0.5f, io.DisplaySize.y*0.5f), ImGuiCond_Always, ImVec2(0.5f, 0.5f));
+                SetNextWindowSize(ImVec2(320.0f, 0.0f), ImGuiCond_Always);
+                if (Begin("Disk A", NULL, UI_WindowFlags | ImGuiWindowFlags_AlwaysAutoResize)){
+                    if (!board->disk_catalog(files, disk_label)){
+                        TextUnformatted("No TR-DOS disk.");
+                    }else{
+                        SeparatorText(disk_label);
+                        for (int i = 0; i < (int)files.size(); i++){
+                            PushID(i);
+                            if (Selectable(files[i].name, false, 0, ImVec2(CalcTextSize("A").x*10, 0))){
+                                board->disk_run(files[i]);
+                                hide();
+                            }
+                            SameLine();
+                            Text("%c %5u %5u", files[i].type, files[i].start, files[i].length);
+                            PopID();
+                        }
+                    }
+                    End();
+                }
+                break;
             case UI_Settings:
                 static int load_rom = -1;
                 static const char *label[sizeof(ROM_Bank)] = { "Rom TR-Dos", "Rom 128", "Rom 48" };
@@ -196,8 +238,41 @@ namespace UI {
                                 board->reset();
                             }
                             SetCursorPosX(LABEL_WIDTH);
+                            if (Checkbox("DivMMC", &cfg.main.divmmc)){
+                                board->set_divmmc(cfg.main.divmmc);
+                                board->reset();
+                            }
+                            SetCursorPosX(LABEL_WIDTH);
                             if (Checkbox("Full speed", &cfg.main.full_speed))
-                                board->set_vsync(cfg.video.vsync & !cfg.main.full_speed);
+                                Frontend::set_vsync(cfg.video.vsync & !cfg.main.full_speed);
+                            Text("Fast forward");
+                            SameLine(LABEL_WIDTH);
+                            SetNextItemWidth(-FLT_MIN);
+                            if (Combo("##fast_forward", &cfg.main.fast_forward, "Off\0x2\0x4\0x8\0\0"))
+                                board->set_fast_forward(cfg.main.fast_forward);
+                            SetCursorPosX(LABEL_WIDTH);
+                            if (Checkbox("Fast disk", &cfg.main.fast_disk))
+                                board->set_fast_disk(cfg.main.fast_disk);
+                            SetCursorPosX(LABEL_WIDTH);
+                            Checkbox("Auto turbo", &cfg.main.auto_turbo);
+                            Text("Turbo frames");
+                            SameLine(LABEL_WIDTH);
+                            SetNextItemWidth(-FLT_MIN);
+                            SliderInt("##turbo_frames", &cfg.main.turbo_frames, 2, AUTO_TURBO_FRAMES_MAX);
+                            SetCursorPosX(LABEL_WIDTH);
+                            if (Checkbox("Tape traps", &cfg.main.tape_traps))
+                                board->update_traps();
+                            SetCursorPosX(LABEL_WIDTH);
+                            Checkbox("Edge loading", &cfg.main.edge_loading);
+                            Text("Run ahead");
+                            SameLine(LABEL_WIDTH);
+                            SetNextItemWidth(-FLT_MIN);
+                            SliderInt("##run_ahead", &cfg.main.run_ahead, 0, RUN_AHEAD_MAX);
+                            Text("Rewind, MB");
+                            SameLine(LABEL_WIDTH);
+                            SetNextItemWidth(-FLT_MIN);
+                            if (SliderInt("##rewind_size", &cfg.main.rewind_size, 0, REWIND_SIZE_MAX))
+                                board->set_rewind(cfg.main.rewind_size);
                             SeparatorText("BIOS");
                             for (int i = 0; i < (int)sizeof(ROM_Bank) - 1; i++){
                                 TextUnformatted(label[i]);
@@ -232,6 +307,10 @@ namespace UI {
                             if (Button("Defaults", btn_size)){
                                 memcpy(&cfg.main, &Config::get_defaults().main, sizeof(Cfg::main));
                                 board->setup((Hardware)cfg.main.model);
+                                board->set_fast_forward(cfg.main.fast_forward);
+                                board->set_fast_disk(cfg.main.fast_disk);
+                                board->set_divmmc(cfg.main.divmmc);
+                                board->set_rewind(cfg.main.rewind_size);
                                 board->reset();
                             }
                             EndTabItem();
@@ -246,7 +325,7 @@ namespace UI {
                             if (!cfg.video.full_screen){
                                 if (Combo("##screen_size", &screen_size, "640x480\0""960x720\0""1280x960\0""1600x1200\0\0"))
                                     if (screen_size >= 0 && screen_size <= 3)
-                                        board->set_window_size(SCREEN_WIDTH+DISPLAY_WIDTH*screen_size, SCREEN_HEIGHT+DISPLAY_HEIGHT*screen_size);
+                                        Frontend::set_window_size(cfg, SCREEN_WIDTH+DISPLAY_WIDTH*screen_size, SCREEN_HEIGHT+DISPLAY_HEIGHT*screen_size);
                             }else{
                                 BeginDisabled();
                                 Combo("##screen_size", &screen_size, "640x480\0""960x720\0""1280x960\0""1600x1200\0\0");
@@ -255,15 +334,15 @@ namespace UI {
 
                             SetCursorPosX(LABEL_WIDTH);
                             if (Checkbox("Full screen", &cfg.video.full_screen))
-                                board->set_full_screen(cfg.video.full_screen);
+                                Frontend::set_full_screen(cfg, cfg.video.full_screen);
                             SeparatorText("Display");
                             Text("Type");
                             SameLine(LABEL_WIDTH);
                             if (RadioButton("LCD", &cfg.video.filter, Nearest))
-                                board->set_texture_filter(Nearest);
+                                Frontend::set_texture_filter(Nearest);
                             SameLine();
                             if (RadioButton("CRT", &cfg.video.filter, Linear))
-                                board->set_texture_filter(Linear);
+                                Frontend::set_texture_filter(Linear);
                             SetCursorPosX(LABEL_WIDTH);
                             if (cfg.main.full_speed){
                                 bool value = false;
@@ -272,15 +351,15 @@ namespace UI {
                                 EndDisabled();
                             }else
                                 if (Checkbox("V-Sync", &cfg.video.vsync))
-                                    board->set_vsync(cfg.video.vsync);
+                                    Frontend::set_vsync(cfg.video.vsync);
                             Spacing();
                             SetCursorPosX(GetWindowWidth()-btn_size.x-style.WindowPadding.x);
                             if (Button("Defaults", btn_size)){
                                 memcpy(&cfg.video, &Config::get_defaults().video, sizeof(Cfg::video));
-                                board->set_window_size(SCREEN_WIDTH, SCREEN_HEIGHT);
-                                board->set_full_screen(cfg.video.full_screen);
-                                board->set_texture_filter((Filter)cfg.video.filter);
-                                board->set_vsync(cfg.video.vsync);
+                                Frontend::set_window_size(cfg, SCREEN_WIDTH, SCREEN_HEIGHT);
+                                Frontend::set_full_screen(cfg, cfg.video.full_screen);
+                                Frontend::set_texture_filter((Filter)cfg.video.filter);
+                                Frontend::set_vsync(cfg.video.vsync);
                             }
                             EndTabItem();
                         }
@@ -373,6 +452,10 @@ namespace UI {
 #endif
                 break;
         }
+        if (board->is_turbo()){
+            static const char *turbo_label = "TURBO";
+            GetForegroundDrawList()->AddText(ImVec2(io.DisplaySize.x - CalcTextSize(turbo_label).x - style.WindowPadding.x, style.WindowPadding.y), IM_COL32(255, 255, 0, 200), turbo_label);
+        }
 #ifdef STYLE_EDITOR
         ShowStyleEditor();
 #endif
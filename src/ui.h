@@ -3,7 +3,7 @@
     ImGuiWindowFlags_NoResize
 
 namespace UI {
-    enum UI_Mode { UI_None, UI_Exit, UI_KbdLayout, UI_OpenFile, UI_SaveFile, UI_Settings, UI_Debugger };
+    enum UI_Mode { UI_None, UI_Exit, UI_KbdLayout, UI_OpenFile, UI_SaveFile, UI_Settings, UI_DiskCatalog, UI_Debugger };
     void setup(Cfg &cfg, SDL_Window *window, SDL_GLContext context, const char *glsl_version);
     bool frame(Cfg &cfg, Board *board);
     bool event(SDL_Event &event);
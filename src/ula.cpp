@@ -53,15 +53,17 @@ void ULA::update(s32 clk){
     while (update_clk < clk){
         int offset = update_clk - table[idx].clk;
         int limit = offset + MIN(clk, table[idx].clk + table[idx].len) - update_clk;
-        if (table[idx].type == Border){
+        if (!frame_buffer){
+            // Not displayed, only the beam goes on for the floating bus.
+        }else if (table[idx].type == Border){
             u32 color = palette[border_color]; // GCC not optimize this in loop body. Clang is ok.
             for (; offset < limit; offset++){
                 frame_buffer[offset * 2] = color;
                 frame_buffer[offset * 2 + 1] = color;
             }
         }else{
-            u8 *color = &display_page[table[idx].color + (offset >> 2)];
-            u8 *pixel = &display_page[table[idx].pixel + (offset >> 2)];
+            u8 *color = &(*display_page)[table[idx].color + (offset >> 2)];
+            u8 *pixel = &(*display_page)[table[idx].pixel + (offset >> 2)];
             while (offset < limit){
                 void *src = &pixel_table[(((*color++ & flash_mask) << 8) | *pixel++) << 3];
                 do {
@@ -72,7 +74,8 @@ void ULA::update(s32 clk){
         if (limit < table[idx].len)
             update_clk = clk;
         else{
-            frame_buffer += table[idx].len*2;
+            if (frame_buffer)
+                frame_buffer += table[idx].len*2;
             update_clk = table[++idx].clk;
         }
     }
@@ -87,14 +90,45 @@ void ULA::frame(s32 frame_clk){
     idx = 0;
 }
 
+// The frame is drawn from the memory as it is, no time passes for the emulation.
+void ULA::redraw(u16 *buffer, s32 frame_clk){
+    frame_buffer = buffer;
+    update(frame_clk);
+    update_clk = table[0].clk;
+    frame_buffer = NULL;
+    idx = 0;
+}
+
 void ULA::reset(){
     Memory::reset();
-    display_page = Memory::port_7FFD & ULA_PAGE5 ? Memory::ram[7] : Memory::ram[5];
+    display_page = Memory::port_7FFD & ULA_PAGE5 ? &Memory::ram[7] : &Memory::ram[5];
     border_color = 0x07;
     update_clk = table[0].clk;
     idx = 0;
 }
 
+void ULA::get_state(ULA_State &state){
+    state.p7ffd = Memory::port_7FFD;
+    state.border = border_color;
+    state.frame_count = frame_count;
+    state.flash_mask = flash_mask;
+    state.screen = display_page == &Memory::ram[7] ? 7 : 5;
+    state.rom = ROM_128;
+    for (unsigned int i = 0; i < sizeof(ROM_Bank); i++)
+        if ((overlay ? rom_rd : page_rd[0]) == rom[i])
+            state.rom = i;
+}
+
+void ULA::set_state(const ULA_State &state){
+    Memory::write(0x7FFD, state.p7ffd, 0);
+    border_color = state.border & 0x07;
+    frame_count = state.frame_count;
+    flash_mask = state.flash_mask;
+    display_page = state.screen == 7 ? &Memory::ram[7] : &Memory::ram[5];
+    if (!overlay && state.rom < sizeof(ROM_Bank))
+        page_rom((ROM_Bank)state.rom);
+}
+
 void ULA::write(u16 port, u8 byte, s32 clk){
     Memory::write(port, byte, clk);
     if (!(port & 0x01)){
@@ -108,7 +142,7 @@ void ULA::write(u16 port, u8 byte, s32 clk){
             //    return;
             if ((Memory::port_7FFD ^ byte) & ULA_PAGE5){
                 update(clk);
-                display_page = !(byte & ULA_PAGE5) ? Memory::ram[5] : Memory::ram[7];
+                display_page = !(byte & ULA_PAGE5) ? &Memory::ram[5] : &Memory::ram[7];
             }
         }
     }
@@ -118,6 +152,6 @@ void ULA::read(u16 port, u8 *byte, s32 clk){
     if ((port & 0xFF) == 0xFF){
         update(clk);
         if (table[idx].type == Paper && clk >= table[idx].clk && clk < table[idx].clk + table[idx].len)
-            *byte = display_page[table[idx].color + (clk - table[idx].clk) / 4];
+            *byte = (*display_page)[table[idx].color + (clk - table[idx].clk) / 4];
     }
 }
@@ -50,6 +50,17 @@ inline unsigned short RGB565(float r, float g, float b){
         ((unsigned short)(0x1F*b)));
 }
 
+#pragma pack(1)
+struct ULA_State {                                          // Paging and raster phase between frames.
+    u8 p7ffd;
+    u8 border;
+    s32 frame_count;
+    u8 flash_mask;
+    u8 screen;                                              // RAM page displayed.
+    u8 rom;                                                 // ROM bank at 0x0000, it's not always the one 7FFD selects.
+};
+#pragma pack()
+
 class ULA : public Memory {
     enum Type { Border = 0x00, Paper = 0x01, Last = 0x02};
     struct Table {
@@ -63,9 +74,13 @@ class ULA : public Memory {
         ULA();
         inline void write_byte(u16 ptr, u8 byte, s32 clk){
             update(clk);
+            if (cow >> (ptr >> 0x0E) & 0x01)
+                unshare_slot(ptr >> 0x0E);
             page_wr[ptr >> 0x0E][ptr] = byte;
+            page_dirty[ptr >> 0x0E][ptr >> DIRTY_SHIFT] = 1;
         }
         void frame_setup(u16 *buffer) { frame_buffer = buffer; };
+        void redraw(u16 *buffer, s32 frame_clk);
         void update(s32 clk);
 
         void read(u16 port, u8 *byte, s32 clk);
@@ -74,12 +89,14 @@ class ULA : public Memory {
         void reset();
 
         u8 get_border_color() { return border_color & 0x07; };
+        void get_state(ULA_State &state);
+        void set_state(const ULA_State &state);
     private:
         s32 update_clk = 0;
         s32 idx = 0;
         Table table[DISPLAY_HEIGHT*4];
         u16 border_color;
-        u8 *display_page = NULL;
+        u8 **display_page = NULL;                           // RAM page slot, the page is moved as it's unshared.
         u8 flash_mask = 0x7F;
         u16 palette[0x10];
         u16 pixel_table[0x10000*8];
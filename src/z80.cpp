@@ -131,12 +131,10 @@ void Z80::NMI(){
 void Z80::step_over(ULA *memory, IO *io, s32 frame_clk){
 }
 
+// One instruction, the interrupt at the frame end is left to the frame.
 void Z80::step_into(ULA *memory, IO *io, s32 frame_clk){
-    frame(memory, io, clk);
-    if (clk > frame_clk){
-        interrupt(memory);
-        clk -= frame_clk;
-    }
+    if (clk < frame_clk)
+        frame(memory, io, clk + 1);
 }
 
 void Z80::frame(ULA *memory, IO *io, s32 frame_clk){
@@ -440,8 +438,10 @@ void Z80::frame(ULA *memory, IO *io, s32 frame_clk){
                 if (memory->trap_trdos(pc - 1)){
                     pc--;
                     irl--;
-                }else
+                }else{
+                    io->trap(pc - 1);
                     time(4);
+                }
                 break;
             case 0x5C: // LD E, H
                 LD_R_R(e, h);
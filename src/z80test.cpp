@@ -0,0 +1,270 @@
+#include <cstddef>
+#include <limits.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include <string>
+#include "types.h"
+#include "utils.h"
+#include "config.h"
+#include "device.h"
+#include "memory.h"
+#include "ula.h"
+#include "z80.h"
+#include "filemap.h"
+#include "z80test.h"
+
+#define FUSE_REGISTERS              13                      // AF BC DE HL AF' BC' DE' HL' IX IY SP PC MEMPTR
+
+struct Fuse_State {
+    u32 regs[FUSE_REGISTERS];
+    u32 i, r, iff1, iff2, im, halted, tstates;
+};
+
+class Test_IO : public IO {
+    public:
+        Test_IO(ULA *memory, Z80 *cpu) : memory(memory), cpu(cpu) {};
+        void read(u16 port, u8 *byte, s32 clk=0) { *byte = port >> 8; };
+        bool trap(u16 pc);
+        bool done = false;
+        int errors = 0;
+    private:
+        void put(char c);
+
+        ULA *memory;
+        Z80 *cpu;
+        std::string line;
+};
+
+// Warm boot at 0x0000 ends the program, the BDOS calls go to the console.
+bool Test_IO::trap(u16 pc){
+    if (pc == 0x0000){
+        done = true;
+        return true;
+    }
+    if (pc != Z80TEST_BDOS)
+        return false;
+    if (cpu->c == 2)
+        put(cpu->e);
+    else if (cpu->c == 9)
+        for (u16 addr = cpu->de; addr != Z80TEST_BDOS && memory->read_byte(addr) != '$'; addr++)
+            put(memory->read_byte(addr));
+    return true;
+}
+
+void Test_IO::put(char c){
+    putchar(c);
+    if (c != '\n'){
+        line += c;
+        return;
+    }
+    errors += line.find("ERROR") != std::string::npos;
+    line.clear();
+    fflush(stdout);
+}
+
+static u16* get_register(Z80 *cpu, int idx){
+    u16 *regs[FUSE_REGISTERS] = { &cpu->af, &cpu->bc, &cpu->de, &cpu->hl, &cpu->alt.af, &cpu->alt.bc, &cpu->alt.de, &cpu->alt.hl,
+                                  &cpu->ix, &cpu->iy, &cpu->sp, &cpu->pc, &cpu->memptr };
+    return regs[idx];
+}
+
+// The overlay page takes 0x0000-0x3FFF, the RAM pages 5, 2, 0 are the rest as 7FFD is never written.
+// The 48K ROM is the main one, the TR-DOS one would execute its trap page above 0x3FFF.
+static ULA* flat_memory(u8 *page){
+    ULA *memory = new ULA();
+    memory->set_main_rom(ROM_48);
+    memory->reset();
+    memory->map_overlay(page, true);
+    return memory;
+}
+
+int Z80_Test::run_cpm(const char *path){
+    File_Map file;
+    if (!file.open(path) || file.size() > Z80TEST_BDOS - 0x0100){
+        printf("WARN: Load CP/M program %s.\n", path);
+        return 1;
+    }
+    u8 *page = new u8[PAGE_SIZE]();
+    ULA *memory = flat_memory(page);
+    Z80 *cpu = new Z80();
+    Test_IO io(memory, cpu);
+    for (size_t i = 0; i < file.size(); i++)
+        memory->write_byte(0x0100 + i, file.data()[i], 0);
+    // 0x0000: trap, HALT; 0x0005: JP BDOS, the programs take the memory top from 0x0006; BDOS: trap, RET.
+    static const u8 boot[] = { TRAP_BYTE, 0x76, 0x00, 0x00, 0x00, 0xC3, Z80TEST_BDOS & 0xFF, Z80TEST_BDOS >> 8 };
+    for (size_t i = 0; i < sizeof(boot); i++)
+        memory->write_byte(i, boot[i], 0);
+    memory->write_byte(Z80TEST_BDOS, TRAP_BYTE, 0);
+    memory->write_byte(Z80TEST_BDOS + 1, 0xC9, 0);
+    cpu->pc = 0x0100;
+    cpu->sp = Z80TEST_BDOS - 2;                             // RET from the program is the warm boot.
+    memory->write_byte(cpu->sp, 0x00, 0);
+    memory->write_byte(cpu->sp + 1, 0x00, 0);
+    cpu->iff1 = cpu->iff2 = 0;
+    u64 clk = 0;
+    u64 fetches = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (!io.done){
+        u8 r = cpu->irl;
+        s32 slice_clk = cpu->clk;
+        cpu->frame(memory, &io, cpu->clk + Z80TEST_SLICE);
+        fetches += (cpu->irl - r) & 0x7F;
+        clk += cpu->clk - slice_clk;
+        if (cpu->clk >= Z80TEST_FRAME){
+            cpu->clk -= Z80TEST_FRAME;
+            memory->frame(Z80TEST_FRAME);
+        }
+    }
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    printf("\nCP/M %s: %llu T-states in %.1f s, %.1f MHz, %.1f MIPS, %d errors.\n", path, (unsigned long long)clk, us / 1000000,
+           us > 0 ? clk / us : 0, us > 0 ? fetches / us : 0, io.errors);
+    int errors = io.errors;
+    DELETE(cpu);
+    DELETE(memory);
+    DELETE_ARRAY(page);
+    return errors ? 1 : 0;
+}
+
+static bool read_line(FILE *fp, char *line, size_t size){
+    if (!fgets(line, size, fp))
+        return false;
+    line[strcspn(line, "\r\n")] = 0x00;
+    return true;
+}
+
+static bool read_state(FILE *fp, Fuse_State &state){
+    char line[256];
+    u32 *r = state.regs;
+    return read_line(fp, line, sizeof(line)) &&
+           sscanf(line, "%x %x %x %x %x %x %x %x %x %x %x %x %x", &r[0], &r[1], &r[2], &r[3], &r[4], &r[5], &r[6], &r[7], &r[8], &r[9], &r[10], &r[11], &r[12]) == FUSE_REGISTERS &&
+           read_line(fp, line, sizeof(line)) &&
+           sscanf(line, "%x %x %u %u %u %u %u", &state.i, &state.r, &state.iff1, &state.iff2, &state.im, &state.halted, &state.tstates) == 7;
+}
+
+// "addr byte byte ... -1" lines, up to a "-1" one in tests.in, up to the blank one in tests.expected.
+static void read_memory(FILE *fp, std::vector<std::pair<u16, u8>> &bytes){
+    char line[1024];
+    while (read_line(fp, line, sizeof(line)) && line[0] && strncmp(line, "-1", 2)){
+        char *src = line, *end;
+        u16 addr = strtoul(src, &end, 16);
+        for (src = end; ; src = end){
+            long byte = strtol(src, &end, 16);
+            if (end == src || byte < 0)
+                break;
+            bytes.push_back(std::make_pair(addr++, (u8)byte));
+        }
+    }
+}
+
+static std::string compare(Z80 *cpu, ULA *memory, const Fuse_State &state, const std::vector<std::pair<u16, u8>> &bytes){
+    static const char *names[FUSE_REGISTERS] = { "AF", "BC", "DE", "HL", "AF'", "BC'", "DE'", "HL'", "IX", "IY", "SP", "PC", "MEMPTR" };
+    std::string out;
+    char text[64];
+    // The core keeps the PC on the HALT while halted, FUSE has it past the opcode.
+    u16 pc = cpu->pc;
+    if (state.halted && memory->read_byte(pc) == 0x76)
+        cpu->pc++;
+    for (int i = 0; i < FUSE_REGISTERS; i++)
+        if (*get_register(cpu, i) != state.regs[i]){
+            snprintf(text, sizeof(text), " %s %04x (%04x)", names[i], *get_register(cpu, i), state.regs[i]);
+            out += text;
+        }
+    cpu->pc = pc;
+    u8 r = (cpu->irl & 0x7F) | (cpu->r8bit & 0x80);
+    u32 got[] = { cpu->irh, r, cpu->iff1 != 0, cpu->iff2 != 0, cpu->im, (u32)cpu->clk };
+    u32 expected[] = { state.i, state.r, state.iff1, state.iff2, state.im, state.tstates };
+    static const char *fields[] = { "I", "R", "IFF1", "IFF2", "IM", "T-states" };
+    for (size_t i = 0; i < sizeof(got) / sizeof(got[0]); i++)
+        if (got[i] != expected[i]){
+            snprintf(text, sizeof(text), " %s %u (%u)", fields[i], got[i], expected[i]);
+            out += text;
+        }
+    for (const auto &byte : bytes)
+        if (memory->read_byte(byte.first) != byte.second){
+            snprintf(text, sizeof(text), " (%04x) %02x (%02x)", byte.first, memory->read_byte(byte.first), byte.second);
+            out += text;
+        }
+    return out;
+}
+
+// The memory is filled with DE AD BE EF before each test, as the FUSE core test does. The halted flag
+// is not compared, the core has none.
+int Z80_Test::run_fuse(const char *tests, const char *expected){
+    FILE *in = fopen(tests, "r");
+    FILE *out = fopen(expected, "r");
+    if (!in || !out){
+        printf("WARN: Open FUSE tests %s.\n", !in ? tests : expected);
+        if (in)
+            fclose(in);
+        if (out)
+            fclose(out);
+        return 1;
+    }
+    u8 *page = new u8[PAGE_SIZE]();
+    ULA *memory = flat_memory(page);
+    Z80 *cpu = new Z80();
+    Test_IO io(memory, cpu);
+    int count = 0, failed = 0;
+    char name[256], expected_name[256];
+    while (read_line(in, name, sizeof(name))){
+        if (!name[0])
+            continue;
+        Fuse_State state, result;
+        std::vector<std::pair<u16, u8>> bytes, result_bytes;
+        if (!read_state(in, state)){
+            printf("WARN: FUSE test %s.\n", name);
+            break;
+        }
+        read_memory(in, bytes);
+        do{
+            if (!read_line(out, expected_name, sizeof(expected_name))){
+                expected_name[0] = 0x00;
+                break;
+            }
+        }while (!expected_name[0]);
+        // The bus events are indented, they are not compared.
+        long pos = ftell(out);
+        char line[256];
+        while (read_line(out, line, sizeof(line)) && (line[0] == ' ' || line[0] == '\t'))
+            pos = ftell(out);
+        fseek(out, pos, SEEK_SET);
+        if (strcmp(name, expected_name) || !read_state(out, result)){
+            printf("WARN: FUSE expected %s.\n", name);
+            break;
+        }
+        read_memory(out, result_bytes);
+
+        for (u32 i = 0; i < 0x10000; i++)
+            memory->write_byte(i, "\xDE\xAD\xBE\xEF"[i & 0x03], 0);
+        for (const auto &byte : bytes)
+            memory->write_byte(byte.first, byte.second, 0);
+        for (int i = 0; i < FUSE_REGISTERS; i++)
+            *get_register(cpu, i) = state.regs[i];
+        cpu->ir = state.i << 8 | state.r;
+        cpu->r8bit = state.r & 0x80;
+        cpu->iff1 = state.iff1;
+        cpu->iff2 = state.iff2;
+        cpu->im = state.im;
+        cpu->clk = 0;
+        cpu->frame(memory, &io, state.tstates);
+        memory->frame(cpu->clk);
+
+        std::string diff = compare(cpu, memory, result, result_bytes);
+        count++;
+        if (!diff.empty()){
+            printf("FAIL %s:%s\n", name, diff.c_str());
+            failed++;
+        }
+    }
+    printf("FUSE: %d tests, %d failed.\n", count, failed);
+    fclose(in);
+    fclose(out);
+    DELETE(cpu);
+    DELETE(memory);
+    DELETE_ARRAY(page);
+    return failed || !count ? 1 : 0;
+}
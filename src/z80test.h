@@ -0,0 +1,14 @@
+// Z80 core checks without a machine around it. The memory is the ULA with the writable overlay at 0x0000, 64K of RAM,
+// the ports read their high byte as in the FUSE tests. No interrupts are taken.
+// CP/M programs (zexdoc, zexall) run from 0x0100 with BDOS functions 2 and 9 trapped at its entry, the output goes to stdout,
+// a line with "ERROR" is a failed test. The opcode fetches are counted by the R register (a prefix is one), in slices short enough for it not to wrap.
+// FUSE tests.in/tests.expected: each test runs for its T-states, the registers, the T-states and the memory listed are compared.
+
+#define Z80TEST_BDOS                0xFE00                  // BDOS entry, the stack is below.
+#define Z80TEST_SLICE               480                     // T-states, less than 128 opcode fetches.
+#define Z80TEST_FRAME               71680                   // T-states the ULA beam is wrapped at.
+
+namespace Z80_Test {
+    int run_cpm(const char *path);
+    int run_fuse(const char *tests, const char *expected);
+}
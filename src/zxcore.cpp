@@ -0,0 +1,211 @@
+#include <cstddef>
+#include <limits.h>
+#include <stdexcept>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <deque>
+#include <string>
+#include "types.h"
+#include "utils.h"
+#include "config.h"
+#include "device.h"
+#include "memory.h"
+#include "ula.h"
+#include "z80.h"
+#include "filemap.h"
+#include "disk.h"
+#include "floppy.h"
+#include "divmmc.h"
+#include "keyboard.h"
+#include "joystick.h"
+#include "tape.h"
+#include "recorder.h"
+#include "sound.h"
+#include "snapshot.h"
+#include "movie.h"
+#include "netplay.h"
+#include "gdb.h"
+#include "mouse.h"
+#include "rewind.h"
+#include "board.h"
+#include "zxcore.h"
+
+struct zx_machine {
+    Cfg cfg;
+    Board *board = NULL;
+    u16 frame_buffer[DISPLAY_WIDTH * DISPLAY_HEIGHT] = {};
+};
+
+struct zx_state {
+    Board_State state;
+};
+
+// The buffers are loaded as in-memory files under a name no real file has, the disk image is not written back then.
+static std::string memory_path(zx_machine *machine, const char *name){
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "zxcore:%p/", (void*)machine);
+    return prefix + std::string(name);
+}
+
+// The ROM images go to the board as in-memory files for the time it's made, it copies them.
+static zx_machine* create_board(zx_machine *machine, const void *const roms[3], const size_t rom_sizes[3], zx_machine *parent){
+    std::string paths[ZX_ROM_48 + 1];
+    for (int i = ZX_ROM_TRDOS; roms && i <= ZX_ROM_48; i++){
+        if (!roms[i])
+            continue;
+        paths[i] = memory_path(machine, "rom") + char('0' + i);
+        File_Map::add(paths[i].c_str(), roms[i], rom_sizes[i]);
+        snprintf(machine->cfg.main.rom_path[i], sizeof(machine->cfg.main.rom_path[i]), "%s", paths[i].c_str());
+    }
+    try{
+        machine->board = new Board(machine->cfg);
+        if (parent)
+            machine->board->fork(*parent->board);
+        machine->board->ula.frame_setup(machine->frame_buffer);
+    }catch (const std::exception &e){
+        printf("WARN: %s.\n", e.what());
+    }
+    for (const std::string &path : paths)
+        if (!path.empty())
+            File_Map::remove(path.c_str());
+    if (!machine->board)
+        DELETE(machine);
+    return machine;
+}
+
+zx_machine* zx_create(int model, const void *const roms[3], const size_t rom_sizes[3]){
+    if (model < ZX_PENTAGON_128 || model > ZX_SINCLAIR_48)
+        return NULL;
+    zx_machine *machine = new zx_machine;
+    machine->cfg.main.model = model;
+    machine->cfg.main.rewind_size = 0;
+    return create_board(machine, roms, rom_sizes, NULL);
+}
+
+// The ROMs are taken from the parent as it has them, the paths it was made with may be gone.
+zx_machine* zx_fork(zx_machine *parent){
+    zx_machine *machine = new zx_machine;
+    machine->cfg = parent->cfg;
+    const void *roms[ZX_ROM_48 + 1];
+    size_t rom_sizes[ZX_ROM_48 + 1];
+    for (int i = ZX_ROM_TRDOS; i <= ZX_ROM_48; i++){
+        roms[i] = parent->board->ula.read_rom((ROM_Bank)i);
+        rom_sizes[i] = PAGE_SIZE;
+    }
+    return create_board(machine, roms, rom_sizes, parent);
+}
+
+void zx_destroy(zx_machine *machine){
+    if (machine)
+        DELETE(machine->board);
+    DELETE(machine);
+}
+
+// The screen starts over with the reset.
+void zx_reset(zx_machine *machine){
+    machine->board->reset();
+    machine->board->ula.frame_setup(machine->frame_buffer);
+}
+
+int zx_load(zx_machine *machine, const char *name, const void *data, size_t size){
+    std::string path = memory_path(machine, name);
+    File_Map::add(path.c_str(), data, size);
+    int result = zx_load_file(machine, path.c_str());
+    File_Map::remove(path.c_str());
+    return result;
+}
+
+int zx_load_file(zx_machine *machine, const char *path){
+    try{
+        return machine->board->load_file(path);
+    }catch (const std::exception &e){
+        printf("WARN: %s.\n", e.what());
+        return 0;
+    }
+}
+
+int zx_save_file(zx_machine *machine, const char *path){
+    try{
+        return machine->board->save_file(path);
+    }catch (const std::exception &e){
+        printf("WARN: %s.\n", e.what());
+        return 0;
+    }
+}
+
+void zx_run_frames(zx_machine *machine, int frames){
+    for (int i = 0; i < frames; i++){
+        machine->board->frame();
+        machine->board->ula.frame_setup(machine->frame_buffer);
+    }
+}
+
+void zx_run_tstates(zx_machine *machine, int32_t tstates){
+    machine->board->run_clk(tstates, machine->frame_buffer);
+}
+
+int32_t zx_frame_tstates(zx_machine *machine){
+    return machine->board->frame_clk;
+}
+
+const uint16_t* zx_framebuffer(zx_machine *machine, int *width, int *height){
+    if (width)
+        *width = DISPLAY_WIDTH;
+    if (height)
+        *height = DISPLAY_HEIGHT;
+    return machine->frame_buffer;
+}
+
+const int16_t* zx_audio(zx_machine *machine, int *samples, int *sample_rate){
+    if (samples)
+        *samples = machine->board->sound.get_samples();
+    if (sample_rate)
+        *sample_rate = machine->board->sound.get_sample_rate();
+    return machine->board->sound.get_buffer();
+}
+
+void zx_set_key(zx_machine *machine, uint16_t port, uint8_t mask, int pressed){
+    machine->board->keyboard.button(port, mask, pressed);
+}
+
+void zx_set_keyboard(zx_machine *machine, const uint8_t rows[8]){
+    machine->board->keyboard.set_state(rows);
+}
+
+void zx_set_joystick(zx_machine *machine, uint8_t kempston){
+    machine->board->joystick.button(0x3F, false);
+    machine->board->joystick.button(kempston & 0x3F, true);
+}
+
+zx_state* zx_save_state(zx_machine *machine){
+    zx_state *state = new zx_state;
+    machine->board->save_state(state->state);
+    return state;
+}
+
+int zx_load_state(zx_machine *machine, const zx_state *state){
+    if (!state || !state->state.valid)
+        return 0;
+    machine->board->load_state(state->state);
+    return 1;
+}
+
+void zx_free_state(zx_state *state){
+    DELETE(state);
+}
+
+uint32_t zx_state_hash(zx_machine *machine){
+    return machine->board->state_hash();
+}
+
+uint8_t zx_peek(zx_machine *machine, uint16_t addr){
+    return machine->board->ula.read_byte(addr);
+}
+
+void zx_poke(zx_machine *machine, uint16_t addr, uint8_t value){
+    machine->board->ula.write_byte(addr, value, machine->board->cpu_state().clk);
+}
@@ -0,0 +1,67 @@
+// C interface of the emulation core, the library has no SDL, GL or ImGui in it.
+// A machine keeps its own configuration, the calls on one machine go from one thread.
+// The functions returning int give 1 on success and 0 on error, the errors are printed to stdout as the emulator does.
+
+#ifndef ZXCORE_H
+#define ZXCORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum { ZX_PENTAGON_128, ZX_SINCLAIR_128, ZX_SINCLAIR_48 };  // Models.
+enum { ZX_ROM_TRDOS, ZX_ROM_128, ZX_ROM_48 };               // ROM images.
+
+#define ZX_DISPLAY_WIDTH            320
+#define ZX_DISPLAY_HEIGHT           240
+
+typedef struct zx_machine zx_machine;
+typedef struct zx_state zx_state;
+
+// The ROM images are taken from memory, a NULL one is read from data/rom as the emulator does.
+zx_machine* zx_create(int model, const void *const roms[3], const size_t rom_sizes[3]);
+void zx_destroy(zx_machine *machine);
+void zx_reset(zx_machine *machine);
+// A new machine going on from the state of the parent, the memory pages are shared until written and the forks may run
+// on threads of their own. The parent must not run during the call. The media is not shared, the fork has none loaded.
+zx_machine* zx_fork(zx_machine *parent);
+
+// The format goes by the name extension as in the emulator: .z80 .sna .szx .zxm .trd .scl .udi .fdi .td0 .img .tap .tzx .csw.
+// The data is copied, the buffer may be freed after the call.
+int zx_load(zx_machine *machine, const char *name, const void *data, size_t size);
+int zx_load_file(zx_machine *machine, const char *path);
+int zx_save_file(zx_machine *machine, const char *path);
+
+// Whole instructions are run, the last one may go over the count. The frames are finished on the way.
+void zx_run_frames(zx_machine *machine, int frames);
+void zx_run_tstates(zx_machine *machine, int32_t tstates);
+int32_t zx_frame_tstates(zx_machine *machine);
+
+// RGBA4444 pixels, the screen with the border. Valid until the machine is destroyed.
+const uint16_t* zx_framebuffer(zx_machine *machine, int *width, int *height);
+// Interleaved stereo samples of the last frame run. Valid until the next run or load.
+const int16_t* zx_audio(zx_machine *machine, int *samples, int *sample_rate);
+
+// The keyboard half-row port (7FFE ... FEFE) and the key bits, the row bits are 0 for the keys pressed.
+void zx_set_key(zx_machine *machine, uint16_t port, uint8_t mask, int pressed);
+void zx_set_keyboard(zx_machine *machine, const uint8_t rows[8]);
+// Kempston bits from bit 0: right, left, down, up, fire, second fire, 1 for the pressed.
+void zx_set_joystick(zx_machine *machine, uint8_t kempston);
+
+// The state is the machine in memory, the loaded tape and disk images are not a part of it.
+zx_state* zx_save_state(zx_machine *machine);
+int zx_load_state(zx_machine *machine, const zx_state *state);
+void zx_free_state(zx_state *state);
+uint32_t zx_state_hash(zx_machine *machine);
+
+uint8_t zx_peek(zx_machine *machine, uint16_t addr);
+void zx_poke(zx_machine *machine, uint16_t addr, uint8_t value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif